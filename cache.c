@@ -1,44 +1,2051 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "cache.h"
 
+//Number of distinct (disk_num, block_num) keys, one slot per block in the JBOD.
+#define CACHE_NUM_KEYS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+//Marks an empty index slot or the end of a list.
+#define CACHE_NIL -1
+
+//Lists an entry can be linked on. Resident entries live on T1/T2, ghost keys
+//(blocks recently evicted, remembered without their data) live on B1/B2.
+//  LRU:   T1 is the recency list.
+//  CLOCK: no lists, entries are swept in array order by the clock hand.
+//  2Q:    T1 is A1in (FIFO), T2 is Am (LRU), B1 is A1out (ghost FIFO).
+//  ARC:   T1/T2 hold blocks seen once/more than once, B1/B2 their ghosts.
+enum { LIST_NONE, LIST_T1, LIST_T2, LIST_B1, LIST_B2, NUM_LISTS };
+
+typedef struct {
+  int head;  //most recently inserted end
+  int tail;  //eviction end
+  int size;
+} cache_list_t;
+
+//Per block state, indexed by cache_key(disk_num, block_num).
+typedef struct {
+  int slot;        //position of the resident entry in |cache|, or CACHE_NIL
+  int ghost_prev;  //links on the ghost list B1 or B2
+  int ghost_next;
+  uint8_t ghost_list;
+} cache_key_t;
+
+//Counters of one thread. Each thread gets its own cache line, so counting a hit
+//never touches a line another thread writes.
+typedef struct {
+  int queries;
+  int hits;
+  int prefetch_used;   //prefetched blocks that were looked up
+  int prefetch_wasted; //prefetched blocks dropped before anyone asked for them
+  int validated;       //snapshot blocks found current on first use
+  int stale;           //snapshot blocks found out of date on first use
+  int evictions;       //blocks dropped to make room for others
+  int collisions;      //inserts of a block that was already cached
+} __attribute__((aligned(64))) cache_stats_t;
+
+//Threads past the first CACHE_MAX_THREADS share the last slot, the counters are atomic.
+#define CACHE_MAX_THREADS 64
+#define STAT_ADD(field) __atomic_fetch_add(&thread_stats()->field, 1, __ATOMIC_RELAXED)
+
+//Concurrent mode: one entry of a shard. Readers copy it without the shard lock and
+//retry if |seq| was odd or changed meanwhile, see shard_lookup.
+typedef struct {
+  uint32_t seq;
+  int key;          //cache_key of the block, CACHE_NIL while free
+  bool referenced;  //CLOCK reference bit
+  bool dirty;
+  bool prefetched;
+  uint8_t block[JBOD_BLOCK_SIZE];
+} __attribute__((aligned(64))) shard_entry_t;
+
+//Concurrent mode: a shard owns the keys with key % num_shards equal to its number
+//and evicts among its own entries with CLOCK, under its own lock.
+typedef struct {
+  pthread_mutex_t lock;
+  shard_entry_t *entries;
+  int size;
+  int used;
+  int hand;
+} __attribute__((aligned(64))) cache_shard_t;
+
+//Shared mode: one entry of the segment, evicted with CLOCK.
+typedef struct {
+  int key;          //cache_key of the block, CACHE_NIL while free
+  bool referenced;  //CLOCK reference bit
+  bool dirty;
+  bool prefetched;
+  uint8_t block[JBOD_BLOCK_SIZE];
+} shm_entry_t;
+
+//Shared mode: the head of the segment, followed by the entries at the next 64-byte boundary.
+#define SHM_MAGIC 0x434d4853444f424aULL //"JBODSHMC" in memory order
+typedef struct {
+  uint64_t magic;
+  uint32_t ready;         //set once the creating process has initialized the segment
+  pthread_mutex_t lock;   //process shared and robust, guards everything below
+  int size;
+  int used;
+  int hand;
+  int num_dirty;
+  int busy;               //entry being changed under the lock, dropped if its owner dies
+  uint32_t recovered;     //times the lock was taken over from a dead process
+  int slots[CACHE_NUM_KEYS];
+} shm_header_t;
+
+//Snapshot file: a header, then the cached blocks from least to most recently used.
+#define SNAPSHOT_MAGIC 0x50414e53444f424aULL //"JBODSNAP" in file order
+#define SNAPSHOT_VERSION 1
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t count;
+} snapshot_header_t;
+
+typedef struct {
+  uint16_t disk_num;
+  uint16_t block_num;
+  uint8_t block[JBOD_BLOCK_SIZE];
+} snapshot_entry_t;
+
+//Extent mode: a run of up to EXTENT_MAX_BLOCKS consecutive blocks of one disk. Bit i of
+//the masks is about block start + i.
+#define EXTENT_MAX_BLOCKS 64
+typedef struct {
+  int disk_num;
+  int start;           //first block of the run
+  int count;           //blocks in the run, 0 while the extent is free
+  int capacity;        //blocks |data| has room for
+  uint64_t dirty;
+  uint64_t prefetched;
+  int access_time;
+  int prev;            //LRU links, or the free list through |next|
+  int next;
+  uint8_t *data;       //the blocks of the run, back to back
+} cache_extent_t;
+
 static cache_entry_t *cache = NULL;
 static int cache_size = 0;
-static int clock = 0;
-static int num_queries = 0;
-static int num_hits = 0;
+static int access_clock = 0;
+static cache_stats_t stats[CACHE_MAX_THREADS];
+static int num_stats = 0;
+static __thread cache_stats_t *local_stats = NULL;
+
+static cache_policy_t policy = CACHE_POLICY_LRU;
+//Hash index from cache_key(disk_num, block_num) to the block's cache state.
+static cache_key_t *cache_keys = NULL;
+//Number of entries handed out so far, entries below this position are valid unless they
+//were dropped since. Dropped entries are chained from |free_head| through |next|.
+static int num_used = 0;
+static int free_head = CACHE_NIL;
+static cache_list_t lists[NUM_LISTS];
+//CLOCK hand, the next entry considered for eviction.
+static int clock_hand = 0;
+//ARC target size for T1.
+static int arc_p = 0;
+//Write-back mode: called to write a dirty block to disk before its entry is reused.
+static cache_writeback_fn writeback = NULL;
+static int num_dirty = 0;
+//Snapshots: called to check a block loaded from a snapshot before its first use.
+static cache_validate_fn validate = NULL;
+//Serializes every public function; handles on different threads share the cache.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//Concurrent mode: the shards, all their entries, and the entry holding each key.
+static cache_shard_t *shards = NULL;
+static int num_shards = 0;
+static shard_entry_t *shard_entries = NULL;
+static int *shard_slots = NULL;
+
+//Set-associative mode: tags, LRU stamps and flags of set s live in row s of their arrays,
+//ASSOC_ROW ways per row. Tags are key + 1, ASSOC_FREE for an empty way. The payloads are
+//packed set by set in a separate 64-byte aligned slab.
+#define ASSOC_ROW 16
+#define ASSOC_FREE 0
+#define ASSOC_PAD 0xffff
+#define ASSOC_DIRTY 0x1
+#define ASSOC_PREFETCHED 0x2
+#define ASSOC_HUGE_PAGE (2 * 1024 * 1024)
+static uint16_t *assoc_tags = NULL;
+static uint32_t *assoc_stamps = NULL;
+static uint8_t *assoc_flags = NULL;
+static uint8_t *assoc_slab = NULL;
+static size_t assoc_slab_len = 0;
+static bool assoc_slab_mapped = false;
+static int num_sets = 0;
+static int assoc_ways = 0;
+//Finds |tag| in a row of tags and returns its way, or -1; picked from the CPU's features.
+static int (*assoc_match)(const uint16_t *row, uint16_t tag);
+
+//Extent mode: the extents, the extent holding each key, the free extents and the LRU list.
+//|cache_size| counts blocks, whatever the number of extents holding them.
+static cache_extent_t *extents = NULL;
+static int16_t *extent_of = NULL;
+static int extent_free = CACHE_NIL;
+static int extent_blocks = 0;
+static cache_list_t extent_lru;
+
+//Shared mode: this process's mapping of the segment.
+static shm_header_t *shm = NULL;
+static shm_entry_t *shm_entries = NULL;
+static size_t shm_len = 0;
+
+static const char *policy_names[CACHE_NUM_POLICIES] = {
+  "lru",
+  "clock",
+  "2q",
+  "arc",
+};
+
+//Returns the counters of the calling thread.
+static cache_stats_t *thread_stats(void) {
+  if(local_stats == NULL) {
+    int slot = __atomic_fetch_add(&num_stats, 1, __ATOMIC_RELAXED);
+    local_stats = &stats[slot < CACHE_MAX_THREADS ? slot : CACHE_MAX_THREADS - 1];
+  }
+  return local_stats;
+}
+
+//Adds up the counters of every thread.
+static cache_stats_t stats_total(void) {
+  cache_stats_t total = {0};
+  for(int slot = 0; slot < CACHE_MAX_THREADS; slot++) {
+    total.queries += __atomic_load_n(&stats[slot].queries, __ATOMIC_RELAXED);
+    total.hits += __atomic_load_n(&stats[slot].hits, __ATOMIC_RELAXED);
+    total.prefetch_used += __atomic_load_n(&stats[slot].prefetch_used, __ATOMIC_RELAXED);
+    total.prefetch_wasted += __atomic_load_n(&stats[slot].prefetch_wasted, __ATOMIC_RELAXED);
+    total.validated += __atomic_load_n(&stats[slot].validated, __ATOMIC_RELAXED);
+    total.stale += __atomic_load_n(&stats[slot].stale, __ATOMIC_RELAXED);
+    total.evictions += __atomic_load_n(&stats[slot].evictions, __ATOMIC_RELAXED);
+    total.collisions += __atomic_load_n(&stats[slot].collisions, __ATOMIC_RELAXED);
+  }
+  return total;
+}
+
+static void stats_reset(void) {
+  for(int slot = 0; slot < CACHE_MAX_THREADS; slot++) {
+    __atomic_store_n(&stats[slot].queries, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[slot].hits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[slot].prefetch_used, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[slot].prefetch_wasted, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[slot].validated, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[slot].stale, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[slot].evictions, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[slot].collisions, 0, __ATOMIC_RELAXED);
+  }
+}
+
+//aligned_alloc on a cache line, C11 wants the size to be a multiple of the alignment.
+static void *line_alloc(size_t len) {
+  return aligned_alloc(64, (len + 63) / 64 * 64);
+}
+
+static inline bool valid_block(int disk_num, int block_num) {
+  return block_num >= 0 && block_num < JBOD_NUM_BLOCKS_PER_DISK && disk_num >= 0 && disk_num < JBOD_NUM_DISKS;
+}
+
+//Hashes a disk and block number into the index. The JBOD has exactly
+//CACHE_NUM_KEYS blocks, so this is a perfect hash and buckets never collide.
+static inline int cache_key(int disk_num, int block_num) {
+  return disk_num * JBOD_NUM_BLOCKS_PER_DISK + block_num;
+}
+
+static inline int entry_key(int index) {
+  return cache_key(cache[index].disk_num, cache[index].block_num);
+}
+
+//Unlinks resident entry |index| from the list it is on.
+static void list_unlink(int index) {
+  cache_entry_t *entry = &cache[index];
+  cache_list_t *list = &lists[entry->list];
+  if(entry->prev != CACHE_NIL) {
+    cache[entry->prev].next = entry->next;
+  } else {
+    list->head = entry->next;
+  }
+  if(entry->next != CACHE_NIL) {
+    cache[entry->next].prev = entry->prev;
+  } else {
+    list->tail = entry->prev;
+  }
+  list->size -= 1;
+  entry->prev = CACHE_NIL;
+  entry->next = CACHE_NIL;
+  entry->list = LIST_NONE;
+}
+
+//Links resident entry |index| at the head (most recent end) of list |id|.
+static void list_push_front(int id, int index) {
+  cache_entry_t *entry = &cache[index];
+  cache_list_t *list = &lists[id];
+  entry->prev = CACHE_NIL;
+  entry->next = list->head;
+  if(list->head != CACHE_NIL) {
+    cache[list->head].prev = index;
+  } else {
+    list->tail = index;
+  }
+  list->head = index;
+  list->size += 1;
+  entry->list = id;
+}
+
+//Moves resident entry |index| to the head of list |id|.
+static void list_move_front(int id, int index) {
+  if(cache[index].list == id && lists[id].head == index) {
+    return;
+  }
+  list_unlink(index);
+  list_push_front(id, index);
+}
+
+//Removes ghost |key| from the ghost list it is on.
+static void ghost_unlink(int key) {
+  cache_key_t *ghost = &cache_keys[key];
+  cache_list_t *list = &lists[ghost->ghost_list];
+  if(ghost->ghost_prev != CACHE_NIL) {
+    cache_keys[ghost->ghost_prev].ghost_next = ghost->ghost_next;
+  } else {
+    list->head = ghost->ghost_next;
+  }
+  if(ghost->ghost_next != CACHE_NIL) {
+    cache_keys[ghost->ghost_next].ghost_prev = ghost->ghost_prev;
+  } else {
+    list->tail = ghost->ghost_prev;
+  }
+  list->size -= 1;
+  ghost->ghost_prev = CACHE_NIL;
+  ghost->ghost_next = CACHE_NIL;
+  ghost->ghost_list = LIST_NONE;
+}
+
+//Remembers |key| at the head of ghost list |id|.
+static void ghost_push_front(int id, int key) {
+  cache_key_t *ghost = &cache_keys[key];
+  cache_list_t *list = &lists[id];
+  ghost->ghost_prev = CACHE_NIL;
+  ghost->ghost_next = list->head;
+  if(list->head != CACHE_NIL) {
+    cache_keys[list->head].ghost_prev = key;
+  } else {
+    list->tail = key;
+  }
+  list->head = key;
+  list->size += 1;
+  ghost->ghost_list = id;
+}
+
+//Forgets the oldest ghost on list |id|.
+static void ghost_drop_tail(int id) {
+  if(lists[id].tail != CACHE_NIL) {
+    ghost_unlink(lists[id].tail);
+  }
+}
+
+//Writes dirty entry |index| back to disk and marks it clean.
+static int cache_clean(int index) {
+  if(writeback == NULL || writeback(cache[index].disk_num, cache[index].block_num, cache[index].block) == -1) {
+    return -1;
+  }
+  cache[index].dirty = false;
+  num_dirty -= 1;
+  return 1;
+}
+
+//Writes dirty entry |index| back with cache_lock released, so other threads are
+//not held up behind the round trip. The entry stays cached meanwhile and is only
+//marked clean if it still holds the bytes that reached the disk. Called with
+//cache_lock held, returns -1 if the write-back failed.
+static int cache_clean_unlocked(int index) {
+  uint8_t block[JBOD_BLOCK_SIZE];
+  int disk_num = cache[index].disk_num;
+  int block_num = cache[index].block_num;
+  cache_writeback_fn fn = writeback;
+  if(fn == NULL) {
+    return -1;
+  }
+  memcpy(block, cache[index].block, JBOD_BLOCK_SIZE);
+  pthread_mutex_unlock(&cache_lock);
+  int rc = fn(disk_num, block_num, block);
+  pthread_mutex_lock(&cache_lock);
+  if(rc == -1) {
+    return -1;
+  }
+  int now = cache != NULL ? cache_keys[cache_key(disk_num, block_num)].slot : CACHE_NIL;
+  if(now != CACHE_NIL && cache[now].dirty && memcmp(cache[now].block, block, JBOD_BLOCK_SIZE) == 0) {
+    cache[now].dirty = false;
+    num_dirty -= 1;
+  }
+  return 1;
+}
+
+//True when every entry holds a block, so a new one needs a victim.
+static inline bool cache_full(void) {
+  return num_used == cache_size && free_head == CACHE_NIL;
+}
+
+//Hands out an entry holding no block, a dropped one first. The cache must not be full.
+static int cache_free_entry(void) {
+  if(free_head == CACHE_NIL) {
+    return num_used++;
+  }
+  int index = free_head;
+  free_head = cache[index].next;
+  cache[index].next = CACHE_NIL;
+  return index;
+}
+
+//Drops clean entry |index| without remembering it on a ghost list, for a block found stale.
+static void cache_drop(int index) {
+  if(cache[index].list != LIST_NONE) {
+    list_unlink(index);
+  }
+  cache[index].valid = false;
+  cache_keys[entry_key(index)].slot = CACHE_NIL;
+  cache[index].next = free_head;
+  free_head = index;
+}
+
+//Evicts resident entry |index| and returns it for reuse. If |ghost| is not
+//LIST_NONE the evicted block is remembered on that ghost list. Returns CACHE_NIL
+//and leaves the entry alone if it is dirty and cannot be written back.
+static int cache_evict(int index, int ghost) {
+  int key = entry_key(index);
+  //A dirty block is the only up to date copy, it stays cached until it reaches the disk.
+  if(cache[index].dirty && cache_clean(index) == -1) {
+    return CACHE_NIL;
+  }
+  if(cache[index].prefetched) {
+    STAT_ADD(prefetch_wasted);
+  }
+  STAT_ADD(evictions);
+  if(cache[index].list != LIST_NONE) {
+    list_unlink(index);
+  }
+  cache[index].valid = false;
+  cache_keys[key].slot = CACHE_NIL;
+  if(ghost != LIST_NONE) {
+    ghost_push_front(ghost, key);
+  }
+  return index;
+}
+
+//CLOCK: sweeps the hand past referenced entries, clearing their bit, and
+//returns the first unreferenced entry.
+static int clock_victim(void) {
+  while(cache[clock_hand].referenced) {
+    cache[clock_hand].referenced = false;
+    clock_hand = (clock_hand + 1) % cache_size;
+  }
+  int victim = clock_hand;
+  clock_hand = (clock_hand + 1) % cache_size;
+  return victim;
+}
+
+//2Q: frees an entry, preferring the A1in FIFO while it is over its quarter
+//share. Blocks leaving A1in are remembered on A1out, which holds up to half
+//the cache size worth of ghosts.
+static int twoq_reclaim(void) {
+  int kin = cache_size / 4 > 0 ? cache_size / 4 : 1;
+  int kout = cache_size / 2 > 0 ? cache_size / 2 : 1;
+  if(lists[LIST_T1].size > kin || lists[LIST_T2].size == 0) {
+    if(lists[LIST_B1].size >= kout) {
+      ghost_drop_tail(LIST_B1);
+    }
+    return cache_evict(lists[LIST_T1].tail, LIST_B1);
+  }
+  return cache_evict(lists[LIST_T2].tail, LIST_NONE);
+}
+
+//ARC: the entry REPLACE picks for target |p|, the tail of T1 or of T2.
+static int arc_victim(bool in_b2, int p) {
+  int t1 = lists[LIST_T1].size;
+  if(t1 > 0 && ((in_b2 && t1 == p) || t1 > p || lists[LIST_T2].size == 0)) {
+    return lists[LIST_T1].tail;
+  }
+  return lists[LIST_T2].tail;
+}
+
+//ARC: the REPLACE routine, evicting from T1 or T2 depending on the target p.
+static int arc_replace(bool in_b2) {
+  int victim = arc_victim(in_b2, arc_p);
+  return cache_evict(victim, cache[victim].list == LIST_T1 ? LIST_B1 : LIST_B2);
+}
+
+//ARC: the target p after a miss on block |key|, which moves it on a ghost hit.
+static int arc_adapted_p(int key) {
+  int b1 = lists[LIST_B1].size;
+  int b2 = lists[LIST_B2].size;
+  if(cache_keys[key].ghost_list == LIST_B1) {
+    //Recently evicted from T1: grow T1's target.
+    int delta = (b2 / b1) > 1 ? (b2 / b1) : 1;
+    return (arc_p + delta < cache_size) ? arc_p + delta : cache_size;
+  }
+  if(cache_keys[key].ghost_list == LIST_B2) {
+    //Recently evicted from T2: shrink T1's target.
+    int delta = (b1 / b2) > 1 ? (b1 / b2) : 1;
+    return (arc_p - delta > 0) ? arc_p - delta : 0;
+  }
+  return arc_p;
+}
+
+//ARC: makes room for block |key| on a miss, adapting p when it is a ghost
+//hit, and returns the entry to fill along with the list to put it on.
+static int arc_reclaim(int key, int *list) {
+  cache_key_t *state = &cache_keys[key];
+  bool full = cache_full();
+  int b1 = lists[LIST_B1].size;
+  int b2 = lists[LIST_B2].size;
+
+  if(state->ghost_list == LIST_B1) {
+    arc_p = arc_adapted_p(key);
+    ghost_unlink(key);
+    *list = LIST_T2;
+    return full ? arc_replace(false) : cache_free_entry();
+  }
+  if(state->ghost_list == LIST_B2) {
+    arc_p = arc_adapted_p(key);
+    ghost_unlink(key);
+    *list = LIST_T2;
+    return full ? arc_replace(true) : cache_free_entry();
+  }
+
+  //Complete miss, keep |T1| + |B1| <= c and the directory at most 2c.
+  *list = LIST_T1;
+  int t1 = lists[LIST_T1].size;
+  if(t1 + b1 >= cache_size) {
+    if(t1 < cache_size) {
+      ghost_drop_tail(LIST_B1);
+      return full ? arc_replace(false) : cache_free_entry();
+    }
+    return cache_evict(lists[LIST_T1].tail, LIST_NONE);
+  }
+  if(t1 + b1 + lists[LIST_T2].size + b2 >= 2 * cache_size) {
+    ghost_drop_tail(LIST_B2);
+  }
+  return full ? arc_replace(false) : cache_free_entry();
+}
+
+//Counts the first access to prefetched entry |index|.
+static void cache_used(int index) {
+  if(cache[index].prefetched) {
+    cache[index].prefetched = false;
+    STAT_ADD(prefetch_used);
+  }
+}
+
+//Checks entry |index| against the disk if it came from a snapshot. Returns true if it is
+//current. A stale entry is dropped, so the block is only checked once. If the check
+//itself failed the entry stays unverified and is tried again on the next use.
+static bool cache_verify(int index) {
+  if(!cache[index].unverified) {
+    return true;
+  }
+  int rc = validate != NULL ? validate(cache[index].disk_num, cache[index].block_num, cache[index].block) : 0;
+  if(rc == 1) {
+    cache[index].unverified = false;
+    STAT_ADD(validated);
+    return true;
+  }
+  if(rc == 0) {
+    STAT_ADD(stale);
+    cache_drop(index);
+  }
+  return false;
+}
+
+//Records a hit on resident entry |index| according to the policy.
+static void cache_touch(int index) {
+  access_clock += 1;
+  cache[index].access_time = access_clock;
+  switch(policy) {
+    case CACHE_POLICY_CLOCK:
+      cache[index].referenced = true;
+      break;
+    case CACHE_POLICY_2Q:
+      //A hit in A1in leaves the block in the FIFO, only Am is reordered.
+      if(cache[index].list == LIST_T2) {
+        list_move_front(LIST_T2, index);
+      }
+      break;
+    case CACHE_POLICY_ARC:
+      list_move_front(LIST_T2, index);
+      break;
+    default:
+      list_move_front(LIST_T1, index);
+      break;
+  }
+}
+
+//Picks the entry to hold newly inserted block |key| and the list it goes on.
+static int cache_reclaim(int key, int *list) {
+  *list = LIST_T1;
+  switch(policy) {
+    case CACHE_POLICY_CLOCK:
+      *list = LIST_NONE;
+      return !cache_full() ? cache_free_entry() : cache_evict(clock_victim(), LIST_NONE);
+    case CACHE_POLICY_2Q:
+      //A block remembered on A1out was reused soon after eviction, promote it to Am.
+      if(cache_keys[key].ghost_list == LIST_B1) {
+        ghost_unlink(key);
+        *list = LIST_T2;
+      }
+      return !cache_full() ? cache_free_entry() : twoq_reclaim();
+    case CACHE_POLICY_ARC:
+      return arc_reclaim(key, list);
+    default:
+      return !cache_full() ? cache_free_entry() : cache_evict(lists[LIST_T1].tail, LIST_NONE);
+  }
+}
+
+//The entry cache_reclaim would evict to make room for block |key|, without
+//changing any state, or CACHE_NIL while there is a free entry.
+static int cache_next_victim(int key) {
+  if(!cache_full()) {
+    return CACHE_NIL;
+  }
+  switch(policy) {
+    case CACHE_POLICY_CLOCK:
+      for(int i = 0; i < cache_size; i++) {
+        int index = (clock_hand + i) % cache_size;
+        if(!cache[index].referenced) {
+          return index;
+        }
+      }
+      return clock_hand;
+    case CACHE_POLICY_2Q: {
+      int kin = cache_size / 4 > 0 ? cache_size / 4 : 1;
+      return (lists[LIST_T1].size > kin || lists[LIST_T2].size == 0) ? lists[LIST_T1].tail : lists[LIST_T2].tail;
+    }
+    case CACHE_POLICY_ARC: {
+      int ghost = cache_keys[key].ghost_list;
+      if(ghost == LIST_NONE && lists[LIST_T1].size >= cache_size) {
+        return lists[LIST_T1].tail;
+      }
+      return arc_victim(ghost == LIST_B2, arc_adapted_p(key));
+    }
+    default:
+      return lists[LIST_T1].tail;
+  }
+}
+
+//Returns the position of the entry for |disk_num| and |block_num|, or CACHE_NIL if not cached.
+static inline int cache_find(int disk_num, int block_num) {
+  return cache_keys[cache_key(disk_num, block_num)].slot;
+}
+
+//Concurrent mode. Writers hold the shard lock and make |seq| odd while they change an
+//entry; readers copy the entry between two reads of |seq| and retry if it moved.
+static void shard_write_begin(shard_entry_t *entry) {
+  __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void shard_write_end(shard_entry_t *entry) {
+  __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+}
+
+//The block is copied with plain memcpy on both sides. A reader racing with a writer may
+//copy a torn block, but then it sees |seq| move and throws the copy away.
+static void shard_store_block(shard_entry_t *entry, const uint8_t *buf) {
+  memcpy(entry->block, buf, JBOD_BLOCK_SIZE);
+}
+
+static void shard_load_block(shard_entry_t *entry, uint8_t *buf) {
+  memcpy(buf, entry->block, JBOD_BLOCK_SIZE);
+}
+
+static inline cache_shard_t *shard_of(int key) {
+  return &shards[key % num_shards];
+}
+
+//Returns the entry holding |key|. Only stable while the key's shard is locked.
+static inline shard_entry_t *shard_find(int key) {
+  int slot = __atomic_load_n(&shard_slots[key], __ATOMIC_ACQUIRE);
+  return slot == CACHE_NIL ? NULL : &shard_entries[slot];
+}
+
+static int shard_create(int num_entries, int new_num_shards) {
+  if(new_num_shards < 1 || new_num_shards > num_entries) {
+    return -1;
+  }
+  shards = line_alloc(new_num_shards * sizeof(cache_shard_t));
+  shard_entries = line_alloc(num_entries * sizeof(shard_entry_t));
+  shard_slots = malloc(CACHE_NUM_KEYS * sizeof(int));
+  if(shards == NULL || shard_entries == NULL || shard_slots == NULL) {
+    free(shards);
+    free(shard_entries);
+    free(shard_slots);
+    shards = NULL;
+    shard_entries = NULL;
+    shard_slots = NULL;
+    return -1;
+  }
+  memset(shard_entries, 0, num_entries * sizeof(shard_entry_t));
+  for(int key = 0; key < CACHE_NUM_KEYS; key++) {
+    shard_slots[key] = CACHE_NIL;
+  }
+  //Spread the entries evenly, the first shards take the remainder
+  int first = 0;
+  for(int id = 0; id < new_num_shards; id++) {
+    cache_shard_t *shard = &shards[id];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->entries = &shard_entries[first];
+    shard->size = num_entries / new_num_shards + (id < num_entries % new_num_shards ? 1 : 0);
+    shard->used = 0;
+    shard->hand = 0;
+    for(int index = 0; index < shard->size; index++) {
+      shard->entries[index].key = CACHE_NIL;
+    }
+    first += shard->size;
+  }
+  num_shards = new_num_shards;
+  cache_size = num_entries;
+  stats_reset();
+  return 1;
+}
+
+static int shard_destroy(void) {
+  for(int index = 0; index < cache_size; index++) {
+    if(shard_entries[index].key != CACHE_NIL && shard_entries[index].prefetched) {
+      STAT_ADD(prefetch_wasted);
+    }
+  }
+  for(int id = 0; id < num_shards; id++) {
+    pthread_mutex_destroy(&shards[id].lock);
+  }
+  free(shards);
+  free(shard_entries);
+  free(shard_slots);
+  shards = NULL;
+  shard_entries = NULL;
+  shard_slots = NULL;
+  num_shards = 0;
+  cache_size = 0;
+  num_dirty = 0;
+  return 1;
+}
+
+//Writes dirty |entry| back to disk and marks it clean. The shard must be locked.
+static int shard_clean(shard_entry_t *entry) {
+  int key = entry->key;
+  if(writeback == NULL || writeback(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, entry->block) == -1) {
+    return -1;
+  }
+  entry->dirty = false;
+  __atomic_fetch_sub(&num_dirty, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+//Writes dirty |entry| of |shard| back with the shard lock released, so lookups that
+//fall back to the lock and inserts into the shard do not wait for the round trip. The
+//entry stays cached meanwhile and is only marked clean if it still holds the bytes
+//that reached the disk. The shard must be locked.
+static int shard_clean_unlocked(cache_shard_t *shard, shard_entry_t *entry) {
+  uint8_t block[JBOD_BLOCK_SIZE];
+  int key = entry->key;
+  cache_writeback_fn fn = writeback;
+  if(fn == NULL) {
+    return -1;
+  }
+  memcpy(block, entry->block, JBOD_BLOCK_SIZE);
+  pthread_mutex_unlock(&shard->lock);
+  int rc = fn(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, block);
+  pthread_mutex_lock(&shard->lock);
+  if(rc == -1) {
+    return -1;
+  }
+  entry = shard_find(key);
+  if(entry != NULL && entry->dirty && memcmp(entry->block, block, JBOD_BLOCK_SIZE) == 0) {
+    entry->dirty = false;
+    __atomic_fetch_sub(&num_dirty, 1, __ATOMIC_RELAXED);
+  }
+  return 1;
+}
+
+//The entry shard_reclaim would evict from |shard|, without moving the hand or clearing
+//reference bits, or NULL while the shard has a free entry.
+static shard_entry_t *shard_next_victim(cache_shard_t *shard) {
+  if(shard->used < shard->size) {
+    return NULL;
+  }
+  for(int i = 0; i < shard->size; i++) {
+    shard_entry_t *entry = &shard->entries[(shard->hand + i) % shard->size];
+    if(!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED)) {
+      return entry;
+    }
+  }
+  return &shard->entries[shard->hand];
+}
+
+//Frees an entry of |shard| for a new block, evicting with CLOCK once the shard is full.
+//Returns NULL and leaves the victim alone if it is dirty and cannot be written back.
+static shard_entry_t *shard_reclaim(cache_shard_t *shard) {
+  if(shard->used < shard->size) {
+    return &shard->entries[shard->used++];
+  }
+  while(__atomic_load_n(&shard->entries[shard->hand].referenced, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&shard->entries[shard->hand].referenced, false, __ATOMIC_RELAXED);
+    shard->hand = (shard->hand + 1) % shard->size;
+  }
+  shard_entry_t *victim = &shard->entries[shard->hand];
+  shard->hand = (shard->hand + 1) % shard->size;
+  if(victim->dirty && shard_clean(victim) == -1) {
+    return NULL;
+  }
+  if(victim->prefetched) {
+    STAT_ADD(prefetch_wasted);
+  }
+  STAT_ADD(evictions);
+  //Unpublish the block before the entry changes, later lookups miss right away
+  __atomic_store_n(&shard_slots[victim->key], CACHE_NIL, __ATOMIC_RELAXED);
+  return victim;
+}
+
+static int shard_insert(int disk_num, int block_num, const uint8_t *buf, bool dirty, bool prefetched) {
+  if(buf == NULL || !valid_block(disk_num, block_num)) {
+    return -1;
+  }
+  int key = cache_key(disk_num, block_num);
+  cache_shard_t *shard = shard_of(key);
+  pthread_mutex_lock(&shard->lock);
+  for(;;) {
+    if(shard_find(key) != NULL) {
+      pthread_mutex_unlock(&shard->lock);
+      STAT_ADD(collisions);
+      return -1;
+    }
+    //A dirty victim is written back with the lock dropped, then everything is checked again
+    shard_entry_t *victim = shard_next_victim(shard);
+    if(victim == NULL || !victim->dirty) {
+      break;
+    }
+    if(shard_clean_unlocked(shard, victim) == -1) {
+      pthread_mutex_unlock(&shard->lock);
+      return -1;
+    }
+  }
+  shard_entry_t *entry = shard_reclaim(shard);
+  if(entry == NULL) {
+    pthread_mutex_unlock(&shard->lock);
+    return -1;
+  }
+  shard_write_begin(entry);
+  __atomic_store_n(&entry->key, key, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->prefetched, prefetched, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->referenced, false, __ATOMIC_RELAXED);
+  entry->dirty = dirty;
+  shard_store_block(entry, buf);
+  shard_write_end(entry);
+  if(dirty) {
+    __atomic_fetch_add(&num_dirty, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&shard_slots[key], (int)(entry - shard_entries), __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&shard->lock);
+  return 1;
+}
+
+//Copies the entry of |key| under the shard lock, for hits the optimistic path leaves alone.
+static int shard_lookup_slow(int key, uint8_t *buf) {
+  cache_shard_t *shard = shard_of(key);
+  pthread_mutex_lock(&shard->lock);
+  shard_entry_t *entry = shard_find(key);
+  if(entry == NULL) {
+    pthread_mutex_unlock(&shard->lock);
+    return -1;
+  }
+  memcpy(buf, entry->block, JBOD_BLOCK_SIZE);
+  if(entry->prefetched) {
+    __atomic_store_n(&entry->prefetched, false, __ATOMIC_RELAXED);
+    STAT_ADD(prefetch_used);
+  }
+  __atomic_store_n(&entry->referenced, true, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&shard->lock);
+  return 1;
+}
+
+//The hit path takes no lock and writes nothing shared unless the reference bit is clear.
+static int shard_lookup(int disk_num, int block_num, uint8_t *buf) {
+  if(buf == NULL || !valid_block(disk_num, block_num)) {
+    return -1;
+  }
+  int key = cache_key(disk_num, block_num);
+  STAT_ADD(queries);
+  for(;;) {
+    shard_entry_t *entry = shard_find(key);
+    if(entry == NULL) {
+      return -1;
+    }
+    uint32_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    if(seq & 1) {
+      continue;
+    }
+    int found_key = __atomic_load_n(&entry->key, __ATOMIC_RELAXED);
+    bool prefetched = __atomic_load_n(&entry->prefetched, __ATOMIC_RELAXED);
+    shard_load_block(entry, buf);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq || found_key != key) {
+      //The entry changed under us or was reused for another block, look again
+      continue;
+    }
+    if(prefetched) {
+      //First use of a prefetched block, count it exactly once under the lock
+      if(shard_lookup_slow(key, buf) == -1) {
+        return -1;
+      }
+    } else if(!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&entry->referenced, true, __ATOMIC_RELAXED);
+    }
+    STAT_ADD(hits);
+    return 1;
+  }
+}
+
+//Patches |len| bytes at |offset| of a cached block, marking it dirty if |dirty|.
+static int shard_patch(int disk_num, int block_num, int offset, int len, const uint8_t *buf, bool dirty) {
+  int key = cache_key(disk_num, block_num);
+  cache_shard_t *shard = shard_of(key);
+  pthread_mutex_lock(&shard->lock);
+  shard_entry_t *entry = shard_find(key);
+  if(entry == NULL) {
+    pthread_mutex_unlock(&shard->lock);
+    return -1;
+  }
+  uint8_t block[JBOD_BLOCK_SIZE];
+  memcpy(block, entry->block, JBOD_BLOCK_SIZE);
+  memcpy(block + offset, buf, len);
+  shard_write_begin(entry);
+  shard_store_block(entry, block);
+  shard_write_end(entry);
+  if(dirty && !entry->dirty) {
+    entry->dirty = true;
+    __atomic_fetch_add(&num_dirty, 1, __ATOMIC_RELAXED);
+  }
+  if(dirty && entry->prefetched) {
+    __atomic_store_n(&entry->prefetched, false, __ATOMIC_RELAXED);
+    STAT_ADD(prefetch_used);
+  }
+  __atomic_store_n(&entry->referenced, true, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&shard->lock);
+  return 1;
+}
+
+static int shard_flush(void) {
+  int flushed = 0;
+  for(int key = 0; key < CACHE_NUM_KEYS && __atomic_load_n(&num_dirty, __ATOMIC_RELAXED) > 0; key++) {
+    if(__atomic_load_n(&shard_slots[key], __ATOMIC_RELAXED) == CACHE_NIL) {
+      continue;
+    }
+    cache_shard_t *shard = shard_of(key);
+    pthread_mutex_lock(&shard->lock);
+    shard_entry_t *entry = shard_find(key);
+    int rc = 0;
+    if(entry != NULL && entry->dirty) {
+      rc = shard_clean_unlocked(shard, entry);
+      flushed += 1;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    if(rc == -1) {
+      return -1;
+    }
+  }
+  return flushed;
+}
+
+//Set-associative mode. The key of a block picks its set (key % num_sets), the block can
+//live in any of the set's ways. Tags are compared a whole set at a time, see assoc_match.
+static int assoc_match_scalar(const uint16_t *row, uint16_t tag) {
+  for(int way = 0; way < ASSOC_ROW; way++) {
+    if(row[way] == tag) {
+      return way;
+    }
+  }
+  return -1;
+}
+
+#if defined(__x86_64__)
+//SSE2 is part of x86-64, two compares cover a row.
+static int assoc_match_sse2(const uint16_t *row, uint16_t tag) {
+  __m128i needle = _mm_set1_epi16(tag);
+  for(int way = 0; way < ASSOC_ROW; way += 8) {
+    __m128i tags = _mm_load_si128((const __m128i *)(row + way));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(tags, needle));
+    if(mask != 0) {
+      //Two mask bits per 16-bit lane
+      return way + __builtin_ctz(mask) / 2;
+    }
+  }
+  return -1;
+}
+
+//One AVX2 compare covers a row, used when the CPU has it.
+__attribute__((target("avx2")))
+static int assoc_match_avx2(const uint16_t *row, uint16_t tag) {
+  __m256i tags = _mm256_load_si256((const __m256i *)row);
+  int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(tags, _mm256_set1_epi16(tag)));
+  return mask != 0 ? __builtin_ctz(mask) / 2 : -1;
+}
+#endif
+
+//Returns the position of |key| in the slab, or CACHE_NIL if not cached.
+static inline int assoc_find(int key) {
+  int set = key % num_sets;
+  int way = assoc_match(&assoc_tags[set * ASSOC_ROW], key + 1);
+  return way == -1 ? CACHE_NIL : set * ASSOC_ROW + way;
+}
+
+static inline uint8_t *assoc_block(int slot) {
+  return assoc_slab + (slot / ASSOC_ROW * assoc_ways + slot % ASSOC_ROW) * JBOD_BLOCK_SIZE;
+}
+
+static int assoc_create(int num_entries, int ways, bool huge_pages) {
+  if(ways < 1 || ways > ASSOC_ROW || num_entries % ways != 0) {
+    return -1;
+  }
+  int sets = num_entries / ways;
+  assoc_tags = line_alloc(sets * ASSOC_ROW * sizeof(uint16_t));
+  assoc_stamps = malloc(sets * ASSOC_ROW * sizeof(uint32_t));
+  assoc_flags = calloc(sets * ASSOC_ROW, sizeof(uint8_t));
+  //Huge pages spare the TLB a miss per 4 KiB of payload, fall back to normal pages
+  assoc_slab_len = (size_t)num_entries * JBOD_BLOCK_SIZE;
+  assoc_slab = NULL;
+  if(huge_pages) {
+    size_t huge_len = (assoc_slab_len + ASSOC_HUGE_PAGE - 1) / ASSOC_HUGE_PAGE * ASSOC_HUGE_PAGE;
+    void *slab = mmap(NULL, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(slab != MAP_FAILED) {
+      assoc_slab = slab;
+      assoc_slab_len = huge_len;
+      assoc_slab_mapped = true;
+    }
+  }
+  if(assoc_slab == NULL) {
+    assoc_slab = line_alloc(assoc_slab_len);
+    assoc_slab_mapped = false;
+  }
+  if(assoc_tags == NULL || assoc_stamps == NULL || assoc_flags == NULL || assoc_slab == NULL) {
+    free(assoc_tags);
+    free(assoc_stamps);
+    free(assoc_flags);
+    if(!assoc_slab_mapped) {
+      free(assoc_slab);
+    }
+    assoc_tags = NULL;
+    assoc_stamps = NULL;
+    assoc_flags = NULL;
+    assoc_slab = NULL;
+    return -1;
+  }
+  //Ways past |ways| are padding that never matches a key nor reads as free
+  for(int slot = 0; slot < sets * ASSOC_ROW; slot++) {
+    assoc_tags[slot] = slot % ASSOC_ROW < ways ? ASSOC_FREE : ASSOC_PAD;
+    assoc_stamps[slot] = 0;
+  }
+  assoc_match = assoc_match_scalar;
+#if defined(__x86_64__)
+  assoc_match = __builtin_cpu_supports("avx2") ? assoc_match_avx2 : assoc_match_sse2;
+#endif
+  num_sets = sets;
+  assoc_ways = ways;
+  cache_size = num_entries;
+  access_clock = 0;
+  num_dirty = 0;
+  stats_reset();
+  return 1;
+}
+
+static int assoc_destroy(void) {
+  for(int slot = 0; slot < num_sets * ASSOC_ROW; slot++) {
+    if(assoc_tags[slot] != ASSOC_FREE && assoc_tags[slot] != ASSOC_PAD && (assoc_flags[slot] & ASSOC_PREFETCHED)) {
+      STAT_ADD(prefetch_wasted);
+    }
+  }
+  free(assoc_tags);
+  free(assoc_stamps);
+  free(assoc_flags);
+  if(assoc_slab_mapped) {
+    munmap(assoc_slab, assoc_slab_len);
+  } else {
+    free(assoc_slab);
+  }
+  assoc_tags = NULL;
+  assoc_stamps = NULL;
+  assoc_flags = NULL;
+  assoc_slab = NULL;
+  num_sets = 0;
+  assoc_ways = 0;
+  cache_size = 0;
+  num_dirty = 0;
+  access_clock = 0;
+  return 1;
+}
+
+//Marks |slot| as the most recently used way of its set.
+static void assoc_touch(int slot) {
+  access_clock += 1;
+  assoc_stamps[slot] = access_clock;
+  if(assoc_flags[slot] & ASSOC_PREFETCHED) {
+    assoc_flags[slot] &= ~ASSOC_PREFETCHED;
+    STAT_ADD(prefetch_used);
+  }
+}
+
+//Writes dirty |slot| back to disk and marks it clean.
+static int assoc_clean(int slot) {
+  int key = assoc_tags[slot] - 1;
+  if(writeback == NULL || writeback(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, assoc_block(slot)) == -1) {
+    return -1;
+  }
+  assoc_flags[slot] &= ~ASSOC_DIRTY;
+  num_dirty -= 1;
+  return 1;
+}
+
+//Frees a way of the set of |key|, evicting the least recently used one when the set is full.
+//Returns CACHE_NIL and leaves the victim alone if it is dirty and cannot be written back.
+static int assoc_reclaim(int key) {
+  int set = key % num_sets;
+  uint16_t *row = &assoc_tags[set * ASSOC_ROW];
+  int way = assoc_match(row, ASSOC_FREE);
+  if(way != -1) {
+    return set * ASSOC_ROW + way;
+  }
+  int victim = set * ASSOC_ROW;
+  for(way = 1; way < assoc_ways; way++) {
+    if(assoc_stamps[set * ASSOC_ROW + way] < assoc_stamps[victim]) {
+      victim = set * ASSOC_ROW + way;
+    }
+  }
+  if((assoc_flags[victim] & ASSOC_DIRTY) && assoc_clean(victim) == -1) {
+    return CACHE_NIL;
+  }
+  if(assoc_flags[victim] & ASSOC_PREFETCHED) {
+    STAT_ADD(prefetch_wasted);
+  }
+  STAT_ADD(evictions);
+  assoc_tags[victim] = ASSOC_FREE;
+  return victim;
+}
+
+static int assoc_insert(int disk_num, int block_num, const uint8_t *buf, bool dirty, bool prefetched) {
+  if(buf == NULL || !valid_block(disk_num, block_num)) {
+    return -1;
+  }
+  int key = cache_key(disk_num, block_num);
+  if(assoc_find(key) != CACHE_NIL) {
+    STAT_ADD(collisions);
+    return -1;
+  }
+  int slot = assoc_reclaim(key);
+  if(slot == CACHE_NIL) {
+    return -1;
+  }
+  memcpy(assoc_block(slot), buf, JBOD_BLOCK_SIZE);
+  assoc_tags[slot] = key + 1;
+  assoc_flags[slot] = (dirty ? ASSOC_DIRTY : 0) | (prefetched ? ASSOC_PREFETCHED : 0);
+  if(dirty) {
+    num_dirty += 1;
+  }
+  access_clock += 1;
+  assoc_stamps[slot] = access_clock;
+  return 1;
+}
+
+static int assoc_lookup(int disk_num, int block_num, uint8_t *buf) {
+  if(buf == NULL || !valid_block(disk_num, block_num)) {
+    return -1;
+  }
+  STAT_ADD(queries);
+  int slot = assoc_find(cache_key(disk_num, block_num));
+  if(slot == CACHE_NIL) {
+    return -1;
+  }
+  memcpy(buf, assoc_block(slot), JBOD_BLOCK_SIZE);
+  assoc_touch(slot);
+  STAT_ADD(hits);
+  return 1;
+}
+
+//Patches |len| bytes at |offset| of a cached block, marking it dirty if |dirty|.
+static int assoc_patch(int disk_num, int block_num, int offset, int len, const uint8_t *buf, bool dirty) {
+  int slot = assoc_find(cache_key(disk_num, block_num));
+  if(slot == CACHE_NIL) {
+    return -1;
+  }
+  memcpy(assoc_block(slot) + offset, buf, len);
+  if(dirty && !(assoc_flags[slot] & ASSOC_DIRTY)) {
+    assoc_flags[slot] |= ASSOC_DIRTY;
+    num_dirty += 1;
+  }
+  if(dirty) {
+    assoc_touch(slot);
+  } else {
+    access_clock += 1;
+    assoc_stamps[slot] = access_clock;
+  }
+  return 1;
+}
+
+static int assoc_flush(void) {
+  int flushed = 0;
+  for(int key = 0; key < CACHE_NUM_KEYS && num_dirty > 0; key++) {
+    int slot = assoc_find(key);
+    if(slot != CACHE_NIL && (assoc_flags[slot] & ASSOC_DIRTY)) {
+      if(assoc_clean(slot) == -1) {
+        return -1;
+      }
+      flushed += 1;
+    }
+  }
+  return flushed;
+}
+
+//Extent mode. Each extent holds a run of consecutive blocks of one disk; extent_of maps
+//every block to the extent holding it, so a run of blocks is found with one probe per extent.
+static inline uint64_t extent_bits(int from, int count) {
+  return (count == 64 ? ~0ULL : ((1ULL << count) - 1)) << from;
+}
+
+static inline uint8_t *extent_block(cache_extent_t *extent, int index) {
+  return extent->data + index * JBOD_BLOCK_SIZE;
+}
+
+static void extent_unlink(int id) {
+  cache_extent_t *extent = &extents[id];
+  if(extent->prev != CACHE_NIL) {
+    extents[extent->prev].next = extent->next;
+  } else {
+    extent_lru.head = extent->next;
+  }
+  if(extent->next != CACHE_NIL) {
+    extents[extent->next].prev = extent->prev;
+  } else {
+    extent_lru.tail = extent->prev;
+  }
+  extent_lru.size -= 1;
+}
+
+static void extent_push_front(int id) {
+  cache_extent_t *extent = &extents[id];
+  extent->prev = CACHE_NIL;
+  extent->next = extent_lru.head;
+  if(extent_lru.head != CACHE_NIL) {
+    extents[extent_lru.head].prev = id;
+  } else {
+    extent_lru.tail = id;
+  }
+  extent_lru.head = id;
+  extent_lru.size += 1;
+}
+
+//Moves extent |id| to the most recently used end.
+static void extent_touch(int id) {
+  access_clock += 1;
+  extents[id].access_time = access_clock;
+  if(extent_lru.head != id) {
+    extent_unlink(id);
+    extent_push_front(id);
+  }
+}
+
+//Points the index entries of |count| blocks of extent |id| from its block |from| at |id|.
+static void extent_index(int id, int from, int count) {
+  int key = cache_key(extents[id].disk_num, extents[id].start + from);
+  for(int i = 0; i < count; i++) {
+    extent_of[key + i] = id;
+  }
+}
+
+//Makes sure extent |id| has room for |count| blocks.
+static bool extent_reserve(int id, int count) {
+  cache_extent_t *extent = &extents[id];
+  if(count <= extent->capacity) {
+    return true;
+  }
+  //Grow geometrically, runs tend to keep growing in the same direction
+  int capacity = extent->capacity * 2 > count ? extent->capacity * 2 : count;
+  capacity = capacity < EXTENT_MAX_BLOCKS ? capacity : EXTENT_MAX_BLOCKS;
+  uint8_t *data = realloc(extent->data, capacity * JBOD_BLOCK_SIZE);
+  if(data == NULL) {
+    return false;
+  }
+  extent->data = data;
+  extent->capacity = capacity;
+  return true;
+}
+
+static int extent_alloc(int disk_num, int start) {
+  int id = extent_free;
+  extent_free = extents[id].next;
+  extents[id].disk_num = disk_num;
+  extents[id].start = start;
+  extents[id].count = 0;
+  extents[id].dirty = 0;
+  extents[id].prefetched = 0;
+  extent_push_front(id);
+  return id;
+}
+
+//Returns extent |id|, which must hold no blocks, to the free list.
+static void extent_release(int id) {
+  extent_unlink(id);
+  free(extents[id].data);
+  extents[id].data = NULL;
+  extents[id].capacity = 0;
+  extents[id].count = 0;
+  extents[id].next = extent_free;
+  extent_free = id;
+}
+
+//Writes dirty block |index| of extent |id| back to disk and marks it clean.
+static int extent_clean(int id, int index) {
+  cache_extent_t *extent = &extents[id];
+  if(writeback == NULL || writeback(extent->disk_num, extent->start + index, extent_block(extent, index)) == -1) {
+    return -1;
+  }
+  extent->dirty &= ~extent_bits(index, 1);
+  num_dirty -= 1;
+  return 1;
+}
+
+//Evicts the last |count| blocks of extent |id|, splitting them off the run. The blocks must be clean.
+static void extent_trim(int id, int count) {
+  cache_extent_t *extent = &extents[id];
+  for(int index = extent->count - count; index < extent->count; index++) {
+    if(extent->prefetched & extent_bits(index, 1)) {
+      STAT_ADD(prefetch_wasted);
+    }
+    STAT_ADD(evictions);
+    extent_of[cache_key(extent->disk_num, extent->start + index)] = CACHE_NIL;
+  }
+  extent->count -= count;
+  extent->prefetched &= extent_bits(0, extent->count);
+  extent_blocks -= count;
+  if(extent->count == 0) {
+    extent_release(id);
+  }
+}
+
+//Evicts blocks from the least recently used extents until |count| more blocks fit. The dirty
+//blocks to evict are written back first; if one cannot be, nothing is evicted and it returns false.
+static bool extent_make_room(int count) {
+  int excess = extent_blocks + count - cache_size;
+  for(int id = extent_lru.tail; excess > 0; id = extents[id].prev) {
+    int trim = excess < extents[id].count ? excess : extents[id].count;
+    for(int index = extents[id].count - trim; index < extents[id].count; index++) {
+      if((extents[id].dirty & extent_bits(index, 1)) && extent_clean(id, index) == -1) {
+        return false;
+      }
+    }
+    excess -= trim;
+  }
+  while(extent_blocks + count > cache_size) {
+    int id = extent_lru.tail;
+    int excess = extent_blocks + count - cache_size;
+    extent_trim(id, excess < extents[id].count ? excess : extents[id].count);
+  }
+  return true;
+}
+
+//Caches |count| (at most EXTENT_MAX_BLOCKS) consecutive blocks that are not cached yet,
+//merging them into the extents right before and after them when the result fits.
+static bool extent_insert_run(int disk_num, int block_num, int count, uint8_t **blocks, bool dirty, bool prefetched) {
+  if(!extent_make_room(count)) {
+    return false;
+  }
+  int key = cache_key(disk_num, block_num);
+  int left = block_num > 0 ? extent_of[key - 1] : CACHE_NIL;
+  int right = block_num + count < JBOD_NUM_BLOCKS_PER_DISK ? extent_of[key + count] : CACHE_NIL;
+  int id, from;
+
+  if(left != CACHE_NIL && extents[left].count + count <= EXTENT_MAX_BLOCKS) {
+    //Append to the run on the left
+    id = left;
+    from = extents[id].count;
+    if(!extent_reserve(id, from + count)) {
+      return false;
+    }
+  } else if(right != CACHE_NIL && extents[right].count + count <= EXTENT_MAX_BLOCKS) {
+    //Prepend to the run on the right
+    id = right;
+    from = 0;
+    if(!extent_reserve(id, extents[id].count + count)) {
+      return false;
+    }
+    memmove(extents[id].data + count * JBOD_BLOCK_SIZE, extents[id].data, extents[id].count * JBOD_BLOCK_SIZE);
+    extents[id].dirty <<= count;
+    extents[id].prefetched <<= count;
+    extents[id].start = block_num;
+    right = CACHE_NIL;
+  } else {
+    id = extent_alloc(disk_num, block_num);
+    from = 0;
+    if(!extent_reserve(id, count)) {
+      extent_release(id);
+      return false;
+    }
+  }
+  cache_extent_t *extent = &extents[id];
+  for(int i = 0; i < count; i++) {
+    memcpy(extent_block(extent, from + i), blocks[i], JBOD_BLOCK_SIZE);
+  }
+  extent->count += count;
+  if(dirty) {
+    extent->dirty |= extent_bits(from, count);
+    num_dirty += count;
+  }
+  if(prefetched) {
+    extent->prefetched |= extent_bits(from, count);
+  }
+  extent_index(id, from, count);
+  extent_blocks += count;
+
+  //The new blocks may have closed the gap to the run on the right
+  if(right != CACHE_NIL && right != id && extent->count + extents[right].count <= EXTENT_MAX_BLOCKS &&
+     extent_reserve(id, extent->count + extents[right].count)) {
+    cache_extent_t *next = &extents[right];
+    memcpy(extent_block(extent, extent->count), next->data, next->count * JBOD_BLOCK_SIZE);
+    extent->dirty |= next->dirty << extent->count;
+    extent->prefetched |= next->prefetched << extent->count;
+    extent_index(id, extent->count, next->count);
+    extent->count += next->count;
+    next->count = 0;
+    extent_release(right);
+  }
+  extent_touch(id);
+  return true;
+}
+
+static int extent_insert_range(int disk_num, int block_num, int count, uint8_t **blocks, bool dirty, bool prefetched) {
+  if(blocks == NULL || count < 1 || !valid_block(disk_num, block_num) || block_num + count > JBOD_NUM_BLOCKS_PER_DISK) {
+    return -1;
+  }
+  int rc = 1;
+  int i = 0;
+  while(i < count) {
+    //Skip the blocks already cached, the rest go in as runs
+    if(extent_of[cache_key(disk_num, block_num + i)] != CACHE_NIL) {
+      STAT_ADD(collisions);
+      rc = -1;
+      i += 1;
+      continue;
+    }
+    int run = 1;
+    while(i + run < count && run < EXTENT_MAX_BLOCKS && run < cache_size && extent_of[cache_key(disk_num, block_num + i + run)] == CACHE_NIL) {
+      run += 1;
+    }
+    if(!extent_insert_run(disk_num, block_num + i, run, blocks + i, dirty, prefetched)) {
+      return -1;
+    }
+    i += run;
+  }
+  return rc;
+}
+
+static int extent_lookup_range(int disk_num, int block_num, int count, uint8_t **blocks) {
+  if(blocks == NULL || count < 1 || !valid_block(disk_num, block_num) || block_num + count > JBOD_NUM_BLOCKS_PER_DISK) {
+    return 0;
+  }
+  int found = 0;
+  while(found < count) {
+    int id = extent_of[cache_key(disk_num, block_num + found)];
+    if(id == CACHE_NIL) {
+      break;
+    }
+    cache_extent_t *extent = &extents[id];
+    int index = block_num + found - extent->start;
+    int run = extent->count - index < count - found ? extent->count - index : count - found;
+    for(int i = 0; i < run; i++) {
+      memcpy(blocks[found + i], extent_block(extent, index + i), JBOD_BLOCK_SIZE);
+    }
+    uint64_t used = extent->prefetched & extent_bits(index, run);
+    for(; used != 0; used &= used - 1) {
+      STAT_ADD(prefetch_used);
+    }
+    extent->prefetched &= ~extent_bits(index, run);
+    extent_touch(id);
+    found += run;
+  }
+  for(int i = 0; i < found + (found < count ? 1 : 0); i++) {
+    STAT_ADD(queries);
+  }
+  for(int i = 0; i < found; i++) {
+    STAT_ADD(hits);
+  }
+  return found;
+}
+
+//Patches |len| bytes at |offset| of a cached block, marking it dirty if |dirty|.
+static int extent_patch(int disk_num, int block_num, int offset, int len, const uint8_t *buf, bool dirty) {
+  int id = extent_of[cache_key(disk_num, block_num)];
+  if(id == CACHE_NIL) {
+    return -1;
+  }
+  cache_extent_t *extent = &extents[id];
+  int index = block_num - extent->start;
+  memcpy(extent_block(extent, index) + offset, buf, len);
+  if(dirty && !(extent->dirty & extent_bits(index, 1))) {
+    extent->dirty |= extent_bits(index, 1);
+    num_dirty += 1;
+  }
+  if(dirty && (extent->prefetched & extent_bits(index, 1))) {
+    extent->prefetched &= ~extent_bits(index, 1);
+    STAT_ADD(prefetch_used);
+  }
+  extent_touch(id);
+  return 1;
+}
+
+static int extent_flush(void) {
+  int flushed = 0;
+  for(int key = 0; key < CACHE_NUM_KEYS && num_dirty > 0; key++) {
+    int id = extent_of[key];
+    if(id == CACHE_NIL) {
+      continue;
+    }
+    int index = key % JBOD_NUM_BLOCKS_PER_DISK - extents[id].start;
+    if(extents[id].dirty & extent_bits(index, 1)) {
+      if(extent_clean(id, index) == -1) {
+        return -1;
+      }
+      flushed += 1;
+    }
+  }
+  return flushed;
+}
+
+static int extent_create(int num_entries) {
+  extents = calloc(num_entries, sizeof(cache_extent_t));
+  extent_of = malloc(CACHE_NUM_KEYS * sizeof(int16_t));
+  if(extents == NULL || extent_of == NULL) {
+    free(extents);
+    free(extent_of);
+    extents = NULL;
+    extent_of = NULL;
+    return -1;
+  }
+  for(int key = 0; key < CACHE_NUM_KEYS; key++) {
+    extent_of[key] = CACHE_NIL;
+  }
+  //Every extent holds at least one block, so there are never more extents than entries
+  for(int id = 0; id < num_entries; id++) {
+    extents[id].next = id + 1 < num_entries ? id + 1 : CACHE_NIL;
+  }
+  extent_free = 0;
+  extent_lru.head = CACHE_NIL;
+  extent_lru.tail = CACHE_NIL;
+  extent_lru.size = 0;
+  extent_blocks = 0;
+  cache_size = num_entries;
+  access_clock = 0;
+  num_dirty = 0;
+  stats_reset();
+  return 1;
+}
+
+static int extent_destroy(void) {
+  for(int id = 0; id < cache_size; id++) {
+    for(uint64_t wasted = extents[id].prefetched; wasted != 0; wasted &= wasted - 1) {
+      STAT_ADD(prefetch_wasted);
+    }
+    free(extents[id].data);
+  }
+  free(extents);
+  free(extent_of);
+  extents = NULL;
+  extent_of = NULL;
+  extent_blocks = 0;
+  cache_size = 0;
+  num_dirty = 0;
+  access_clock = 0;
+  return 1;
+}
+
+//Shared mode. Every process using the segment maps the header and the entries; slots,
+//entries and the CLOCK hand are only touched with the robust lock held.
+static inline shm_entry_t *shm_entry(int index) {
+  return &shm_entries[index];
+}
+
+//Drops the entry a dead process was changing when it lost the lock. Its block may be
+//half copied, the other entries were consistent when the lock was last released.
+static void shm_recover(void) {
+  int index = shm->busy;
+  if(index != CACHE_NIL) {
+    shm_entry_t *entry = shm_entry(index);
+    if(entry->key != CACHE_NIL && shm->slots[entry->key] == index) {
+      shm->slots[entry->key] = CACHE_NIL;
+    }
+    if(entry->dirty) {
+      shm->num_dirty -= 1;
+    }
+    entry->key = CACHE_NIL;
+    entry->dirty = false;
+    entry->referenced = false;
+    shm->busy = CACHE_NIL;
+  }
+  shm->recovered += 1;
+}
+
+static void shm_lock(void) {
+  if(pthread_mutex_lock(&shm->lock) == EOWNERDEAD) {
+    shm_recover();
+    pthread_mutex_consistent(&shm->lock);
+  }
+}
+
+static void shm_unlock(void) {
+  pthread_mutex_unlock(&shm->lock);
+}
+
+static int shm_create(const char *name, int num_entries) {
+  size_t header_len = (sizeof(shm_header_t) + 63) & ~(size_t)63;
+  bool creator = true;
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if(fd == -1 && errno == EEXIST) {
+    creator = false;
+    fd = shm_open(name, O_RDWR, 0600);
+  }
+  if(fd == -1) {
+    return -1;
+  }
+  size_t len = header_len + num_entries * sizeof(shm_entry_t);
+  if(creator && ftruncate(fd, len) == -1) {
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+  if(!creator) {
+    //Attach with the size the segment was created with, once its creator is done
+    struct stat st;
+    for(int tries = 0; fstat(fd, &st) == 0 && st.st_size < (off_t)header_len && tries < 1000; tries++) {
+      usleep(1000);
+    }
+    if(fstat(fd, &st) == -1 || st.st_size < (off_t)header_len) {
+      close(fd);
+      return -1;
+    }
+    len = st.st_size;
+  }
+  uint8_t *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    if(creator) {
+      shm_unlink(name);
+    }
+    return -1;
+  }
+  shm_header_t *header = (shm_header_t *)map;
+  if(creator) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    header->size = num_entries;
+    header->used = 0;
+    header->hand = 0;
+    header->num_dirty = 0;
+    header->busy = CACHE_NIL;
+    header->recovered = 0;
+    for(int key = 0; key < CACHE_NUM_KEYS; key++) {
+      header->slots[key] = CACHE_NIL;
+    }
+    shm_entry_t *entries = (shm_entry_t *)(map + header_len);
+    for(int index = 0; index < num_entries; index++) {
+      entries[index].key = CACHE_NIL;
+    }
+    header->magic = SHM_MAGIC;
+    __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+  } else {
+    for(int tries = 0; !__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE) && tries < 1000; tries++) {
+      usleep(1000);
+    }
+    if(!__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE) || header->magic != SHM_MAGIC ||
+       len < header_len + header->size * sizeof(shm_entry_t)) {
+      munmap(map, len);
+      return -1;
+    }
+  }
+  shm = header;
+  shm_entries = (shm_entry_t *)(map + header_len);
+  shm_len = len;
+  cache_size = header->size;
+  stats_reset();
+  return 1;
+}
+
+static int shm_destroy(void) {
+  //The segment and the blocks in it stay for the other processes, see cache_remove_shared
+  munmap(shm, shm_len);
+  shm = NULL;
+  shm_entries = NULL;
+  shm_len = 0;
+  cache_size = 0;
+  return 1;
+}
+
+//Writes dirty entry |entry| back to disk and marks it clean.
+static int shm_clean(shm_entry_t *entry) {
+  if(writeback == NULL || writeback(entry->key / JBOD_NUM_BLOCKS_PER_DISK, entry->key % JBOD_NUM_BLOCKS_PER_DISK, entry->block) == -1) {
+    return -1;
+  }
+  entry->dirty = false;
+  shm->num_dirty -= 1;
+  return 1;
+}
+
+//Writes dirty entry |entry| back with the lock released, so the other processes do not
+//wait for the round trip. The entry stays cached and dirty meanwhile, a process dying
+//during the write-back loses nothing, and it is only marked clean if it still holds
+//the bytes that reached the disk. The lock must be held.
+static int shm_clean_unlocked(shm_entry_t *entry) {
+  uint8_t block[JBOD_BLOCK_SIZE];
+  int key = entry->key;
+  cache_writeback_fn fn = writeback;
+  if(fn == NULL) {
+    return -1;
+  }
+  memcpy(block, entry->block, JBOD_BLOCK_SIZE);
+  shm_unlock();
+  int rc = fn(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, block);
+  shm_lock();
+  if(rc == -1) {
+    return -1;
+  }
+  int index = shm->slots[key];
+  if(index != CACHE_NIL && shm_entry(index)->dirty && memcmp(shm_entry(index)->block, block, JBOD_BLOCK_SIZE) == 0) {
+    shm_entry(index)->dirty = false;
+    shm->num_dirty -= 1;
+  }
+  return 1;
+}
+
+//The entry shm_reclaim would evict, without moving the hand or clearing reference bits,
+//or NULL while the segment has a never used entry.
+static shm_entry_t *shm_next_victim(void) {
+  if(shm->used < shm->size) {
+    return NULL;
+  }
+  for(int i = 0; i < shm->size; i++) {
+    shm_entry_t *entry = shm_entry((shm->hand + i) % shm->size);
+    if(!entry->referenced) {
+      return entry;
+    }
+  }
+  return shm_entry(shm->hand);
+}
+
+//Frees an entry with CLOCK, writing back a dirty victim. Returns its index, or CACHE_NIL
+//if the victim cannot be written back; it then stays cached and dirty for its owner.
+//The victim may be an entry shm_recover emptied, it holds no block then.
+static int shm_reclaim(void) {
+  if(shm->used < shm->size) {
+    return shm->used++;
+  }
+  while(shm_entry(shm->hand)->referenced) {
+    shm_entry(shm->hand)->referenced = false;
+    shm->hand = (shm->hand + 1) % shm->size;
+  }
+  int index = shm->hand;
+  shm->hand = (shm->hand + 1) % shm->size;
+  shm_entry_t *victim = shm_entry(index);
+  if(victim->dirty && shm_clean(victim) == -1) {
+    return CACHE_NIL;
+  }
+  shm->busy = index;
+  if(victim->key != CACHE_NIL) {
+    if(victim->prefetched) {
+      STAT_ADD(prefetch_wasted);
+    }
+    STAT_ADD(evictions);
+    shm->slots[victim->key] = CACHE_NIL;
+    victim->key = CACHE_NIL;
+  }
+  return index;
+}
+
+static int shm_insert(int disk_num, int block_num, const uint8_t *buf, bool dirty, bool prefetched) {
+  if(buf == NULL || !valid_block(disk_num, block_num)) {
+    return -1;
+  }
+  int key = cache_key(disk_num, block_num);
+  shm_lock();
+  for(;;) {
+    if(shm->slots[key] != CACHE_NIL) {
+      shm_unlock();
+      STAT_ADD(collisions);
+      return -1;
+    }
+    //A dirty victim is written back with the lock dropped, then everything is checked again
+    shm_entry_t *victim = shm_next_victim();
+    if(victim == NULL || !victim->dirty) {
+      break;
+    }
+    if(shm_clean_unlocked(victim) == -1) {
+      shm_unlock();
+      return -1;
+    }
+  }
+  int index = shm_reclaim();
+  if(index == CACHE_NIL) {
+    shm_unlock();
+    return -1;
+  }
+  shm_entry_t *entry = shm_entry(index);
+  shm->busy = index;
+  memcpy(entry->block, buf, JBOD_BLOCK_SIZE);
+  entry->key = key;
+  entry->referenced = false;
+  entry->dirty = dirty;
+  entry->prefetched = prefetched;
+  if(dirty) {
+    shm->num_dirty += 1;
+  }
+  shm->slots[key] = index;
+  shm->busy = CACHE_NIL;
+  shm_unlock();
+  return 1;
+}
+
+static int shm_lookup(int disk_num, int block_num, uint8_t *buf) {
+  if(buf == NULL || !valid_block(disk_num, block_num)) {
+    return -1;
+  }
+  STAT_ADD(queries);
+  shm_lock();
+  int index = shm->slots[cache_key(disk_num, block_num)];
+  if(index == CACHE_NIL) {
+    shm_unlock();
+    return -1;
+  }
+  shm_entry_t *entry = shm_entry(index);
+  memcpy(buf, entry->block, JBOD_BLOCK_SIZE);
+  entry->referenced = true;
+  if(entry->prefetched) {
+    entry->prefetched = false;
+    STAT_ADD(prefetch_used);
+  }
+  shm_unlock();
+  STAT_ADD(hits);
+  return 1;
+}
+
+//Patches |len| bytes at |offset| of a cached block, marking it dirty if |dirty|.
+static int shm_patch(int disk_num, int block_num, int offset, int len, const uint8_t *buf, bool dirty) {
+  shm_lock();
+  int index = shm->slots[cache_key(disk_num, block_num)];
+  if(index == CACHE_NIL) {
+    shm_unlock();
+    return -1;
+  }
+  shm_entry_t *entry = shm_entry(index);
+  shm->busy = index;
+  memcpy(entry->block + offset, buf, len);
+  if(dirty && !entry->dirty) {
+    entry->dirty = true;
+    shm->num_dirty += 1;
+  }
+  if(dirty && entry->prefetched) {
+    entry->prefetched = false;
+    STAT_ADD(prefetch_used);
+  }
+  entry->referenced = true;
+  shm->busy = CACHE_NIL;
+  shm_unlock();
+  return 1;
+}
+
+static int shm_flush(void) {
+  int flushed = 0;
+  shm_lock();
+  for(int key = 0; key < CACHE_NUM_KEYS && shm->num_dirty > 0; key++) {
+    int index = shm->slots[key];
+    if(index != CACHE_NIL && shm_entry(index)->dirty) {
+      if(shm_clean_unlocked(shm_entry(index)) == -1) {
+        shm_unlock();
+        return -1;
+      }
+      flushed += 1;
+    }
+  }
+  shm_unlock();
+  return flushed;
+}
+
+static bool shm_contains(int disk_num, int block_num) {
+  shm_lock();
+  bool found = shm->slots[cache_key(disk_num, block_num)] != CACHE_NIL;
+  shm_unlock();
+  return found;
+}
 
 int cache_create(int num_entries) {
+  return cache_create_ex(num_entries, CACHE_POLICY_LRU);
+}
+
+static int create_ex_locked(int num_entries, cache_policy_t new_policy) {
   //Parameter Checks
    if(num_entries < 2 || num_entries > 4096) {
     return -1;
   }
+  if(new_policy < 0 || new_policy >= CACHE_NUM_POLICIES) {
+    return -1;
+  }
   //If Cache does not exist then allocate memory to cache
-  if(cache == NULL) {
+  if(cache == NULL && shards == NULL && assoc_tags == NULL && extents == NULL && shm == NULL) {
     cache = calloc(num_entries, sizeof(cache_entry_t));
+    cache_keys = malloc(CACHE_NUM_KEYS * sizeof(cache_key_t));
+    if(cache == NULL || cache_keys == NULL) {
+      free(cache);
+      free(cache_keys);
+      cache = NULL;
+      cache_keys = NULL;
+      return -1;
+    }
+    for(int key = 0; key < CACHE_NUM_KEYS; key++) {
+      cache_keys[key].slot = CACHE_NIL;
+      cache_keys[key].ghost_prev = CACHE_NIL;
+      cache_keys[key].ghost_next = CACHE_NIL;
+      cache_keys[key].ghost_list = LIST_NONE;
+    }
+    for(int id = 0; id < NUM_LISTS; id++) {
+      lists[id].head = CACHE_NIL;
+      lists[id].tail = CACHE_NIL;
+      lists[id].size = 0;
+    }
     cache_size = num_entries;
+    policy = new_policy;
+    num_used = 0;
+    free_head = CACHE_NIL;
+    clock_hand = 0;
+    arc_p = 0;
+    stats_reset();
     return 1;
   }
   return -1;
 }
 
+int cache_create_ex(int num_entries, cache_policy_t new_policy) {
+  pthread_mutex_lock(&cache_lock);
+  int rc = create_ex_locked(num_entries, new_policy);
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
 
-int cache_destroy(void) {
+int cache_create_sharded(int num_entries, int new_num_shards) {
+  if(num_entries < 2 || num_entries > 4096) {
+    return -1;
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = (cache == NULL && shards == NULL && assoc_tags == NULL && extents == NULL && shm == NULL) ? shard_create(num_entries, new_num_shards) : -1;
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+int cache_create_extent(int num_entries) {
+  if(num_entries < 2 || num_entries > 4096) {
+    return -1;
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = (cache == NULL && shards == NULL && assoc_tags == NULL && extents == NULL && shm == NULL) ? extent_create(num_entries) : -1;
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+int cache_create_shared(const char *name, int num_entries) {
+  if(name == NULL || num_entries < 2 || num_entries > 4096) {
+    return -1;
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = (cache == NULL && shards == NULL && assoc_tags == NULL && extents == NULL && shm == NULL) ? shm_create(name, num_entries) : -1;
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+int cache_remove_shared(const char *name) {
+  return shm_unlink(name) == 0 ? 1 : -1;
+}
+
+int cache_shared_recovered(void) {
+  if(shm == NULL) {
+    return -1;
+  }
+  shm_lock();
+  int recovered = shm->recovered;
+  shm_unlock();
+  return recovered;
+}
+
+int cache_create_assoc(int num_entries, int ways, bool huge_pages) {
+  if(num_entries < 2 || num_entries > 4096) {
+    return -1;
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = (cache == NULL && shards == NULL && assoc_tags == NULL && extents == NULL && shm == NULL) ? assoc_create(num_entries, ways, huge_pages) : -1;
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+
+static int destroy_locked(void) {
   //If Cache exists then free memory used by the cache
   if(cache != NULL) {
+    //Prefetched blocks nobody asked for were read for nothing
+    for(int index = 0; index < cache_size; index++) {
+      if(cache[index].valid && cache[index].prefetched) {
+        STAT_ADD(prefetch_wasted);
+      }
+    }
     free(cache);
+    free(cache_keys);
     cache = NULL;
+    cache_keys = NULL;
     cache_size = 0;
-    clock = 0;
+    num_used = 0;
+    free_head = CACHE_NIL;
+    num_dirty = 0;
+    access_clock = 0;
     return 1;
   }
   return -1;
 }
 
+int cache_destroy(void) {
+  pthread_mutex_lock(&cache_lock);
+  int rc;
+  if(shards != NULL) {
+    rc = shard_destroy();
+  } else if(assoc_tags != NULL) {
+    rc = assoc_destroy();
+  } else if(extents != NULL) {
+    rc = extent_destroy();
+  } else if(shm != NULL) {
+    rc = shm_destroy();
+  } else {
+    rc = destroy_locked();
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
 
-int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
+static int lookup_locked(int disk_num, int block_num, uint8_t *buf) {
+  if(assoc_tags != NULL) {
+    return assoc_lookup(disk_num, block_num, buf);
+  }
+  if(extents != NULL) {
+    return extent_lookup_range(disk_num, block_num, 1, &buf) == 1 ? 1 : -1;
+  }
   //If cache or buffer of invalid size / dont exist
   if(cache == NULL || buf == NULL) {
     return -1;
@@ -50,24 +2057,46 @@ int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
   if(disk_num < 0 || disk_num >= 16) {
     return -1;
   }
-  num_queries += 1;
-  int index = 0;
-  //Lookup the block identified by disk_num and block_num in the cache. 
-  while(index < cache_size) {
-    //If found in cache copy from cache to to buffer
-    if(cache[index].disk_num == disk_num && cache[index].block_num == block_num && cache[index].valid) {
-      memcpy(buf, cache[index].block, 256);
-      clock += 1;
-      cache[index].access_time = clock;
-      num_hits += 1;
-      return 1;
-    }
-    index += 1;
+  STAT_ADD(queries);
+  //Lookup the block identified by disk_num and block_num in the index.
+  int index = cache_find(disk_num, block_num);
+  if(index == CACHE_NIL || !cache_verify(index)) {
+    return -1;
   }
-  return -1;
+  //If found in cache copy from cache to to buffer
+  memcpy(buf, cache[index].block, 256);
+  cache_used(index);
+  cache_touch(index);
+  STAT_ADD(hits);
+  return 1;
 }
 
-void cache_update(int disk_num, int block_num, const uint8_t *buf) {
+int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
+  if(shards != NULL) {
+    return shard_lookup(disk_num, block_num, buf);
+  }
+  if(shm != NULL) {
+    return shm_lookup(disk_num, block_num, buf);
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = lookup_locked(disk_num, block_num, buf);
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+static void update_locked(int disk_num, int block_num, const uint8_t *buf) {
+  if(assoc_tags != NULL) {
+    if(buf != NULL && valid_block(disk_num, block_num)) {
+      assoc_patch(disk_num, block_num, 0, JBOD_BLOCK_SIZE, buf, false);
+    }
+    return;
+  }
+  if(extents != NULL) {
+    if(buf != NULL && valid_block(disk_num, block_num)) {
+      extent_patch(disk_num, block_num, 0, JBOD_BLOCK_SIZE, buf, false);
+    }
+    return;
+  }
   //If cacher or buffer of invalid size /Dont exist
   if(cache == NULL || buf == NULL) {
     return;
@@ -79,22 +2108,44 @@ void cache_update(int disk_num, int block_num, const uint8_t *buf) {
   if(disk_num < 0 || disk_num >= 16) {
     return;
   }
-  int index = 0;
-  //Lookup the block identified by disk_num and block_num in the cache. 
-  while(index < cache_size) {
-    //If location in cache is found with corresponding block and disk nums, copy from buffer into cache location
-    if(cache[index].disk_num == disk_num && cache[index].block_num == block_num && cache[index].valid) {
-      memcpy(cache[index].block, buf, 256);
-      clock += 1;
-      cache[index].access_time = clock;
-      return;
+  //Lookup the block identified by disk_num and block_num in the index.
+  int index = cache_find(disk_num, block_num);
+  if(index == CACHE_NIL) {
+    return;
+  }
+  //Copy from buffer into cache location, the whole block is current now
+  memcpy(cache[index].block, buf, 256);
+  cache[index].unverified = false;
+  cache_touch(index);
+}
+
+void cache_update(int disk_num, int block_num, const uint8_t *buf) {
+  if(shards != NULL) {
+    if(buf != NULL && valid_block(disk_num, block_num)) {
+      shard_patch(disk_num, block_num, 0, JBOD_BLOCK_SIZE, buf, false);
+    }
+    return;
+  }
+  if(shm != NULL) {
+    if(buf != NULL && valid_block(disk_num, block_num)) {
+      shm_patch(disk_num, block_num, 0, JBOD_BLOCK_SIZE, buf, false);
     }
-    index += 1;
+    return;
   }
-  return;
+  pthread_mutex_lock(&cache_lock);
+  update_locked(disk_num, block_num, buf);
+  pthread_mutex_unlock(&cache_lock);
 }
 
-int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
+//Inserts the block and marks it |dirty|, see cache_insert and cache_insert_dirty.
+static int cache_insert_entry(int disk_num, int block_num, const uint8_t *buf, bool dirty, bool prefetched) {
+  if(assoc_tags != NULL) {
+    return assoc_insert(disk_num, block_num, buf, dirty, prefetched);
+  }
+  if(extents != NULL) {
+    uint8_t *block = (uint8_t *)buf;
+    return extent_insert_range(disk_num, block_num, 1, &block, dirty, prefetched);
+  }
   //If cache or buffer of invalid size / Dont exist
   if(cache == NULL || buf == NULL) {
     return -1;
@@ -106,44 +2157,455 @@ int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
   if(disk_num < 0 || disk_num >= 16) {
     return -1;
   }
-  int index = 0;
-  int lru_index = 0;
-  while(index < cache_size) {
+  int key = cache_key(disk_num, block_num);
+  for(;;) {
     //If block entry for block and disk num exist, return -1
-    if(cache[index].disk_num == disk_num && cache[index].block_num == block_num && cache[index].valid) {
+    int existing = cache_find(disk_num, block_num);
+    if(existing != CACHE_NIL && cache[existing].unverified) {
+      //A snapshot block that was found stale, or never checked, takes the new copy
+      memcpy(cache[existing].block, buf, 256);
+      cache[existing].unverified = false;
+      if(dirty) {
+        cache[existing].dirty = true;
+        num_dirty += 1;
+      }
+      cache_touch(existing);
+      return 1;
+    }
+    if(existing != CACHE_NIL) {
+      STAT_ADD(collisions);
       return -1;
     }
-    //else insert entry into cache for that block and disk num
-    if(cache[index].valid == false) {
-      memcpy(cache[index].block, buf, 256);
-      cache[index].block_num = block_num;
-      cache[index].disk_num = disk_num;
-      cache[index].valid = true;
-      clock += 1;
-      cache[index].access_time = clock;
-      return 1;
+    //A dirty victim is written back with the lock dropped, then everything is checked again
+    int victim = cache_next_victim(key);
+    if(victim == CACHE_NIL || !cache[victim].dirty) {
+      break;
     }
-    //Least Recently Used Algorithim to evict least recently used entry and replace it with new one.
-    if(cache[index].access_time < cache[lru_index].access_time) {
-      lru_index = index;
+    if(cache_clean_unlocked(victim) == -1 || cache == NULL) {
+      return -1;
     }
-    index += 1;
+  }
+  //Let the replacement policy pick a free or evicted entry
+  int list;
+  int index = cache_reclaim(key, &list);
+  if(index == CACHE_NIL) {
+    return -1;
   }
   //Copy contents of buffer into the cache and update the cache entry properties
-  memcpy(cache[lru_index].block, buf, 256);
-  cache[lru_index].block_num = block_num;
-  cache[lru_index].disk_num = disk_num;
-  cache[lru_index].valid = true;
-  clock += 1;
-  cache[lru_index].access_time = clock;
+  memcpy(cache[index].block, buf, 256);
+  cache[index].block_num = block_num;
+  cache[index].disk_num = disk_num;
+  cache[index].valid = true;
+  cache[index].referenced = false;
+  cache[index].dirty = dirty;
+  cache[index].prefetched = prefetched;
+  cache[index].unverified = false;
+  if(dirty) {
+    num_dirty += 1;
+  }
+  cache[index].prev = CACHE_NIL;
+  cache[index].next = CACHE_NIL;
+  cache[index].list = LIST_NONE;
+  cache_keys[key].slot = index;
+  access_clock += 1;
+  cache[index].access_time = access_clock;
+  if(list != LIST_NONE) {
+    list_push_front(list, index);
+  }
+  return 1;
+}
+
+int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
+  if(shards != NULL) {
+    return shard_insert(disk_num, block_num, buf, false, false);
+  }
+  if(shm != NULL) {
+    return shm_insert(disk_num, block_num, buf, false, false);
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = cache_insert_entry(disk_num, block_num, buf, false, false);
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+int cache_insert_dirty(int disk_num, int block_num, const uint8_t *buf) {
+  if(shards != NULL) {
+    return shard_insert(disk_num, block_num, buf, true, false);
+  }
+  if(shm != NULL) {
+    return shm_insert(disk_num, block_num, buf, true, false);
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = cache_insert_entry(disk_num, block_num, buf, true, false);
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+int cache_insert_prefetch(int disk_num, int block_num, const uint8_t *buf) {
+  if(shards != NULL) {
+    return shard_insert(disk_num, block_num, buf, false, true);
+  }
+  if(shm != NULL) {
+    return shm_insert(disk_num, block_num, buf, false, true);
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = cache_insert_entry(disk_num, block_num, buf, false, true);
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+bool cache_contains(int disk_num, int block_num) {
+  if(block_num < 0 || block_num >= 256 || disk_num < 0 || disk_num >= 16) {
+    return false;
+  }
+  if(shards != NULL) {
+    return __atomic_load_n(&shard_slots[cache_key(disk_num, block_num)], __ATOMIC_RELAXED) != CACHE_NIL;
+  }
+  if(shm != NULL) {
+    return shm_contains(disk_num, block_num);
+  }
+  pthread_mutex_lock(&cache_lock);
+  bool found = false;
+  if(assoc_tags != NULL) {
+    found = assoc_find(cache_key(disk_num, block_num)) != CACHE_NIL;
+  } else if(extents != NULL) {
+    found = extent_of[cache_key(disk_num, block_num)] != CACHE_NIL;
+  } else if(cache != NULL) {
+    found = cache_find(disk_num, block_num) != CACHE_NIL;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return found;
+}
+
+int cache_lookup_range(int disk_num, int block_num, int count, uint8_t **blocks) {
+  if(extents == NULL) {
+    //The other modes look the blocks up one by one
+    int found = 0;
+    while(found < count && cache_lookup(disk_num, block_num + found, blocks[found]) == 1) {
+      found += 1;
+    }
+    return found;
+  }
+  pthread_mutex_lock(&cache_lock);
+  int found = extent_lookup_range(disk_num, block_num, count, blocks);
+  pthread_mutex_unlock(&cache_lock);
+  return found;
+}
+
+int cache_insert_range(int disk_num, int block_num, int count, uint8_t **blocks) {
+  if(extents == NULL) {
+    int rc = 1;
+    for(int i = 0; i < count; i++) {
+      if(cache_insert(disk_num, block_num + i, blocks[i]) == -1) {
+        rc = -1;
+      }
+    }
+    return rc;
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = extent_insert_range(disk_num, block_num, count, blocks, false, false);
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+void cache_get_prefetch_stats(int *used, int *wasted) {
+  cache_stats_t total = stats_total();
+  *used = total.prefetch_used;
+  *wasted = total.prefetch_wasted;
+}
+
+static int write_locked(int disk_num, int block_num, int offset, int len, const uint8_t *buf) {
+  if(assoc_tags != NULL) {
+    if(buf == NULL || !valid_block(disk_num, block_num) || offset < 0 || len < 0 || offset + len > JBOD_BLOCK_SIZE) {
+      return -1;
+    }
+    STAT_ADD(queries);
+    if(assoc_patch(disk_num, block_num, offset, len, buf, true) == -1) {
+      return -1;
+    }
+    STAT_ADD(hits);
+    return 1;
+  }
+  if(extents != NULL) {
+    if(buf == NULL || !valid_block(disk_num, block_num) || offset < 0 || len < 0 || offset + len > JBOD_BLOCK_SIZE) {
+      return -1;
+    }
+    STAT_ADD(queries);
+    if(extent_patch(disk_num, block_num, offset, len, buf, true) == -1) {
+      return -1;
+    }
+    STAT_ADD(hits);
+    return 1;
+  }
+  //If cache or buffer of invalid size / Dont exist
+  if(cache == NULL || buf == NULL) {
+    return -1;
+  }
+  //Bounds Check
+  if(block_num < 0 || block_num >= 256) {
+    return -1;
+  }
+  if(disk_num < 0 || disk_num >= 16) {
+    return -1;
+  }
+  if(offset < 0 || len < 0 || offset + len > JBOD_BLOCK_SIZE) {
+    return -1;
+  }
+  STAT_ADD(queries);
+  int index = cache_find(disk_num, block_num);
+  if(index == CACHE_NIL || !cache_verify(index)) {
+    return -1;
+  }
+  //Patch the cached block in place, it now differs from the disk until written back
+  memcpy(cache[index].block + offset, buf, len);
+  if(!cache[index].dirty) {
+    cache[index].dirty = true;
+    num_dirty += 1;
+  }
+  cache_used(index);
+  cache_touch(index);
+  STAT_ADD(hits);
   return 1;
 }
 
+int cache_write(int disk_num, int block_num, int offset, int len, const uint8_t *buf) {
+  if(shards != NULL) {
+    if(buf == NULL || !valid_block(disk_num, block_num) || offset < 0 || len < 0 || offset + len > JBOD_BLOCK_SIZE) {
+      return -1;
+    }
+    STAT_ADD(queries);
+    if(shard_patch(disk_num, block_num, offset, len, buf, true) == -1) {
+      return -1;
+    }
+    STAT_ADD(hits);
+    return 1;
+  }
+  if(shm != NULL) {
+    if(buf == NULL || !valid_block(disk_num, block_num) || offset < 0 || len < 0 || offset + len > JBOD_BLOCK_SIZE) {
+      return -1;
+    }
+    STAT_ADD(queries);
+    if(shm_patch(disk_num, block_num, offset, len, buf, true) == -1) {
+      return -1;
+    }
+    STAT_ADD(hits);
+    return 1;
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = write_locked(disk_num, block_num, offset, len, buf);
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+void cache_set_writeback(cache_writeback_fn fn) {
+  writeback = fn;
+}
+
+void cache_set_validator(cache_validate_fn fn) {
+  validate = fn;
+}
+
+void cache_get_stats(cache_counters_t *counters) {
+  cache_stats_t total = stats_total();
+  counters->lookups = total.queries;
+  counters->hits = total.hits;
+  counters->misses = total.queries - total.hits;
+  counters->evictions = total.evictions;
+  counters->insert_collisions = total.collisions;
+  counters->prefetch_used = total.prefetch_used;
+  counters->prefetch_wasted = total.prefetch_wasted;
+}
+
+void cache_get_validation_stats(int *validated, int *stale) {
+  cache_stats_t total = stats_total();
+  *validated = total.validated;
+  *stale = total.stale;
+}
+
+static int flush_locked(void) {
+  if(assoc_tags != NULL) {
+    return assoc_flush();
+  }
+  if(extents != NULL) {
+    return extent_flush();
+  }
+  if(cache == NULL) {
+    return -1;
+  }
+  int flushed = 0;
+  //Walk the index in key order so dirty blocks go out sorted by (disk, block),
+  //each one with the lock dropped for the round trip
+  for(int key = 0; key < CACHE_NUM_KEYS && num_dirty > 0; key++) {
+    int index = cache_keys[key].slot;
+    if(index != CACHE_NIL && cache[index].dirty) {
+      if(cache_clean_unlocked(index) == -1 || cache == NULL) {
+        return -1;
+      }
+      flushed += 1;
+    }
+  }
+  return flushed;
+}
+
+int cache_flush(void) {
+  if(shards != NULL) {
+    return shard_flush();
+  }
+  if(shm != NULL) {
+    return shm_flush();
+  }
+  pthread_mutex_lock(&cache_lock);
+  int rc = flush_locked();
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+//Orders entry positions from the least to the most recently used.
+static int compare_access_time(const void *a, const void *b) {
+  return cache[*(const int *)a].access_time - cache[*(const int *)b].access_time;
+}
+
+static int save_locked(const char *path) {
+  if(cache == NULL || path == NULL) {
+    return -1;
+  }
+  //The snapshot only holds clean blocks, the disk has to have the rest first.
+  //Blocks written again while the flush had the lock dropped are left out.
+  if(num_dirty > 0 && (flush_locked() == -1 || cache == NULL)) {
+    return -1;
+  }
+  int order[cache_size];
+  int count = 0;
+  for(int index = 0; index < num_used; index++) {
+    if(cache[index].valid && !cache[index].dirty) {
+      order[count++] = index;
+    }
+  }
+  qsort(order, count, sizeof(int), compare_access_time);
+
+  //Fill a temporary file through a shared mapping and move it over the old snapshot
+  char tmp[strlen(path) + 5];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  size_t len = sizeof(snapshot_header_t) + count * sizeof(snapshot_entry_t);
+  int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd == -1) {
+    return -1;
+  }
+  if(ftruncate(fd, len) == -1) {
+    close(fd);
+    unlink(tmp);
+    return -1;
+  }
+  uint8_t *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    unlink(tmp);
+    return -1;
+  }
+  snapshot_header_t *header = (snapshot_header_t *)map;
+  snapshot_entry_t *entries = (snapshot_entry_t *)(map + sizeof(snapshot_header_t));
+  header->magic = SNAPSHOT_MAGIC;
+  header->version = SNAPSHOT_VERSION;
+  header->count = count;
+  for(int i = 0; i < count; i++) {
+    entries[i].disk_num = cache[order[i]].disk_num;
+    entries[i].block_num = cache[order[i]].block_num;
+    memcpy(entries[i].block, cache[order[i]].block, JBOD_BLOCK_SIZE);
+  }
+  int rc = msync(map, len, MS_SYNC);
+  munmap(map, len);
+  if(rc == -1 || rename(tmp, path) == -1) {
+    unlink(tmp);
+    return -1;
+  }
+  return count;
+}
+
+int cache_save(const char *path) {
+  pthread_mutex_lock(&cache_lock);
+  int rc = save_locked(path);
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
+static int load_locked(const char *path) {
+  if(cache == NULL || path == NULL) {
+    return -1;
+  }
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) {
+    return -1;
+  }
+  struct stat st;
+  if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(snapshot_header_t)) {
+    close(fd);
+    return -1;
+  }
+  const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    return -1;
+  }
+  madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+  const snapshot_header_t *header = (const snapshot_header_t *)map;
+  const snapshot_entry_t *entries = (const snapshot_entry_t *)(map + sizeof(snapshot_header_t));
+  if(header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+     st.st_size != (off_t)(sizeof(snapshot_header_t) + (size_t)header->count * sizeof(snapshot_entry_t))) {
+    munmap((void *)map, st.st_size);
+    return -1;
+  }
+  //Inserting from the least recently used end rebuilds the saved order; if the cache is
+  //smaller than the snapshot, the oldest blocks are evicted again
+  int loaded = 0;
+  for(uint32_t i = 0; i < header->count; i++) {
+    int disk_num = entries[i].disk_num;
+    int block_num = entries[i].block_num;
+    if(!valid_block(disk_num, block_num) || cache_find(disk_num, block_num) != CACHE_NIL) {
+      continue;
+    }
+    if(cache_insert_entry(disk_num, block_num, entries[i].block, false, false) == 1) {
+      cache[cache_find(disk_num, block_num)].unverified = true;
+      loaded += 1;
+    }
+  }
+  munmap((void *)map, st.st_size);
+  return loaded < cache_size ? loaded : cache_size;
+}
+
+int cache_load(const char *path) {
+  pthread_mutex_lock(&cache_lock);
+  int rc = load_locked(path);
+  pthread_mutex_unlock(&cache_lock);
+  return rc;
+}
+
 bool cache_enabled(void) {
   //Cache parameters checked in previous code
-  return (cache != NULL);
+  return (cache != NULL || shards != NULL || assoc_tags != NULL || extents != NULL || shm != NULL);
+}
+
+const char *cache_policy_name(cache_policy_t p) {
+  if(p < 0 || p >= CACHE_NUM_POLICIES) {
+    return NULL;
+  }
+  return policy_names[p];
+}
+
+int cache_policy_from_name(const char *name) {
+  for(int p = 0; p < CACHE_NUM_POLICIES; p++) {
+    if(strcmp(name, policy_names[p]) == 0) {
+      return p;
+    }
+  }
+  return -1;
 }
 
 void cache_print_hit_rate(void) {
-  fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float) num_hits / num_queries);
-}
\ No newline at end of file
+  cache_stats_t total = stats_total();
+  //Without lookups, e.g. with no cache, there is no rate to print
+  if(total.queries == 0) {
+    fprintf(stderr, "Hit rate:   n/a\n");
+    return;
+  }
+  fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float) total.hits / total.queries);
+}
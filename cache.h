@@ -13,13 +13,84 @@ typedef struct {
   int block_num;
   uint8_t block[JBOD_BLOCK_SIZE];
   int access_time;
+  int prev;        /* neighbour towards the most recent end of its list */
+  int next;        /* neighbour towards the eviction end of its list */
+  uint8_t list;    /* replacement policy list the entry is linked on */
+  bool referenced; /* CLOCK reference bit */
+  bool dirty;      /* newer than the copy on disk (write-back mode) */
+  bool prefetched; /* read ahead and not looked up since */
+  bool unverified; /* loaded from a snapshot, not checked against the disk yet */
 } cache_entry_t;
 
+/* Writes a dirty block back to disk. Returns 1 on success and -1 on failure. */
+typedef int (*cache_writeback_fn)(int disk_num, int block_num, const uint8_t *buf);
+
+/* Checks a block loaded from a snapshot against the copy on disk. Returns 1 if
+ * they match, 0 if the cached block is stale and -1 on failure. */
+typedef int (*cache_validate_fn)(int disk_num, int block_num, const uint8_t *buf);
+
+/* Replacement policies the cache can be created with. */
+typedef enum {
+  CACHE_POLICY_LRU,    /* strict least recently used */
+  CACHE_POLICY_CLOCK,  /* second-chance approximation of LRU */
+  CACHE_POLICY_2Q,     /* FIFO probation queue in front of an LRU main queue */
+  CACHE_POLICY_ARC,    /* adaptive replacement cache */
+  CACHE_NUM_POLICIES,
+} cache_policy_t;
+
 /* Returns 1 on success and -1 on failure. Should allocate a space for
  * |num_entries| cache entries, each of type cache_entry_t. Calling it again
  * without first calling cache_destroy (see below) should fail. */
 int cache_create(int num_entries);
 
+/* Same as cache_create, but evicts entries according to |policy| instead of
+ * LRU. Returns 1 on success and -1 on failure. */
+int cache_create_ex(int num_entries, cache_policy_t policy);
+
+/* Concurrent mode for caches shared by several threads. The blocks are
+ * partitioned into |num_shards| shards (block key modulo |num_shards|), each
+ * with its own lock and its own share of the |num_entries| entries, evicted
+ * with CLOCK. Lookups that hit take no lock; they copy the entry and retry if a
+ * writer changed it meanwhile. Returns 1 on success and -1 on failure. The
+ * cache must not be created or destroyed while other threads use it. */
+int cache_create_sharded(int num_entries, int num_shards);
+
+/* Set-associative mode. The |num_entries| entries are split into sets of
+ * |ways| entries (1 to 16, dividing |num_entries|); a block can only be cached
+ * in set (disk_num * 256 + block_num) % number of sets, and each set evicts its
+ * least recently used way. The tags of a set sit together, apart from the
+ * blocks, and are compared with one SIMD instruction where the CPU allows. The
+ * blocks are kept in a 64-byte aligned slab, on huge pages if |huge_pages| and
+ * the system has some to spare. Returns 1 on success and -1 on failure. */
+int cache_create_assoc(int num_entries, int ways, bool huge_pages);
+
+/* Extent mode. Entries are runs of up to 64 consecutive blocks of one disk,
+ * holding |num_entries| blocks in all. A block inserted next to a cached run
+ * joins it, and eviction trims blocks off the end of the least recently used
+ * run, so a sequential read of many blocks is answered by cache_lookup_range
+ * with one probe per run instead of one per block. Returns 1 on success and
+ * -1 on failure. */
+int cache_create_extent(int num_entries);
+
+/* Shared mode, for several processes on one machine working on the same JBOD.
+ * The cache lives in the POSIX shared memory segment |name| ("/something"),
+ * created with |num_entries| entries by the first process and attached by the
+ * others, whatever their |num_entries|. Entries are evicted with CLOCK under a
+ * process-shared robust lock: if a process dies holding it, the next one to
+ * lock drops the entry it was changing and carries on. Dirty blocks are written
+ * back by whichever process evicts or flushes them. cache_destroy detaches,
+ * the segment and its blocks stay until cache_remove_shared. Returns 1 on
+ * success and -1 on failure. */
+int cache_create_shared(const char *name, int num_entries);
+
+/* Removes the shared memory segment |name|. Processes attached to it keep
+ * using it until they detach. Returns 1 on success and -1 on failure. */
+int cache_remove_shared(const char *name);
+
+/* Returns how many times the lock of the shared cache was taken over from a
+ * process that died holding it, or -1 if the cache is not in shared mode. */
+int cache_shared_recovered(void);
+
 /* Returns 1 on success and -1 on failure. Frees the space allocated by
  * cache_create function above. */
 int cache_destroy(void);
@@ -39,10 +110,97 @@ int cache_insert(int disk_num, int block_num, const uint8_t *buf);
  * corresponding block with data from |buf| */
 void cache_update(int disk_num, int block_num, const uint8_t *buf);
 
+/* Write-back mode. Same as cache_insert, but the block is marked dirty: it is
+ * newer than the disk and will be passed to the write-back function before its
+ * entry is reused. Also returns -1, without inserting anything, if the entry
+ * to reuse holds a dirty block that cannot be written back; that block stays
+ * cached and dirty. cache_insert fails the same way. */
+int cache_insert_dirty(int disk_num, int block_num, const uint8_t *buf);
+
+/* Write-back mode. Returns 1 on success and -1 on failure. If the block at
+ * |disk_num| and |block_num| is cached, copies |len| bytes from |buf| into it
+ * at |offset| and marks it dirty. Returns -1 if the block is not cached. */
+int cache_write(int disk_num, int block_num, int offset, int len, const uint8_t *buf);
+
+/* Readahead. Same as cache_insert, but the block was read before anyone asked
+ * for it. It counts as used when it is first looked up (or written with
+ * cache_write) and as wasted if it is evicted or the cache is destroyed first. */
+int cache_insert_prefetch(int disk_num, int block_num, const uint8_t *buf);
+
+/* Looks up the |count| consecutive blocks of |disk_num| starting at
+ * |block_num| and copies them to blocks[0 .. count - 1], stopping at the first
+ * block that is not cached. Returns the number of blocks copied; each of them
+ * counts as a hit, the block that stopped the lookup as a miss. */
+int cache_lookup_range(int disk_num, int block_num, int count, uint8_t **blocks);
+
+/* Same as cache_insert for the |count| consecutive blocks of |disk_num|
+ * starting at |block_num|, from blocks[0 .. count - 1]. Blocks already cached
+ * are left alone. Returns 1 on success and -1 if any block was already cached
+ * or could not be inserted. */
+int cache_insert_range(int disk_num, int block_num, int count, uint8_t **blocks);
+
+/* Returns true if the block at |disk_num| and |block_num| is cached. Unlike
+ * cache_lookup it does not count as an access. */
+bool cache_contains(int disk_num, int block_num);
+
+/* Reports how many blocks inserted with cache_insert_prefetch were used and
+ * how many were wasted since the cache was created. */
+void cache_get_prefetch_stats(int *used, int *wasted);
+
+/* Sets the function used to write dirty blocks back to disk. */
+void cache_set_writeback(cache_writeback_fn fn);
+
+/* Writes every dirty block back to disk in (disk_num, block_num) order and
+ * marks them clean. Returns the number of blocks written or -1 on failure. */
+int cache_flush(void);
+
+/* Snapshots. Writes the cached blocks to the file at |path|, from the least
+ * to the most recently used, through a shared mapping of the file. Dirty
+ * blocks are written back first. The file is replaced atomically. Returns the
+ * number of blocks saved, or -1 on failure. Only the cache created with
+ * cache_create or cache_create_ex supports snapshots. */
+int cache_save(const char *path);
+
+/* Inserts the blocks of the snapshot at |path| into the cache, in their saved
+ * recency order. The loaded blocks are unverified: the first lookup or partial
+ * write of each one passes it to the validation function. A block that turns
+ * out stale is evicted and reported as a miss. A block the function fails to
+ * check is also a miss, but stays cached to be checked on its next use.
+ * Returns the number of blocks loaded, or -1 on failure. */
+int cache_load(const char *path);
+
+/* Sets the function used to validate blocks loaded from a snapshot. */
+void cache_set_validator(cache_validate_fn fn);
+
+/* Reports how many loaded blocks were confirmed current and how many were
+ * found stale since the cache was created. */
+void cache_get_validation_stats(int *validated, int *stale);
+
+/* Counters of the cache since it was created. Every thread counts on its own
+ * cache line, the counters add them up. */
+typedef struct {
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;         /* blocks dropped to make room for others */
+  uint64_t insert_collisions; /* inserts refused because the block was cached */
+  uint64_t prefetch_used;     /* prefetched blocks that were looked up */
+  uint64_t prefetch_wasted;   /* prefetched blocks evicted unused */
+} cache_counters_t;
+
+void cache_get_stats(cache_counters_t *counters);
+
 /* Returns true if cache is enabled and false if not. */
 bool cache_enabled(void);
 
-/* Prints the hit rate of the cache. */
+/* Returns the short name of |policy| ("lru", "clock", "2q", "arc"), or NULL. */
+const char *cache_policy_name(cache_policy_t policy);
+
+/* Returns the policy called |name|, or -1 if there is no such policy. */
+int cache_policy_from_name(const char *name);
+
+/* Prints the hit rate of the cache. Every thread counts its own hits and
+ * misses, the rate adds them up. Prints n/a if nothing was looked up. */
 void cache_print_hit_rate(void);
 
 #endif
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "cache.h"
+#include "jbod.h"
+
+#define BENCH_ARGUMENTS "ht:s:S:n:l"
+#define USAGE                                                        \
+  "USAGE: cache_bench [-h] [-t threads] [-s cache_size] [-S shards] [-n lookups] [-l]\n" \
+  "\n"                                                               \
+  "where:\n"                                                         \
+  "    -h - help mode (display this message)\n"                      \
+  "    -t - largest number of threads, runs 1, 2, 4, ... up to it (default 8)\n" \
+  "    -s - cache entries, every lookup hits (default 1024)\n"       \
+  "    -S - shards of the concurrent cache (default 16)\n"           \
+  "    -n - lookups per thread (default 2000000)\n"                  \
+  "    -l - compare cache layouts on one thread instead\n"          \
+  "\n"                                                               \
+  "Measures cache hit throughput against the number of threads, for the\n" \
+  "mutex protected LRU cache and for the sharded concurrent cache. With -l,\n" \
+  "compares the LRU, set-associative and extent caches at 256, 1024 and\n" \
+  "4096 entries, on hits only, on random blocks inserted when missed, and on\n" \
+  "runs of 16 resident blocks looked up with cache_lookup_range.\n"
+
+//A cache layout compared by -l.
+typedef struct {
+  const char *name;
+  int ways;         //0 for the LRU or extent cache
+  bool huge_pages;
+  bool extent;
+} layout_t;
+
+static const layout_t layouts[] = {
+  { "lru", 0, false, false },
+  { "assoc 4-way", 4, false, false },
+  { "assoc 8-way", 8, false, false },
+  { "assoc 16-way", 16, false, false },
+  { "assoc 16-way huge", 16, true, false },
+  { "extent", 0, false, true },
+};
+
+typedef struct {
+  pthread_t thread;
+  int id;
+  long lookups;
+} worker_t;
+
+static int cache_size = 1024;
+static pthread_barrier_t start;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//xorshift32, cheaper than rand_r and keeps the threads independent.
+static uint32_t xorshift(uint32_t *seed) {
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 17;
+  *seed ^= *seed << 5;
+  return *seed;
+}
+
+//Looks up random resident blocks, every lookup is a hit.
+static void *worker(void *arg) {
+  worker_t *w = arg;
+  uint32_t seed = 2463534242u + w->id;
+  uint8_t buf[JBOD_BLOCK_SIZE];
+
+  pthread_barrier_wait(&start);
+  for (long i = 0; i < w->lookups; i++) {
+    int key = xorshift(&seed) % cache_size;
+    if (cache_lookup(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, buf) != 1)
+      errx(1, "lookup of resident block %d missed", key);
+  }
+  return NULL;
+}
+
+//Runs |threads| workers against the current cache and returns lookups per second.
+static double run(int threads, long lookups) {
+  worker_t workers[threads];
+
+  pthread_barrier_init(&start, NULL, threads + 1);
+  for (int i = 0; i < threads; i++) {
+    workers[i].id = i;
+    workers[i].lookups = lookups;
+    if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]) != 0)
+      errx(1, "Failed to start thread %d", i);
+  }
+  double begin = now();
+  pthread_barrier_wait(&start);
+  for (int i = 0; i < threads; i++)
+    pthread_join(workers[i].thread, NULL);
+  double elapsed = now() - begin;
+  pthread_barrier_destroy(&start);
+  return threads * lookups / elapsed;
+}
+
+//Fills the cache with blocks 0 .. cache_size - 1.
+static void fill(void) {
+  uint8_t block[JBOD_BLOCK_SIZE];
+
+  for (int key = 0; key < cache_size; key++) {
+    memset(block, key, JBOD_BLOCK_SIZE);
+    if (cache_insert(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, block) != 1)
+      errx(1, "Failed to insert block %d", key);
+  }
+}
+
+//Runs |lookups| lookups of random blocks against the current cache and returns lookups
+//per second. With |all_blocks| the blocks come from the whole JBOD and misses are
+//inserted, otherwise they are the resident blocks 0 .. cache_size - 1.
+static double run_layout(long lookups, bool all_blocks) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  uint32_t seed = 2463534242u;
+  int range = all_blocks ? JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK : cache_size;
+
+  memset(buf, 0, JBOD_BLOCK_SIZE);
+  double begin = now();
+  for (long i = 0; i < lookups; i++) {
+    int key = xorshift(&seed) % range;
+    int disk = key / JBOD_NUM_BLOCKS_PER_DISK, block = key % JBOD_NUM_BLOCKS_PER_DISK;
+    if (cache_lookup(disk, block, buf) != 1) {
+      if (!all_blocks)
+        errx(1, "lookup of resident block %d missed", key);
+      cache_insert(disk, block, buf);
+    }
+  }
+  return lookups / (now() - begin);
+}
+
+//Looks up |lookups| blocks as random runs of RUN_BLOCKS resident blocks with
+//cache_lookup_range and returns blocks per second.
+#define RUN_BLOCKS 16
+static double run_ranges(long lookups) {
+  uint8_t bufs[RUN_BLOCKS][JBOD_BLOCK_SIZE];
+  uint8_t *blocks[RUN_BLOCKS];
+  uint32_t seed = 2463534242u;
+  int runs = cache_size / RUN_BLOCKS;
+
+  for (int i = 0; i < RUN_BLOCKS; i++)
+    blocks[i] = bufs[i];
+  double begin = now();
+  for (long i = 0; i < lookups; i += RUN_BLOCKS) {
+    int key = xorshift(&seed) % runs * RUN_BLOCKS;
+    if (cache_lookup_range(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK, RUN_BLOCKS, blocks) != RUN_BLOCKS)
+      errx(1, "lookup of resident run %d missed", key);
+  }
+  return lookups / (now() - begin);
+}
+
+//Creates the cache of |layout| with cache_size entries.
+static void create_layout(const layout_t *layout) {
+  int rc;
+  if (layout->extent)
+    rc = cache_create_extent(cache_size);
+  else if (layout->ways)
+    rc = cache_create_assoc(cache_size, layout->ways, layout->huge_pages);
+  else
+    rc = cache_create(cache_size);
+  if (rc != 1)
+    errx(1, "Failed to create the %s cache.", layout->name);
+}
+
+//Compares the layouts of the cache at a few sizes.
+static void compare_layouts(long lookups) {
+  static const int sizes[] = { 256, 1024, 4096 };
+
+  printf("%ld lookups per run\n", lookups);
+  printf("%8s %-18s %14s %14s %14s\n", "entries", "layout", "hit Mops/s", "mixed Mops/s", "run Mblocks/s");
+  for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    for (int j = 0; j < sizeof(layouts) / sizeof(layouts[0]); j++) {
+      const layout_t *layout = &layouts[j];
+      double hits, mixed;
+
+      cache_size = sizes[i];
+      for (int all_blocks = 0; all_blocks < 2; all_blocks++) {
+        create_layout(layout);
+        fill();
+        double rate = run_layout(lookups, all_blocks);
+        cache_destroy();
+        if (all_blocks)
+          mixed = rate;
+        else
+          hits = rate;
+      }
+      create_layout(layout);
+      fill();
+      double ranges = run_ranges(lookups);
+      cache_destroy();
+      printf("%8d %-18s %14.2f %14.2f %14.2f\n", cache_size, layout->name, hits / 1e6, mixed / 1e6, ranges / 1e6);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int ch, max_threads = 8, shards = 16;
+  long lookups = 2000000;
+  bool layouts_mode = false;
+
+  while ((ch = getopt(argc, argv, BENCH_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 't':
+        max_threads = atoi(optarg);
+        break;
+      case 's':
+        cache_size = atoi(optarg);
+        break;
+      case 'S':
+        shards = atoi(optarg);
+        break;
+      case 'n':
+        lookups = atol(optarg);
+        break;
+      case 'l':
+        layouts_mode = true;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (max_threads < 1 || lookups < 1) {
+    fprintf(stderr, USAGE);
+    return -1;
+  }
+  if (layouts_mode) {
+    compare_layouts(lookups);
+    return 0;
+  }
+
+  printf("%d entries, %d shards, %ld lookups per thread, %ld online cpus\n",
+         cache_size, shards, lookups, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%8s %16s %16s\n", "threads", "mutex Mhits/s", "sharded Mhits/s");
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    if (cache_create(cache_size) != 1)
+      errx(1, "Failed to create cache.");
+    fill();
+    double locked = run(threads, lookups);
+    cache_destroy();
+
+    if (cache_create_sharded(cache_size, shards) != 1)
+      errx(1, "Failed to create sharded cache.");
+    fill();
+    double sharded = run(threads, lookups);
+    cache_destroy();
+
+    printf("%8d %16.2f %16.2f\n", threads, locked / 1e6, sharded / 1e6);
+  }
+  return 0;
+}
@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "cache.h"
+#include "jbod.h"
+
+#define TEST_ENTRIES 8
+#define MAX_WRITTEN 64
+
+//A cache layout under test, created with TEST_ENTRIES entries.
+typedef struct {
+  const char *name;
+  int (*create)(void);
+} layout_t;
+
+//A test of the table below, run on its own cache.
+typedef struct {
+  const char *name;
+  void (*run)(void);
+} test_t;
+
+//The test and layout running, and whether all the test's checks held so far.
+static const char *current;
+static const char *current_layout = NULL;
+static bool passed;
+
+//Fails the current test with a message unless |cond| holds.
+#define CHECK(cond, ...)                                                         \
+  do {                                                                           \
+    if (!(cond)) {                                                               \
+      fprintf(stderr, "%s%s%s: ", current, current_layout ? "/" : "",            \
+              current_layout ? current_layout : "");                             \
+      fprintf(stderr, __VA_ARGS__);                                              \
+      fputc('\n', stderr);                                                       \
+      passed = false;                                                            \
+    }                                                                            \
+  } while (0)
+
+//Blocks written back land here, unless the write-back is made to fail, and
+//their keys are recorded in the order they came.
+static uint8_t disks[JBOD_NUM_DISKS][JBOD_NUM_BLOCKS_PER_DISK][JBOD_BLOCK_SIZE];
+static bool fail_writeback = false;
+static int written[MAX_WRITTEN];
+static int num_written = 0;
+
+//Set by test_unlocked_writeback: the next write-back looks the block up from another
+//thread and inserts block (3, 0), which must get through while the write-back runs.
+static bool probe_writeback = false;
+static pthread_t probe_thread;
+static pthread_mutex_t probe_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t probe_cond = PTHREAD_COND_INITIALIZER;
+static bool probe_done;
+static bool probe_found;
+static bool probe_blocked;
+static int probe_key;
+
+static void *probe(void *arg) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  int rc = cache_lookup(probe_key / JBOD_NUM_BLOCKS_PER_DISK, probe_key % JBOD_NUM_BLOCKS_PER_DISK, buf);
+  memset(buf, 0, sizeof(buf));
+  int inserted = cache_insert(3, 0, buf);
+  pthread_mutex_lock(&probe_lock);
+  probe_done = true;
+  probe_found = (rc == 1 && inserted == 1);
+  pthread_cond_signal(&probe_cond);
+  pthread_mutex_unlock(&probe_lock);
+  return NULL;
+}
+
+//Starts the probe for |key| and waits for it for a second at most. The caller joins it.
+static void run_probe(int key) {
+  struct timespec deadline;
+  probe_writeback = false;
+  probe_key = key;
+  probe_done = false;
+  if (pthread_create(&probe_thread, NULL, probe, NULL) != 0) {
+    probe_blocked = true;
+    return;
+  }
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 1;
+  pthread_mutex_lock(&probe_lock);
+  while (!probe_done && pthread_cond_timedwait(&probe_cond, &probe_lock, &deadline) == 0)
+    ;
+  probe_blocked = !probe_done;
+  pthread_mutex_unlock(&probe_lock);
+}
+
+static int writeback(int disk_num, int block_num, const uint8_t *buf) {
+  if (fail_writeback)
+    return -1;
+  if (probe_writeback)
+    run_probe(disk_num * JBOD_NUM_BLOCKS_PER_DISK + block_num);
+  memcpy(disks[disk_num][block_num], buf, JBOD_BLOCK_SIZE);
+  if (num_written < MAX_WRITTEN)
+    written[num_written++] = disk_num * JBOD_NUM_BLOCKS_PER_DISK + block_num;
+  return 1;
+}
+
+static int create_lru(void) { return cache_create_ex(TEST_ENTRIES, CACHE_POLICY_LRU); }
+static int create_clock(void) { return cache_create_ex(TEST_ENTRIES, CACHE_POLICY_CLOCK); }
+static int create_2q(void) { return cache_create_ex(TEST_ENTRIES, CACHE_POLICY_2Q); }
+static int create_arc(void) { return cache_create_ex(TEST_ENTRIES, CACHE_POLICY_ARC); }
+static int create_sharded(void) { return cache_create_sharded(TEST_ENTRIES, 2); }
+static int create_assoc(void) { return cache_create_assoc(TEST_ENTRIES, 4, false); }
+static int create_extent(void) { return cache_create_extent(TEST_ENTRIES); }
+
+//The segment is removed right away, the cache keeps it until cache_destroy detaches.
+static int create_shared(void) {
+  char name[32];
+  snprintf(name, sizeof(name), "/cache_test.%d", (int)getpid());
+  int rc = cache_create_shared(name, TEST_ENTRIES);
+  cache_remove_shared(name);
+  return rc;
+}
+
+static const layout_t layouts[] = {
+  { "lru", create_lru },
+  { "clock", create_clock },
+  { "2q", create_2q },
+  { "arc", create_arc },
+  { "sharded", create_sharded },
+  { "assoc", create_assoc },
+  { "extent", create_extent },
+  { "shared", create_shared },
+};
+#define NUM_LAYOUTS (int)(sizeof(layouts) / sizeof(layouts[0]))
+
+//Creates the cache of |layout| with the recording write-back. Returns false if it failed.
+static bool setup(const layout_t *layout) {
+  if (layout->create() != 1) {
+    CHECK(false, "creating the cache failed");
+    return false;
+  }
+  memset(disks, 0, sizeof(disks));
+  num_written = 0;
+  fail_writeback = false;
+  cache_set_writeback(writeback);
+  return true;
+}
+
+static void teardown(void) {
+  cache_set_writeback(NULL);
+  cache_destroy();
+}
+
+//Checks that block |disk_num|, |block_num| is cached and holds |fill| bytes.
+static bool cached_as(int disk_num, int block_num, uint8_t fill) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  if (cache_lookup(disk_num, block_num, buf) != 1)
+    return false;
+  for (int i = 0; i < JBOD_BLOCK_SIZE; i++)
+    if (buf[i] != fill)
+      return false;
+  return true;
+}
+
+//Dirty blocks are written back by a flush, in (disk, block) order and only once,
+//cache_write dirties a clean block, and clean blocks are never written back.
+static void test_writeback(void) {
+  static const int dirty_keys[][2] = { { 3, 5 }, { 0, 9 }, { 3, 1 }, { 0, 2 } };
+  uint8_t buf[JBOD_BLOCK_SIZE];
+
+  for (int l = 0; l < NUM_LAYOUTS; l++) {
+    current_layout = layouts[l].name;
+    if (!setup(&layouts[l]))
+      continue;
+    memset(buf, 0x22, sizeof(buf));
+    for (int i = 0; i < 4; i++)
+      CHECK(cache_insert_dirty(dirty_keys[i][0], dirty_keys[i][1], buf) == 1, "inserting a dirty block failed");
+    CHECK(cache_insert(1, 7, buf) == 1, "inserting a clean block failed");
+    CHECK(cache_insert_dirty(1, 7, buf) == -1, "a cached block was inserted again");
+    CHECK(cache_flush() == 4 && num_written == 4, "the flush wrote %d blocks, not the 4 dirty ones", num_written);
+    for (int i = 1; i < num_written; i++)
+      CHECK(written[i - 1] < written[i], "the flush did not go in (disk, block) order");
+    CHECK(cache_flush() == 0, "a second flush found dirty blocks");
+
+    //A write to a clean block dirties it, the write lands in the cached copy
+    memset(buf, 0x33, 16);
+    CHECK(cache_write(1, 7, 0, 16, buf) == 1, "writing to a cached block failed");
+    CHECK(cache_write(2, 2, 0, 16, buf) == -1, "writing to a block that is not cached succeeded");
+    num_written = 0;
+    CHECK(cache_flush() == 1 && num_written == 1 && written[0] == JBOD_NUM_BLOCKS_PER_DISK + 7,
+          "the written block was not flushed");
+    CHECK(disks[1][7][0] == 0x33 && disks[1][7][16] == 0x22, "the flushed block does not hold the write");
+
+    //Evicting clean blocks writes nothing
+    num_written = 0;
+    memset(buf, 0x44, sizeof(buf));
+    for (int i = 0; i < 4 * TEST_ENTRIES; i++)
+      cache_insert(5, i, buf);
+    CHECK(num_written == 0, "%d clean blocks were written back", num_written);
+    teardown();
+  }
+}
+
+//Dirties a block, then fills the cache with others while the write-back fails.
+//The dirty block must stay cached, and reach the disk once the write-back works.
+static void test_failed_writeback(void) {
+  uint8_t block[JBOD_BLOCK_SIZE], buf[JBOD_BLOCK_SIZE];
+
+  for (int l = 0; l < NUM_LAYOUTS; l++) {
+    current_layout = layouts[l].name;
+    if (!setup(&layouts[l]))
+      continue;
+    memset(block, 0xab, sizeof(block));
+    CHECK(cache_insert_dirty(0, 0, block) == 1, "inserting the dirty block failed");
+
+    //The filler blocks are on another disk, so that no extent grows from block 0
+    fail_writeback = true;
+    int failed = 0;
+    memset(buf, 0x11, sizeof(buf));
+    for (int i = 0; i < 4 * TEST_ENTRIES; i++)
+      if (cache_insert(1, i, buf) == -1)
+        failed++;
+    CHECK(failed > 0, "no insert reported the failed write-back");
+    CHECK(cached_as(0, 0, 0xab), "the dirty block was dropped when its write-back failed");
+    CHECK(cache_flush() == -1, "the flush did not report the failed write-back");
+
+    fail_writeback = false;
+    CHECK(cache_flush() >= 1 && memcmp(disks[0][0], block, sizeof(block)) == 0,
+          "the dirty block did not reach the disk");
+    teardown();
+  }
+}
+
+//Returns the layout called |name|.
+static const layout_t *layout_named(const char *name) {
+  for (int l = 0; l < NUM_LAYOUTS; l++)
+    if (strcmp(layouts[l].name, name) == 0)
+      return &layouts[l];
+  return NULL;
+}
+
+//The write-back of a dirty victim runs without the cache locked: another thread can
+//look blocks up meanwhile, and still finds the victim until it is on the disk.
+static void test_unlocked_writeback(void) {
+  static const char *names[] = { "lru", "clock", "2q", "arc", "sharded", "shared" };
+  uint8_t buf[JBOD_BLOCK_SIZE];
+
+  for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+    current_layout = names[n];
+    if (!setup(layout_named(names[n])))
+      continue;
+    memset(buf, 0x5a, sizeof(buf));
+    CHECK(cache_insert_dirty(0, 0, buf) == 1, "inserting the dirty block failed");
+    memset(buf, 0, sizeof(buf));
+    for (int i = 1; i < TEST_ENTRIES; i++)
+      cache_insert(1, i, buf);
+
+    probe_writeback = true;
+    CHECK(cache_insert(2, 0, buf) == 1, "the insert that evicts the dirty block failed");
+    CHECK(!probe_writeback, "the dirty block was not written back");
+    if (!probe_writeback) {
+      pthread_join(probe_thread, NULL);
+      CHECK(!probe_blocked, "the cache was locked during the write-back");
+      CHECK(probe_blocked || probe_found, "the block was gone before it reached the disk, or the insert failed");
+    }
+    probe_writeback = false;
+    //The probe used the block again, so it may stay cached, but clean
+    CHECK(disks[0][0][0] == 0x5a, "the dirty block did not reach the disk");
+    CHECK(cache_flush() == 0, "the block written back is still dirty");
+    teardown();
+  }
+}
+
+//Shared mode: a process that dies holding the lock, halfway through an insert, costs
+//the entry it was filling and nothing else, also once CLOCK reaches that empty entry.
+//The child's buffer is unreadable, so it faults in the copy, with the lock held.
+static void test_shared_recovery(void) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  int status = 0;
+
+  current_layout = "shared";
+  if (!setup(layout_named("shared")))
+    return;
+  for (int i = 0; i < TEST_ENTRIES; i++) {
+    memset(buf, i, sizeof(buf));
+    cache_insert(0, i, buf);
+  }
+  uint8_t *unreadable = mmap(NULL, JBOD_BLOCK_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  CHECK(unreadable != MAP_FAILED, "mapping the unreadable buffer failed");
+  pid_t pid = unreadable == MAP_FAILED ? -1 : fork();
+  if (pid == 0) {
+    struct rlimit no_core = { 0, 0 };
+    setrlimit(RLIMIT_CORE, &no_core);
+    cache_insert(1, 0, unreadable);
+    _exit(0);
+  }
+  CHECK(pid != -1 && waitpid(pid, &status, 0) == pid && WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV,
+        "the child did not die in the insert");
+  if (unreadable != MAP_FAILED)
+    munmap(unreadable, JBOD_BLOCK_SIZE);
+  CHECK(!cache_contains(1, 0), "the half inserted block is cached");
+  CHECK(cache_shared_recovered() == 1, "the lock was recovered %d times, not once", cache_shared_recovered());
+
+  //Cycle the cache twice, through the entry the child left empty
+  for (int i = 0; i < 2 * TEST_ENTRIES; i++) {
+    memset(buf, 0x80 + i, sizeof(buf));
+    CHECK(cache_insert(2, i, buf) == 1, "inserting block %d after the recovery failed", i);
+  }
+  CHECK(cache_shared_recovered() == 1, "the recovery count became %d", cache_shared_recovered());
+  for (int i = TEST_ENTRIES; i < 2 * TEST_ENTRIES; i++)
+    CHECK(cached_as(2, i, 0x80 + i), "block %d is not cached intact", i);
+  teardown();
+}
+
+//Inserts |count| new blocks of disk |disk_num| from block |first| on, once each.
+static void scan(int disk_num, int first, int count) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  memset(buf, 0, sizeof(buf));
+  for (int i = 0; i < count; i++)
+    cache_insert(disk_num, first + i, buf);
+}
+
+//Replacement policies. LRU evicts the least recently used block and CLOCK gives a
+//referenced block a second chance. 2Q and ARC keep a block that was used twice, or
+//that comes back from a ghost list, through a scan that flushes LRU.
+static void test_policies(void) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+
+  for (cache_policy_t policy = CACHE_POLICY_LRU; policy <= CACHE_POLICY_CLOCK; policy++) {
+    current_layout = policy == CACHE_POLICY_LRU ? "lru" : "clock";
+    CHECK(cache_create_ex(TEST_ENTRIES, policy) == 1, "creating the cache failed");
+    scan(0, 0, TEST_ENTRIES);
+    CHECK(cache_lookup(0, 0, buf) == 1, "a block was evicted before the cache was full");
+    scan(1, 0, 1);
+    CHECK(cache_contains(0, 0), "the block just used was evicted");
+    CHECK(!cache_contains(0, 1), "the least recently used block was kept");
+    CHECK(cache_contains(1, 0), "the new block was not inserted");
+    cache_destroy();
+  }
+
+  //A hot block survives a scan twice the cache size, except under LRU
+  for (cache_policy_t policy = CACHE_POLICY_LRU; policy < CACHE_NUM_POLICIES; policy++) {
+    static const char *names[] = { "lru", "clock", "2q", "arc" };
+    current_layout = names[policy];
+    CHECK(cache_create_ex(TEST_ENTRIES, policy) == 1, "creating the cache failed");
+    scan(0, 0, 1);
+    if (policy == CACHE_POLICY_2Q) {
+      //2Q promotes a block when it comes back while remembered on A1out
+      scan(1, 0, TEST_ENTRIES);
+      CHECK(!cache_contains(0, 0), "the block was not evicted by the first scan");
+      scan(0, 0, 1);
+    } else {
+      cache_lookup(0, 0, buf);
+    }
+    //CLOCK keeps the block only while it is used between sweeps
+    for (int i = 0; i < 2 * TEST_ENTRIES; i++) {
+      scan(2, i, 1);
+      if (policy == CACHE_POLICY_CLOCK)
+        cache_lookup(0, 0, buf);
+    }
+    if (policy == CACHE_POLICY_LRU)
+      CHECK(!cache_contains(0, 0), "LRU kept a block the scan pushed out");
+    else
+      CHECK(cache_contains(0, 0), "the hot block was evicted by the scan");
+    cache_destroy();
+  }
+
+  //ARC: a block evicted from T1 and inserted again is a B1 ghost hit, it goes to T2.
+  //T1 and B1 hold at most the cache size together, so with one block in T2 and T1
+  //full the ghost is only kept until the next miss.
+  current_layout = "arc ghost";
+  CHECK(cache_create_ex(TEST_ENTRIES, CACHE_POLICY_ARC) == 1, "creating the cache failed");
+  scan(0, 1, 1);
+  cache_lookup(0, 1, buf);
+  scan(0, 0, 1);
+  scan(1, 0, TEST_ENTRIES - 1);
+  CHECK(!cache_contains(0, 0), "the block was not evicted by the first scan");
+  scan(0, 0, 1);
+  scan(2, 0, 2 * TEST_ENTRIES);
+  CHECK(cache_contains(0, 0), "the block that came back from B1 was evicted by the scan");
+  cache_destroy();
+
+  CHECK(cache_policy_from_name("arc") == CACHE_POLICY_ARC && cache_policy_from_name("2q") == CACHE_POLICY_2Q &&
+        cache_policy_from_name("bogus") == -1, "policy names are not parsed");
+}
+
+//Snapshot validation answers, per block of disk 0, and how many checks were made.
+static int validate_result[JBOD_NUM_BLOCKS_PER_DISK];
+static int num_validated = 0;
+
+static int validate(int disk_num, int block_num, const uint8_t *buf) {
+  num_validated++;
+  return validate_result[block_num];
+}
+
+//Blocks loaded from a snapshot are checked on first use. A current one becomes a hit, a
+//stale one is evicted on the spot and its entry reused, and one that could not be
+//checked stays cached and unverified, without counting as stale.
+static void test_snapshot(void) {
+  char path[64];
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  int validated, stale;
+
+  current_layout = "lru";
+  snprintf(path, sizeof(path), "/tmp/cache_test.%d.snap", (int)getpid());
+  if (!setup(layout_named("lru")))
+    return;
+  for (int i = 0; i < 3; i++) {
+    memset(buf, i, sizeof(buf));
+    cache_insert(0, i, buf);
+  }
+  CHECK(cache_save(path) == 3, "saving the snapshot failed");
+  teardown();
+  if (!setup(layout_named("lru")))
+    return;
+  cache_set_validator(validate);
+  CHECK(cache_load(path) == 3, "loading the snapshot failed");
+  unlink(path);
+
+  validate_result[0] = 1;
+  validate_result[1] = 0;
+  validate_result[2] = -1;
+  num_validated = 0;
+  CHECK(cached_as(0, 0, 0) && cached_as(0, 0, 0) && num_validated == 1, "a current block was not a hit checked once");
+  CHECK(cache_lookup(0, 1, buf) == -1 && !cache_contains(0, 1), "a stale block was kept");
+  CHECK(cache_lookup(0, 1, buf) == -1 && num_validated == 2, "a stale block was checked again");
+  CHECK(cache_lookup(0, 2, buf) == -1 && cache_contains(0, 2), "a block that could not be checked was dropped");
+  cache_get_validation_stats(&validated, &stale);
+  CHECK(validated == 1 && stale == 1, "%d blocks validated and %d stale, not 1 and 1", validated, stale);
+  validate_result[2] = 1;
+  CHECK(cached_as(0, 2, 2) && num_validated == 4, "a block that could not be checked was not checked again");
+
+  //The stale block's entry is free again, the cache holds 6 more blocks before evicting
+  scan(1, 0, TEST_ENTRIES - 2);
+  CHECK(cache_contains(0, 0) && cache_contains(0, 2), "a block was evicted while an entry was free");
+  scan(1, TEST_ENTRIES, 1);
+  CHECK(!cache_contains(0, 0), "the least recently used block was not evicted from the full cache");
+  cache_set_validator(NULL);
+  teardown();
+}
+
+//Set-associative mode: a block only competes with the blocks of its set, and each set
+//evicts its least recently used way. 6 entries of 2 ways make an odd number of sets.
+static void test_assoc(void) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+
+  CHECK(cache_create_assoc(6, 4, false) == -1, "ways that do not divide the entries were accepted");
+  CHECK(cache_create_assoc(34, 17, false) == -1, "more than 16 ways were accepted");
+  CHECK(cache_create_assoc(6, 2, false) == 1, "creating a cache of 3 sets failed");
+  //Keys 0, 3 and 6 share set 0, key 1 is in set 1
+  memset(buf, 1, sizeof(buf));
+  cache_insert(0, 0, buf);
+  cache_insert(0, 3, buf);
+  cache_insert(0, 1, buf);
+  CHECK(cache_lookup(0, 0, buf) == 1, "a block of a set that is not full was evicted");
+  cache_insert(0, 6, buf);
+  CHECK(!cache_contains(0, 3), "the least recently used way was not evicted");
+  CHECK(cache_contains(0, 0) && cache_contains(0, 6), "the wrong way was evicted");
+  CHECK(cache_contains(0, 1), "a block of another set was evicted");
+  cache_destroy();
+
+  //One set of 16 ways, every tag of the row must match
+  CHECK(cache_create_assoc(16, 16, false) == 1, "creating a cache of 16 ways failed");
+  for (int i = 0; i < 16; i++) {
+    memset(buf, i, sizeof(buf));
+    cache_insert(i, i * 7, buf);
+  }
+  for (int i = 0; i < 16; i++)
+    CHECK(cached_as(i, i * 7, i), "way %d was not found", i);
+  CHECK(!cache_contains(0, 1), "a block that was never inserted was found");
+  cache_destroy();
+}
+
+static const test_t tests[] = {
+  { "writeback", test_writeback },
+  { "failed_writeback", test_failed_writeback },
+  { "unlocked_writeback", test_unlocked_writeback },
+  { "shared_recovery", test_shared_recovery },
+  { "snapshot", test_snapshot },
+  { "policies", test_policies },
+  { "assoc", test_assoc },
+};
+
+int main(int argc, char *argv[]) {
+  int failures = 0;
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    current = tests[i].name;
+    passed = true;
+    tests[i].run();
+    current_layout = NULL;
+    printf("%-20s %s\n", tests[i].name, passed ? "PASS" : "FAIL");
+    if (!passed)
+      failures++;
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+
+#define DISK_SIZE (JBOD_NUM_BLOCKS_PER_DISK * JBOD_BLOCK_SIZE)
+
+static int fds[JBOD_NUM_DISKS] = {[0 ... JBOD_NUM_DISKS - 1] = -1};
+static uint8_t *disks[JBOD_NUM_DISKS];
+//Pages written since the last sync, one bit per page of each disk.
+static uint64_t dirty[JBOD_NUM_DISKS];
+static bool any_dirty = false;
+static long page_size;
+static int sync_interval;
+static long long sync_due;   //monotonic milliseconds at which the written pages are synced
+static uint32_t syncs = 0;
+static uint32_t synced_pages = 0;
+
+static long long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+//Opens the image of |disk_num| in |dir| and maps it. Returns 1 on success and -1 on failure.
+static int open_disk(const char *dir, int disk_num) {
+  char path[4096];
+  struct stat st;
+
+  snprintf(path, sizeof(path), "%s/disk%02d.img", dir, disk_num);
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if(fd == -1) {
+    return -1;
+  }
+  //Two servers writing the same images would tear them
+  if(flock(fd, LOCK_EX | LOCK_NB) == -1 || fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+  if(st.st_size == 0) {
+    //A new disk, the file reads back as zeros without writing them
+    if(ftruncate(fd, DISK_SIZE) == -1 || fsync(fd) == -1) {
+      close(fd);
+      return -1;
+    }
+  } else if(st.st_size != DISK_SIZE) {
+    fprintf(stderr, "%s is not a disk image (%lld bytes)\n", path, (long long)st.st_size);
+    close(fd);
+    return -1;
+  }
+  uint8_t *map = mmap(NULL, DISK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(map == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  fds[disk_num] = fd;
+  disks[disk_num] = map;
+  return 1;
+}
+
+int image_open(const char *dir, int sync_ms) {
+  if(image_enabled() || dir == NULL || sync_ms < 0) {
+    return -1;
+  }
+  page_size = sysconf(_SC_PAGESIZE);
+  //The dirty masks have a bit for every page of a disk
+  if(page_size < DISK_SIZE / 64) {
+    return -1;
+  }
+  sync_interval = sync_ms;
+  for(int disk = 0; disk < JBOD_NUM_DISKS; disk++) {
+    if(open_disk(dir, disk) == -1) {
+      image_close();
+      return -1;
+    }
+  }
+  return 1;
+}
+
+void image_close(void) {
+  image_sync();
+  for(int disk = 0; disk < JBOD_NUM_DISKS; disk++) {
+    if(disks[disk] != NULL) {
+      munmap(disks[disk], DISK_SIZE);
+      disks[disk] = NULL;
+    }
+    if(fds[disk] != -1) {
+      close(fds[disk]);
+      fds[disk] = -1;
+    }
+  }
+}
+
+bool image_enabled(void) {
+  return disks[0] != NULL;
+}
+
+const uint8_t *image_block(int disk_num, int block_num) {
+  return disks[disk_num] + block_num * JBOD_BLOCK_SIZE;
+}
+
+int image_write(int disk_num, int block_num, const uint8_t *buf) {
+  uint32_t offset = block_num * JBOD_BLOCK_SIZE;
+  memcpy(disks[disk_num] + offset, buf, JBOD_BLOCK_SIZE);
+  dirty[disk_num] |= 1ULL << (offset / page_size);
+  if(!any_dirty) {
+    any_dirty = true;
+    sync_due = now_ms() + sync_interval;
+  }
+  if(sync_interval == 0) {
+    return image_sync() == -1 ? -1 : 1;
+  }
+  return 1;
+}
+
+int image_sync(void) {
+  int pages = 0;
+  if(!any_dirty) {
+    return 0;
+  }
+  for(int disk = 0; disk < JBOD_NUM_DISKS; disk++) {
+    //Sync each run of consecutive written pages with one call
+    int page = 0;
+    while(page < 64) {
+      if(!(dirty[disk] >> page & 1)) {
+        page += 1;
+        continue;
+      }
+      int first = page;
+      while(page < 64 && (dirty[disk] >> page & 1)) {
+        page += 1;
+      }
+      long offset = first * page_size;
+      long length = (page - first) * page_size;
+      if(offset + length > DISK_SIZE) {
+        length = DISK_SIZE - offset;
+      }
+      if(msync(disks[disk] + offset, length, MS_SYNC) == -1) {
+        return -1;
+      }
+      pages += page - first;
+    }
+    dirty[disk] = 0;
+  }
+  any_dirty = false;
+  syncs += 1;
+  synced_pages += pages;
+  return pages;
+}
+
+int image_sync_timeout(void) {
+  if(!any_dirty) {
+    return -1;
+  }
+  long long left = sync_due - now_ms();
+  return left > 0 ? (int)left : 0;
+}
+
+void image_get_stats(uint32_t *syncs_run, uint32_t *pages) {
+  *syncs_run = syncs;
+  *pages = synced_pages;
+}
@@ -0,0 +1,47 @@
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jbod.h"
+
+/* Disk images
+ *
+ * Keeps the disks of the JBOD in files, one per disk, named diskNN.img in a
+ * directory. Each image is mapped into memory; blocks are read straight from
+ * the mapping and written into it, and the written pages are synced to the
+ * files in batches. An image that already exists is used as it is, a missing
+ * one is created empty (all zeros). */
+
+/* Opens or creates the images of all disks in |dir|, which must exist. Written
+ * blocks are synced every |sync_ms| milliseconds, or before image_write
+ * returns if |sync_ms| is 0. Return 1 on success and -1 on failure, e.g. when
+ * an image has the wrong size or another process has it open. */
+int image_open(const char *dir, int sync_ms);
+
+/* Syncs the written blocks and closes the images. */
+void image_close(void);
+
+/* Returns true if the images are open. */
+bool image_enabled(void);
+
+/* Returns the mapped block |block_num| of disk |disk_num|, to read from. */
+const uint8_t *image_block(int disk_num, int block_num);
+
+/* Copies |buf| into block |block_num| of disk |disk_num|. Return 1 on success
+ * and -1 on failure (only possible when syncing right away). */
+int image_write(int disk_num, int block_num, const uint8_t *buf);
+
+/* Syncs the blocks written since the last sync to the image files. Return the
+ * number of pages synced on success and -1 on failure. */
+int image_sync(void);
+
+/* Returns the milliseconds until written blocks are due to be synced, 0 if
+ * they are due now and -1 if nothing waits to be synced. */
+int image_sync_timeout(void);
+
+/* Reports how many syncs ran and how many pages they wrote. */
+void image_get_stats(uint32_t *syncs, uint32_t *pages);
+
+#endif
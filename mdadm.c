@@ -1,22 +1,24 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
 
 #include "mdadm.h"
 #include "jbod.h"
 #include "net.h"
+#include "trace.h"
 
 typedef struct JBOD{
-  uint8_t currentBlockID;
-  int8_t currentDiskID;
+  uint16_t currentBlockID;  //Block under the server's head, JBOD_NUM_BLOCKS_PER_DISK after the last block of a disk.
+  int8_t currentDiskID;     //Disk under the server's head.
+  bool head_known;          //False when the head position is unknown (unmounted or after a failed operation).
   uint8_t targetBlockID;
   int8_t targetDiskID;
   uint32_t block_pointer;
 } JBOD;
 
-JBOD jbod;  //Intializing the struct.
-int mount_status = 1; //if mount_status = 1, it means disk is unmounted, if equal to 2, then disc is mounted.
-
 //Block Constructor to create command block to use for system calls.
 uint32_t block_constructor(uint8_t BlockID, uint16_t Reserved, uint8_t Disk_ID, uint8_t Command){
   uint32_t Reserved32;
@@ -29,203 +31,1251 @@ uint32_t block_constructor(uint8_t BlockID, uint16_t Reserved, uint8_t Disk_ID,
   return op;
 }
 
-int mdadm_mount(void) {
+//Most blocks a single read or write can touch: 1024 bytes starting mid-block.
+#define MAX_REQUEST_BLOCKS (1024 / JBOD_BLOCK_SIZE + 1)
+
+//Operations queued for the server. run_ops sends them in one batch packet when
+//batching is on, otherwise one request at a time.
+typedef struct {
+  uint32_t ops[JBOD_MAX_BATCH];
+  uint8_t *blocks[JBOD_MAX_BATCH];
+  int n;
+  int *error;  //if set, run_ops does not wait for the replies; a failure is reported here
+} op_queue_t;
+
+//One block touched by a read or write request.
+typedef struct {
+  uint8_t diskID;
+  uint8_t blockID;
+  uint32_t offset;   //first byte of the block covered by the request
+  uint32_t chunk;    //number of bytes of the block covered by the request
+  bool pending;      //contents are being fetched from the server
+  uint8_t *block;    //contents of the block: data, or the caller's buffer when the request covers the whole block
+  const uint8_t *src; //bytes to write into the block
+  uint8_t data[JBOD_BLOCK_SIZE];
+} block_span_t;
+
+//A formatted striped volume records its layout in the last block of the last disk.
+#define LABEL_DISK (JBOD_NUM_DISKS - 1)
+#define LABEL_BLOCK (JBOD_NUM_BLOCKS_PER_DISK - 1)
+#define LABEL_MAGIC "MDADMR0"
+#define LABEL_VERSION 1
+
+//Layout label, in network byte order.
+typedef struct {
+  char magic[8];          //LABEL_MAGIC
+  uint32_t version;
+  uint32_t stripe_unit;   //bytes per chunk
+  uint32_t check;         //~stripe_unit, so stray data starting with the magic is not taken for a label
+} layout_label_t;
+
+//Readahead window of a disk when a sequential stream is first seen, and the largest window.
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 64
+
+//Sequential stream detection for one disk, see mdadm_set_readahead.
+typedef struct {
+  int next_block;   //block right after the last one read from the disk, -1 if none
+  int window;       //blocks to keep prefetched past next_block, 0 while the reads look random
+  int prefetched;   //blocks below this one have already been prefetched
+} stream_t;
+
+//Blocks a vectored request handles per round trip.
+#define WINDOW_BLOCKS JBOD_MAX_BATCH
+
+//Position in the iovec array of a vectored request, whose bytes are consumed in order.
+typedef struct {
+  const struct iovec *iov;
+  int iovcnt;
+  int index;
+  size_t offset;
+} iov_cursor_t;
+
+//Most asynchronous requests in flight, submitting more completes the oldest first.
+#define MAX_ASYNC_REQUESTS 64
+
+//A read or write submitted with mdadm_read_async or mdadm_write_async.
+typedef struct {
+  bool write;
+  struct iovec iov;       //destination of a read
+  int count;
+  block_span_t spans[MAX_REQUEST_BLOCKS];
+  uint32_t ticket;        //order of the request among all reads and writes
+  uint32_t last_seq;      //done once the net layer has completed this many requests
+  int error;              //set by the net layer when one of the operations fails
+  mdadm_callback_t callback;
+  void *arg;
+  uint32_t addr;
+  uint64_t start_ns;      //submission time, 0 when not tracing
+  uint32_t hits;          //blocks found in the cache and not, for the trace
+  uint32_t misses;
+} async_request_t;
+
+//Everything mdadm knows about one connection to the JBOD server. The legacy functions
+//(mdadm_mount, mdadm_read, ...) use default_ctx, on the connection opened by jbod_connect.
+struct mdadm_ctx {
+  jbod_conn_t *conn;
+  JBOD jbod;
+  int mount_status; //if mount_status = 1, it means disk is unmounted, if equal to 2, then disc is mounted.
+  bool write_back;  //if true, writes are absorbed by the cache and reach the disks on eviction or flush.
+  bool batching;    //if true, the operations of a request are sent to the server in one batch packet.
+  uint32_t layout_unit;   //stripe unit selected for the next mount, 0 for the linear layout
+  bool layout_label;      //if true, mounts read the label and format a striped volume without one
+  uint32_t stripe_unit;   //stripe unit of the mounted volume, 0 for the linear layout
+  bool labelled;          //the mounted volume has a label, which takes its last block
+  uint32_t seeks_issued;  //Seek operations sent to the server.
+  uint32_t seeks_avoided; //Seek operations skipped because the head was already in place.
+  uint64_t disk_reads[JBOD_NUM_DISKS];  //blocks read from each disk
+  uint64_t disk_writes[JBOD_NUM_DISKS]; //blocks written to each disk
+  uint32_t request_hits;    //blocks of the request in progress found in the cache, for its trace record
+  uint32_t request_misses;  //and blocks that were not
+
+  stream_t streams[JBOD_NUM_DISKS];
+  int readahead_max;          //largest readahead window, 0 when readahead is off
+  uint32_t readahead_issued;  //blocks read ahead of time
+  block_span_t readahead_spans[READAHEAD_MAX];
+
+  async_request_t async_requests[MAX_ASYNC_REQUESTS];
+  int async_head;   //oldest request in flight
+  int async_count;
+
+  //Every read and write takes a ticket. block_written remembers the ticket of the last write
+  //to each block, so a read that completes after a later write does not cache stale data.
+  uint32_t next_ticket;
+  uint32_t block_written[JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK];
+};
+
+static mdadm_ctx_t default_ctx = {.mount_status = 1, .next_ticket = 1};
+
+//The cache is shared by every context and writes dirty blocks back through the context of
+//the thread that evicts or flushes them.
+static __thread mdadm_ctx_t *writeback_ctx = NULL;
+
+static int writeback_block(int disk_num, int block_num, const uint8_t *buf);
+static int validate_block(int disk_num, int block_num, const uint8_t *buf);
+static int load_layout(mdadm_ctx_t *ctx);
+
+//Returns the context of the legacy functions.
+static mdadm_ctx_t *legacy_ctx(void){
+  default_ctx.conn = jbod_default_conn();
+  return &default_ctx;
+}
+
+//Mounts the JBOD on the connection of |ctx|.
+static int ctx_mount(mdadm_ctx_t *ctx){
   //If Disc is Unmounted allow Mount. Otherwise System Call Fails. 
-  if(mount_status==1){
-    jbod_client_operation(JBOD_MOUNT, NULL);
-    mount_status = 2;
-    jbod.targetBlockID = 0;    
-    jbod.targetDiskID = 0;
-    jbod.block_pointer = 0;    
+  if(ctx->mount_status==1){
+    jbod_conn_operation(ctx->conn, block_constructor(0, 0, 0, JBOD_MOUNT), NULL);
+    //Dirty blocks evicted from the cache are written back through mdadm
+    cache_set_writeback(writeback_block);
+    //Blocks loaded from a cache snapshot are checked through mdadm too
+    cache_set_validator(validate_block);
+    ctx->mount_status = 2;
+    //Mounting parks the head at block 0 of disk 0.
+    ctx->jbod.currentDiskID = 0;
+    ctx->jbod.currentBlockID = 0;
+    ctx->jbod.head_known = true;
+    ctx->jbod.targetBlockID = 0;    
+    ctx->jbod.targetDiskID = 0;
+    ctx->jbod.block_pointer = 0;    
+    //No stream survives a remount
+    for(int disk = 0; disk < JBOD_NUM_DISKS; disk++){
+      ctx->streams[disk].next_block = -1;
+      ctx->streams[disk].window = 0;
+      ctx->streams[disk].prefetched = 0;
+    }
+    if(load_layout(ctx) == -1){
+      jbod_conn_operation(ctx->conn, block_constructor(0, 0, 0, JBOD_UNMOUNT), NULL);
+      ctx->mount_status = 1;
+      ctx->jbod.head_known = false;
+      return -1;
+    }
     return 1;
   }
   return -1;
 }
 
-int mdadm_unmount(void) {
+//Unmounts the JBOD on the connection of |ctx|.
+static int ctx_unmount(mdadm_ctx_t *ctx){
   //If Disc is Mounted, allow Unmount. Otherwise System Call Fails.
-  if(mount_status==2){
-    jbod_client_operation(JBOD_UNMOUNT, NULL);
-    mount_status = 1;
+  if(ctx->mount_status==2){
+    //Let the requests in flight finish and write out everything the cache absorbed before the disks go away
+    mdadm_ctx_wait(ctx, 0);
+    if(mdadm_ctx_flush(ctx) == -1){
+      return -1;
+    }
+    jbod_conn_operation(ctx->conn, block_constructor(0, 0, 0, JBOD_UNMOUNT), NULL);
+    ctx->mount_status = 1;
+    ctx->jbod.head_known = false;
     return 1;
   }
   return -1;
 }
 
-//System call to go to specific block and/or Disk
-int seek(uint8_t newBlockID,uint8_t newDiskID){
-  //Check if disk is mounted. 
-  if (mount_status == 1){
+int mdadm_mount(void) {
+  return ctx_mount(legacy_ctx());
+}
+
+int mdadm_unmount(void) {
+  return ctx_unmount(legacy_ctx());
+}
+
+mdadm_ctx_t *mdadm_open(const char *ip, uint16_t port, const mdadm_opts_t *opts) {
+  mdadm_ctx_t *ctx = calloc(1, sizeof(mdadm_ctx_t));
+  if(ctx == NULL){
+    return NULL;
+  }
+  ctx->conn = jbod_conn_open(ip, port);
+  if(ctx->conn == NULL){
+    free(ctx);
+    return NULL;
+  }
+  ctx->mount_status = 1;
+  ctx->next_ticket = 1;
+  if(opts != NULL){
+    ctx->write_back = opts->write_back;
+    ctx->batching = opts->batching;
+    mdadm_ctx_set_readahead(ctx, opts->readahead);
+    ctx->layout_label = opts->layout_label;
+    if(mdadm_ctx_set_stripe_unit(ctx, opts->stripe_unit) == -1){
+      jbod_conn_close(ctx->conn);
+      free(ctx);
+      return NULL;
+    }
+  }
+  if(ctx_mount(ctx) == -1){
+    jbod_conn_close(ctx->conn);
+    free(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+int mdadm_close(mdadm_ctx_t *ctx) {
+  writeback_ctx = ctx;
+  int rc = ctx_unmount(ctx);
+  writeback_ctx = NULL;
+  jbod_conn_close(ctx->conn);
+  free(ctx);
+  return rc;
+}
+
+void mdadm_set_write_back(bool enabled) {
+  legacy_ctx()->write_back = enabled;
+}
+
+void mdadm_set_batching(bool enabled) {
+  legacy_ctx()->batching = enabled;
+}
+
+void mdadm_ctx_set_readahead(mdadm_ctx_t *ctx, int max_blocks) {
+  ctx->readahead_max = max_blocks < 0 ? 0 : (max_blocks > READAHEAD_MAX ? READAHEAD_MAX : max_blocks);
+}
+
+void mdadm_set_readahead(int max_blocks) {
+  mdadm_ctx_set_readahead(legacy_ctx(), max_blocks);
+}
+
+//Returns true if |unit| is 0 or a power of two stripe unit from one block to one disk.
+static bool valid_stripe_unit(uint32_t unit){
+  return unit == 0 || (unit >= JBOD_BLOCK_SIZE && unit <= JBOD_DISK_SIZE && (unit & (unit - 1)) == 0);
+}
+
+int mdadm_ctx_set_stripe_unit(mdadm_ctx_t *ctx, uint32_t stripe_unit) {
+  if(!valid_stripe_unit(stripe_unit)){
     return -1;
   }
+  ctx->layout_unit = stripe_unit;
+  return 1;
+}
 
-  if(jbod.currentBlockID != newBlockID){
-    //construct seek to block opcode
-    uint32_t new_Block_op = block_constructor(newBlockID, 0, 0, JBOD_SEEK_TO_BLOCK);
-    //If seek to block gives an error code, it will return -1, else it will just execute the system call
-    if(jbod_client_operation(new_Block_op, NULL) != 0){
-      return -1;
+int mdadm_set_stripe_unit(uint32_t stripe_unit) {
+  return mdadm_ctx_set_stripe_unit(legacy_ctx(), stripe_unit);
+}
+
+void mdadm_ctx_set_layout_label(mdadm_ctx_t *ctx, bool enabled) {
+  ctx->layout_label = enabled;
+}
+
+void mdadm_set_layout_label(bool enabled) {
+  mdadm_ctx_set_layout_label(legacy_ctx(), enabled);
+}
+
+uint32_t mdadm_ctx_get_stripe_unit(mdadm_ctx_t *ctx) {
+  return ctx->stripe_unit;
+}
+
+uint32_t mdadm_get_stripe_unit(void) {
+  return mdadm_ctx_get_stripe_unit(legacy_ctx());
+}
+
+void mdadm_ctx_get_readahead_stats(mdadm_ctx_t *ctx, uint32_t *prefetched, uint32_t *used, uint32_t *wasted) {
+  int num_used = 0, num_wasted = 0;
+  //Used and wasted blocks are counted by the cache, which every context shares
+  cache_get_prefetch_stats(&num_used, &num_wasted);
+  *prefetched = ctx->readahead_issued;
+  *used = num_used;
+  *wasted = num_wasted;
+}
+
+void mdadm_get_readahead_stats(uint32_t *prefetched, uint32_t *used, uint32_t *wasted) {
+  mdadm_ctx_get_readahead_stats(legacy_ctx(), prefetched, used, wasted);
+}
+
+void mdadm_ctx_get_seek_stats(mdadm_ctx_t *ctx, uint32_t *issued, uint32_t *avoided) {
+  *issued = ctx->seeks_issued;
+  *avoided = ctx->seeks_avoided;
+}
+
+void mdadm_get_seek_stats(uint32_t *issued, uint32_t *avoided) {
+  mdadm_ctx_get_seek_stats(legacy_ctx(), issued, avoided);
+}
+
+void mdadm_ctx_get_stats(mdadm_ctx_t *ctx, mdadm_stats_t *stats) {
+  stats->seeks_issued = ctx->seeks_issued;
+  stats->seeks_avoided = ctx->seeks_avoided;
+  stats->readahead_issued = ctx->readahead_issued;
+  memcpy(stats->disk_reads, ctx->disk_reads, sizeof(stats->disk_reads));
+  memcpy(stats->disk_writes, ctx->disk_writes, sizeof(stats->disk_writes));
+  jbod_conn_get_stats(ctx->conn, &stats->net);
+  cache_get_stats(&stats->cache);
+}
+
+void mdadm_get_stats(mdadm_stats_t *stats) {
+  mdadm_ctx_get_stats(legacy_ctx(), stats);
+}
+
+//Writes the |n| counters of |values| to |f| as a JSON array.
+static void write_json_array(FILE *f, const uint64_t *values, int n){
+  fputc('[', f);
+  for(int i = 0; i < n; i++){
+    fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long)values[i]);
+  }
+  fputc(']', f);
+}
+
+int mdadm_write_stats_json(const mdadm_stats_t *stats, FILE *f) {
+  static const char *cmd_names[JBOD_NUM_CMDS] = {
+    "mount", "unmount", "seek_to_disk", "seek_to_block", "read_block", "write_block", "sign_block",
+  };
+  const jbod_net_stats_t *net = &stats->net;
+  const cache_counters_t *cache = &stats->cache;
+  uint64_t answered = 0;
+
+  fprintf(f, "{\"seeks\": {\"issued\": %u, \"avoided\": %u}, \"readahead_blocks\": %u",
+          stats->seeks_issued, stats->seeks_avoided, stats->readahead_issued);
+  fprintf(f, ", \"disks\": {\"reads\": ");
+  write_json_array(f, stats->disk_reads, JBOD_NUM_DISKS);
+  fprintf(f, ", \"writes\": ");
+  write_json_array(f, stats->disk_writes, JBOD_NUM_DISKS);
+  fprintf(f, "}, \"net\": {\"requests\": %llu, \"ops\": %llu, \"syscalls\": %llu, \"bytes_sent\": %llu, \"bytes_received\": %llu, \"ops_by_cmd\": {",
+          (unsigned long long)net->requests, (unsigned long long)net->ops, (unsigned long long)net->syscalls,
+          (unsigned long long)net->bytes_sent, (unsigned long long)net->bytes_received);
+  for(int cmd = 0; cmd < JBOD_NUM_CMDS; cmd++){
+    fprintf(f, "%s\"%s\": %llu", cmd ? ", " : "", cmd_names[cmd], (unsigned long long)net->op_counts[cmd]);
+  }
+  for(int i = 0; i < JBOD_RTT_BUCKETS; i++){
+    answered += net->rtt_hist[i];
+  }
+  fprintf(f, "}, \"rtt_mean_us\": %.3f, \"rtt_hist_log2_us\": ", answered ? net->rtt_ns / 1e3 / answered : 0.0);
+  write_json_array(f, net->rtt_hist, JBOD_RTT_BUCKETS);
+  fprintf(f, "}, \"cache\": {\"lookups\": %llu, \"hits\": %llu, \"misses\": %llu, \"evictions\": %llu, "
+          "\"insert_collisions\": %llu, \"prefetch_used\": %llu, \"prefetch_wasted\": %llu}}\n",
+          (unsigned long long)cache->lookups, (unsigned long long)cache->hits,
+          (unsigned long long)cache->misses, (unsigned long long)cache->evictions,
+          (unsigned long long)cache->insert_collisions, (unsigned long long)cache->prefetch_used,
+          (unsigned long long)cache->prefetch_wasted);
+  return ferror(f) ? -1 : 1;
+}
+
+int mdadm_ctx_flush(mdadm_ctx_t *ctx) {
+  if(ctx->mount_status == 1){
+    return -1;
+  }
+  //Nothing can be dirty without a cache
+  if(!cache_enabled()){
+    return 0;
+  }
+  writeback_ctx = ctx;
+  return cache_flush();
+}
+
+int mdadm_flush(void) {
+  return mdadm_ctx_flush(legacy_ctx());
+}
+
+//Sends the queued operations to the server and empties the queue. Unless the queue
+//reports errors asynchronously, waits for their replies (and those of every request
+//already in flight, which the server answers first).
+static int run_ops(mdadm_ctx_t *ctx, op_queue_t *queue){
+  int error = 0;
+  int *ret = queue->error ? queue->error : &error;
+  int rc = 0;
+  if(queue->n == 0){
+    return 1;
+  }
+  if(ctx->batching){
+    rc = jbod_conn_submit_batch(ctx->conn, queue->ops, queue->blocks, queue->n, ret);
+  }else{
+    for(int i = 0; i < queue->n && rc == 0; i++){
+      rc = jbod_conn_submit(ctx->conn, queue->ops[i], queue->blocks[i], ret);
     }
   }
+  queue->n = 0;
+  if(rc == 0 && queue->error == NULL){
+    rc = jbod_conn_wait(ctx->conn, jbod_conn_submitted(ctx->conn));
+  }
+  if(rc != 0 || error != 0){
+    //The head stopped somewhere in the middle of the queue.
+    ctx->jbod.head_known = false;
+    return -1;
+  }
+  return 1;
+}
+
+//Appends an operation to the queue, sending the queue first if it is full.
+static int queue_op(mdadm_ctx_t *ctx, op_queue_t *queue, uint32_t op, uint8_t *block){
+  if(queue->n == JBOD_MAX_BATCH && run_ops(ctx, queue) == -1){
+    return -1;
+  }
+  queue->ops[queue->n] = op;
+  queue->blocks[queue->n] = block;
+  queue->n += 1;
+  return 1;
+}
 
-  if(jbod.currentDiskID != newDiskID){
+//Queues the seeks needed to go to specific block and/or Disk. The head position is
+//updated as the operations are queued, run_ops forgets it if the queue fails.
+static int seek(mdadm_ctx_t *ctx, op_queue_t *queue, uint8_t newBlockID, uint8_t newDiskID){
+  //Check if disk is mounted. 
+  if (ctx->mount_status == 1){
+    return -1;
+  }
+
+  //Seek to the disk first, the server moves the head back to block 0 of the new disk.
+  if(!ctx->jbod.head_known || ctx->jbod.currentDiskID != newDiskID){
     //construct seek to disk opcode
     uint32_t new_Disk_op = block_constructor(0, 0, newDiskID, JBOD_SEEK_TO_DISK);
-    //If seek to disk gives an error code, it will return -1, else it will just execute the system call
-    if (jbod_client_operation(new_Disk_op, NULL) != 0){
+    ctx->seeks_issued += 1;
+    if (queue_op(ctx, queue, new_Disk_op, NULL) == -1){
+      return -1;
+    }
+    ctx->jbod.currentDiskID = newDiskID;
+    ctx->jbod.currentBlockID = 0;
+    ctx->jbod.head_known = true;
+  }else{
+    ctx->seeks_avoided += 1;
+  }
+
+  //Only seek to the block if the head is not already there (e.g. after the previous block was read or written).
+  if(ctx->jbod.currentBlockID != newBlockID){
+    //construct seek to block opcode
+    uint32_t new_Block_op = block_constructor(newBlockID, 0, 0, JBOD_SEEK_TO_BLOCK);
+    ctx->seeks_issued += 1;
+    if(queue_op(ctx, queue, new_Block_op, NULL) == -1){
       return -1;
-    }  
+    }
+    ctx->jbod.currentBlockID = newBlockID;
+  }else{
+    ctx->seeks_avoided += 1;
   }
   return 1; 
 }
 
-int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
-  // If Disc is Unmounted, Dont Read, System Call Fails.
-  if(mount_status==1){
+//Queues a read or write of block |blockID| of disk |diskID|. The server moves the head
+//to the next block of the same disk afterwards, it does not wrap to the next disk.
+static int queue_block_op(mdadm_ctx_t *ctx, op_queue_t *queue, uint8_t diskID, uint8_t blockID, uint8_t command, uint8_t *buf){
+  if(seek(ctx, queue, blockID, diskID) == -1){
     return -1;
-  }  
-  //If Test Any of the parameters do not meet the assignment/test requirements or is out of bounds, System Call Fails.
-  if((len > 1024)|| (len < 0)||((len != 0) && (buf==NULL))||(addr + len > (JBOD_DISK_SIZE * JBOD_NUM_DISKS))){
+  }
+  if(queue_op(ctx, queue, block_constructor(blockID, 0, diskID, command), buf) == -1){
     return -1;
   }
-  // Instantiate local buffer of 256 Bytes that will act as source array for mem copy
-  uint8_t localBuff[JBOD_BLOCK_SIZE];
-  //Identify which disc the address is located in.
-  jbod.targetDiskID = (addr / JBOD_DISK_SIZE);
-  //Identify which block in the disc the address is located.
-  jbod.targetBlockID = ((addr % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE);
-  //Count variable that keeps track of number of bytes left to read.
-  uint32_t length = len;
-  //Identify where in the block to start reading from, (specific location of address in block)
-  jbod.block_pointer = addr % JBOD_BLOCK_SIZE;
+  if(command == JBOD_WRITE_BLOCK){
+    ctx->disk_writes[diskID] += 1;
+  }else{
+    ctx->disk_reads[diskID] += 1;
+  }
+  ctx->jbod.currentBlockID += 1;
+  return 1;
+}
+
+//Write-back function for the cache, called for dirty blocks on eviction and flush.
+static int writeback_block(int disk_num, int block_num, const uint8_t *buf){
+  mdadm_ctx_t *ctx = writeback_ctx;
+  op_queue_t queue = {.n = 0, .error = NULL};
+  if(ctx == NULL){
+    return -1;
+  }
+  if(queue_block_op(ctx, &queue, disk_num, block_num, JBOD_WRITE_BLOCK, (uint8_t *)buf) == -1){
+    return -1;
+  }
+  return run_ops(ctx, &queue);
+}
+
+//Validation function for the cache, called for blocks loaded from a snapshot on their first
+//use. Compares the block with the signature the server computes for its copy. Signing names
+//the block in the opcode, it needs no seek and leaves the head where it is.
+static int validate_block(int disk_num, int block_num, const uint8_t *buf){
+  mdadm_ctx_t *ctx = writeback_ctx;
+  op_queue_t queue = {.n = 0, .error = NULL};
+  uint8_t sig[JBOD_BLOCK_SIZE];
+  char expected[SHA1_SIG_LEN];
+  if(ctx == NULL || ctx->mount_status == 1){
+    return -1;
+  }
+  if(queue_op(ctx, &queue, block_constructor(block_num, 0, disk_num, JBOD_SIGN_BLOCK), sig) == -1){
+    return -1;
+  }
+  if(run_ops(ctx, &queue) == -1){
+    return -1;
+  }
+  //The reply reads "SIG(disk,block) <disk> <block> : <digest>", the digest as sha1_sig prints it
+  sig[JBOD_BLOCK_SIZE - 1] = '\0';
+  const char *digest = strstr((const char *)sig, ": ");
+  if(digest == NULL){
+    return -1;
+  }
+  //Into a buffer of our own, sha1_sig's static one is shared by every thread
+  sha1_sig_r(buf, JBOD_BLOCK_SIZE, expected);
+  return strncmp(digest + 2, expected, strlen(expected)) == 0 ? 1 : 0;
+}
+
+//Maps the block holding byte |addr| of the volume to its disk and block. The linear layout
+//fills the disks one after the other; the striped layout deals chunks of stripe_unit bytes
+//to the disks round robin, so chunk c is row c / 16 of disk c % 16.
+static void map_block(const mdadm_ctx_t *ctx, uint32_t addr, uint8_t *disk, uint8_t *block){
+  if(ctx->stripe_unit == 0){
+    *disk = addr / JBOD_DISK_SIZE;
+    *block = (addr % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE;
+    return;
+  }
+  uint32_t chunk = addr / ctx->stripe_unit;
+  *disk = chunk % JBOD_NUM_DISKS;
+  *block = ((chunk / JBOD_NUM_DISKS) * ctx->stripe_unit + addr % ctx->stripe_unit) / JBOD_BLOCK_SIZE;
+}
+
+//Usable bytes of the mounted volume. A labelled volume gives its last block to the label,
+//which the striped layout maps to the last block of the last disk.
+static uint32_t volume_size(const mdadm_ctx_t *ctx){
+  return JBOD_DISK_SIZE * JBOD_NUM_DISKS - (ctx->labelled ? JBOD_BLOCK_SIZE : 0);
+}
+
+//Sets up the layout of the volume just mounted. A linear mount reads nothing unless labels
+//are on. Otherwise the label block is read: a labelled volume mounts with its recorded
+//stripe unit, and fails to mount if another one is selected. With labels on, a striped
+//volume without a label is formatted, provided its last block is still empty.
+static int load_layout(mdadm_ctx_t *ctx){
+  op_queue_t queue = {.n = 0, .error = NULL};
+  uint8_t block[JBOD_BLOCK_SIZE];
+  static const uint8_t empty[JBOD_BLOCK_SIZE];
+  layout_label_t label;
+  ctx->stripe_unit = ctx->layout_unit;
+  ctx->labelled = false;
+  if(ctx->layout_unit == 0 && !ctx->layout_label){
+    return 1;
+  }
+  if(queue_block_op(ctx, &queue, LABEL_DISK, LABEL_BLOCK, JBOD_READ_BLOCK, block) == -1 || run_ops(ctx, &queue) == -1){
+    return -1;
+  }
+  memcpy(&label, block, sizeof(label));
+  uint32_t unit = ntohl(label.stripe_unit);
+  if(memcmp(label.magic, LABEL_MAGIC, sizeof(label.magic)) == 0 && ntohl(label.version) == LABEL_VERSION &&
+     ntohl(label.check) == ~unit && unit != 0 && valid_stripe_unit(unit)){
+    if(ctx->layout_unit != 0 && ctx->layout_unit != unit){
+      return -1;
+    }
+    ctx->stripe_unit = unit;
+    ctx->labelled = true;
+    return 1;
+  }
+  if(!ctx->layout_label || ctx->layout_unit == 0){
+    return 1;
+  }
+  //Formatting never overwrites data
+  if(memcmp(block, empty, JBOD_BLOCK_SIZE) != 0){
+    return -1;
+  }
+  memcpy(label.magic, LABEL_MAGIC, sizeof(label.magic));
+  label.version = htonl(LABEL_VERSION);
+  label.stripe_unit = htonl(ctx->stripe_unit);
+  label.check = htonl(~ctx->stripe_unit);
+  memcpy(block, &label, sizeof(label));
+  if(queue_block_op(ctx, &queue, LABEL_DISK, LABEL_BLOCK, JBOD_WRITE_BLOCK, block) == -1 || run_ops(ctx, &queue) == -1){
+    return -1;
+  }
+  //The block may be cached as the empty block it was
+  cache_update(LABEL_DISK, LABEL_BLOCK, block);
+  ctx->labelled = true;
+  return 1;
+}
 
-  // While bits left to be read is greater than 0
+//Splits the byte range [addr, addr + len) into the blocks it touches, returns the number of blocks.
+static int split_request(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, block_span_t *spans){
+  //Identify where in the block the request starts, (specific location of address in block)
+  ctx->jbod.block_pointer = addr % JBOD_BLOCK_SIZE;
+  //Count variable that keeps track of number of bytes left.
+  uint32_t length = len;
+  int count = 0;
   while (length > 0){
-    //seeks to block and disc of given address. 
-    seek(jbod.targetBlockID, jbod.targetDiskID);
-    //Construct Opcode
-    uint32_t read_op = block_constructor(jbod.targetBlockID, 0, jbod.targetDiskID, JBOD_READ_BLOCK);
-    
-    //If Cache enabled
-    if(cache_enabled() == true) {
-      //Lookup cache entry for current disk and block, if found copies into local buffer
-      if(cache_lookup(jbod.targetDiskID, jbod.targetBlockID, localBuff) == -1) {
-        //If not found execute system call and isert into cache
-        jbod_client_operation(read_op, localBuff);
-        cache_insert(jbod.targetDiskID, jbod.targetBlockID, localBuff);
+    block_span_t *span = &spans[count];
+    //Identify which disc and block the address is located in.
+    map_block(ctx, addr, &span->diskID, &span->blockID);
+    span->offset = ctx->jbod.block_pointer;
+    //Number of bytes of the request that land in the current block.
+    span->chunk = JBOD_BLOCK_SIZE - ctx->jbod.block_pointer;
+    if(span->chunk > length){
+      span->chunk = length;
+    }
+    span->pending = false;
+    span->block = span->data;
+    span->src = NULL;
+    length -= span->chunk;
+    addr += span->chunk;
+    count += 1;
+    //When moving on to next block set block pointer to zero to start from the beginning of the block.
+    ctx->jbod.block_pointer = 0;
+  }
+  return count;
+}
+
+//Checks the parameters of a read or write of |len| bytes, at most |max_len|.
+static bool valid_request(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint32_t max_len, const void *buf){
+  // If Disc is Unmounted, System Call Fails.
+  if(ctx->mount_status==1){
+    return false;
+  }
+  //If Test Any of the parameters do not meet the assignment/test requirements or is out of bounds, System Call Fails.
+  if((len > max_len)||((len != 0) && (buf==NULL))||(len > volume_size(ctx))||(addr > volume_size(ctx) - len)){
+    return false;
+  }
+  return true;
+}
+
+//Checks the iovec array of a vectored request and returns its total length, -1 if it is invalid.
+static int64_t iov_length(const struct iovec *iov, int iovcnt){
+  int64_t total = 0;
+  if(iovcnt < 0 || (iovcnt > 0 && iov == NULL)){
+    return -1;
+  }
+  for(int i = 0; i < iovcnt; i++){
+    if(iov[i].iov_len != 0 && iov[i].iov_base == NULL){
+      return -1;
+    }
+    total += iov[i].iov_len;
+    //Anything past the size of the JBOD fails anyway
+    if(total > JBOD_DISK_SIZE * JBOD_NUM_DISKS){
+      return -1;
+    }
+  }
+  return total;
+}
+
+//Skips the exhausted iovecs under the cursor.
+static void iov_skip_empty(iov_cursor_t *cur){
+  while(cur->index < cur->iovcnt && cur->offset == cur->iov[cur->index].iov_len){
+    cur->index += 1;
+    cur->offset = 0;
+  }
+}
+
+//Returns the next |n| bytes under the cursor if they sit in one iovec, NULL otherwise.
+static uint8_t *iov_direct(iov_cursor_t *cur, uint32_t n){
+  iov_skip_empty(cur);
+  if(cur->index == cur->iovcnt || cur->iov[cur->index].iov_len - cur->offset < n){
+    return NULL;
+  }
+  return (uint8_t *)cur->iov[cur->index].iov_base + cur->offset;
+}
+
+//Moves the cursor |n| bytes forward. With |out| set, copies the bytes from |out| into the
+//iovecs, with |in| set, copies them from the iovecs into |in|.
+static void iov_move(iov_cursor_t *cur, uint32_t n, const uint8_t *out, uint8_t *in){
+  while(n > 0){
+    iov_skip_empty(cur);
+    uint8_t *base = (uint8_t *)cur->iov[cur->index].iov_base + cur->offset;
+    size_t step = cur->iov[cur->index].iov_len - cur->offset;
+    if(step > n){
+      step = n;
+    }
+    if(out != NULL){
+      memcpy(base, out, step);
+      out += step;
+    }
+    if(in != NULL){
+      memcpy(in, base, step);
+      in += step;
+    }
+    cur->offset += step;
+    n -= step;
+  }
+}
+
+//Index of a block in block_written.
+static int block_key(const block_span_t *span){
+  return span->diskID * JBOD_NUM_BLOCKS_PER_DISK + span->blockID;
+}
+
+//Returns how many of the |count| spans from |spans| on are consecutive blocks of one disk.
+static int span_run(const block_span_t *spans, int count){
+  int run = 1;
+  while(run < count && spans[run].diskID == spans[0].diskID && spans[run].blockID == spans[0].blockID + run){
+    run += 1;
+  }
+  return run;
+}
+
+//Serves each block of a read from the cache if possible, otherwise queues a read for it. The
+//cache is asked for whole runs of blocks, the extent cache answers a run with one probe.
+static int start_read(mdadm_ctx_t *ctx, block_span_t *spans, int count, op_queue_t *queue){
+  int i = 0;
+  while(i < count){
+    if(cache_enabled()){
+      int run = span_run(spans + i, count - i);
+      uint8_t *blocks[run];
+      for(int j = 0; j < run; j++){
+        blocks[j] = spans[i + j].block;
       }
-    }else { //If cache not enabled
-      //Execute System Call
-      jbod_client_operation(read_op, localBuff);
-    }
-
-    //If addr + bytes to be read extends the bound of the current block:
-    if(jbod.block_pointer + length > JBOD_BLOCK_SIZE-1){
-      //Copy local Buffer (essentially current block) starting from the position of the block pointer(current address)
-      memcpy(buf+(len-length),localBuff+jbod.block_pointer,JBOD_BLOCK_SIZE-jbod.block_pointer);
-      //Update bytes left to be read
-      length -= (JBOD_BLOCK_SIZE-jbod.block_pointer);
-      //Check if the current block is the final block of the disc, if so increment disk number and set block id to zero.
-      if(jbod.targetBlockID < JBOD_NUM_BLOCKS_PER_DISK - 1){
-        jbod.targetBlockID ++;
-      }else{
-        jbod.targetDiskID ++;
-        jbod.targetBlockID = 0;
+      int found = cache_lookup_range(spans[i].diskID, spans[i].blockID, run, blocks);
+      i += found;
+      ctx->request_hits += found;
+      if(found == run){
+        continue;
       }
-    //When moving on to next block set block pointer to zero to read from the beginning of the block.         
-    jbod.block_pointer = 0;
-    //If addr + bytes left to be read is within the the bounds of the current block.
+      ctx->request_misses += 1;
+    }
+    //seek() skips seeks the head does not need, so consecutive misses are read back to back
+    if(queue_block_op(ctx, queue, spans[i].diskID, spans[i].blockID, JBOD_READ_BLOCK, spans[i].block) == -1){
+      return -1;
+    }
+    spans[i].pending = true;
+    i += 1;
+  }
+  return 1;
+}
+
+//Returns true if the block of |span| came from the server and no later write has replaced it.
+static bool cacheable(mdadm_ctx_t *ctx, const block_span_t *span, uint32_t ticket){
+  return span->pending && ctx->block_written[block_key(span)] < ticket;
+}
+
+//Copies the requested bytes of each block to the cursor once the reads are done, caching the
+//blocks that came from the server unless a later write has replaced them, a run of them at a
+//time. Blocks read straight into the caller's buffer are already in place.
+static void finish_read(mdadm_ctx_t *ctx, block_span_t *spans, int count, iov_cursor_t *cur, uint32_t ticket){
+  for(int i = 0; i < count && cache_enabled();){
+    if(!cacheable(ctx, &spans[i], ticket)){
+      i += 1;
+      continue;
+    }
+    int run = span_run(spans + i, count - i);
+    uint8_t *blocks[run];
+    int n = 0;
+    while(n < run && cacheable(ctx, &spans[i + n], ticket)){
+      blocks[n] = spans[i + n].block;
+      n += 1;
+    }
+    cache_insert_range(spans[i].diskID, spans[i].blockID, n, blocks);
+    i += n;
+  }
+  for(int i = 0; i < count; i++){
+    if(spans[i].block == spans[i].data){
+      iov_move(cur, spans[i].chunk, spans[i].data + spans[i].offset, NULL);
     }else{
-      memcpy(buf+(len-length),localBuff+jbod.block_pointer,length);
-      length -= length;
+      iov_move(cur, spans[i].chunk, NULL, NULL);
     }
   }
-//Once read is complete and copied to *buf, increment block by 1 for next I/O operation. If on final block of disc, move on to the beginning of the next disc.
-  if(jbod.targetBlockID < JBOD_NUM_BLOCKS_PER_DISK - 1){
-    jbod.targetBlockID ++;
+}
+
+//Feeds the read of [addr, addr + len) to the stream detector of its disk and picks the blocks
+//to prefetch into readahead_spans. A read that starts where the previous one on the disk ended
+//grows the window, any other read drops it. Returns the number of blocks to prefetch. Streams
+//follow the address space: "disk" here is each 64 KiB of it, the disk itself only in the
+//linear layout, and the blocks picked are mapped to where the layout puts them.
+static int plan_readahead(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len){
+  if(ctx->readahead_max == 0 || !cache_enabled() || len == 0){
+    return 0;
+  }
+  int first_disk = addr / JBOD_DISK_SIZE;
+  int first_block = (addr % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE;
+  int disk = (addr + len - 1) / JBOD_DISK_SIZE;
+  int last_block = ((addr + len - 1) % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE;
+  stream_t stream = ctx->streams[first_disk];
+
+  //Reads rarely end on a block boundary, so starting in the last block read also continues the stream
+  bool sequential = stream.next_block != -1 &&
+                    (first_block == stream.next_block || first_block == stream.next_block - 1);
+  if(!sequential){
+    stream.window = 0;
+    stream.prefetched = 0;
+  }else if(stream.window == 0){
+    stream.window = READAHEAD_MIN < ctx->readahead_max ? READAHEAD_MIN : ctx->readahead_max;
   }else{
-    jbod.targetDiskID ++;
-    jbod.targetBlockID = 0;
+    stream.window = 2 * stream.window < ctx->readahead_max ? 2 * stream.window : ctx->readahead_max;
+  }
+  stream.next_block = last_block + 1;
+  if(stream.prefetched < stream.next_block){
+    stream.prefetched = stream.next_block;
+  }
+  //The stream follows the read onto the next disk
+  if(disk != first_disk){
+    ctx->streams[first_disk].next_block = -1;
+    ctx->streams[first_disk].window = 0;
+  }
+  if(stream.next_block == JBOD_NUM_BLOCKS_PER_DISK && disk < JBOD_NUM_DISKS - 1){
+    ctx->streams[disk].next_block = -1;
+    disk += 1;
+    stream.next_block = 0;
+    stream.prefetched = 0;
+  }
+  ctx->streams[disk] = stream;
+
+  //Top the window up once less than half of it is left, so prefetches go out in runs
+  stream_t *s = &ctx->streams[disk];
+  if(s->window == 0 || s->prefetched - s->next_block > s->window / 2){
+    return 0;
+  }
+  int stop = s->next_block + s->window;
+  if(stop > JBOD_NUM_BLOCKS_PER_DISK){
+    stop = JBOD_NUM_BLOCKS_PER_DISK;
+  }
+  int count = 0;
+  for(int block = s->prefetched; block < stop; block++){
+    uint32_t next = disk * JBOD_DISK_SIZE + block * JBOD_BLOCK_SIZE;
+    uint8_t disk_id, block_id;
+    map_block(ctx, next, &disk_id, &block_id);
+    if(next >= volume_size(ctx) || cache_contains(disk_id, block_id)){
+      continue;
+    }
+    ctx->readahead_spans[count].diskID = disk_id;
+    ctx->readahead_spans[count].blockID = block_id;
+    ctx->readahead_spans[count].block = ctx->readahead_spans[count].data;
+    count += 1;
+  }
+  s->prefetched = stop;
+  return count;
+}
+
+//Reads the range [addr, addr + len), at most WINDOW_BLOCKS blocks, into the cursor. Whole blocks
+//that land in one iovec are read in place, the rest go through the span's data. The first
+//|prefetch| blocks of readahead_spans are read in the same round trip and cached.
+static int read_window(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, iov_cursor_t *cur, uint32_t ticket, int prefetch){
+  block_span_t spans[WINDOW_BLOCKS];
+  op_queue_t queue = {.n = 0, .error = NULL};
+  int count = split_request(ctx, addr, len, spans);
+  iov_cursor_t start = *cur;
+
+  for(int i = 0; i < count; i++){
+    uint8_t *direct = iov_direct(cur, spans[i].chunk);
+    if(spans[i].chunk == JBOD_BLOCK_SIZE && direct != NULL){
+      spans[i].block = direct;
+    }
+    iov_move(cur, spans[i].chunk, NULL, NULL);
+  }
+  if(start_read(ctx, spans, count, &queue) == -1){
+    return -1;
+  }
+  //The head is right behind the blocks just read, where the readahead starts
+  for(int i = 0; i < prefetch; i++){
+    block_span_t *span = &ctx->readahead_spans[i];
+    if(queue_block_op(ctx, &queue, span->diskID, span->blockID, JBOD_READ_BLOCK, span->data) == -1){
+      return -1;
+    }
+  }
+  //All the reads of the window go out together
+  if(run_ops(ctx, &queue) == -1){
+    return -1;
+  }
+  finish_read(ctx, spans, count, &start, ticket);
+  for(int i = 0; i < prefetch; i++){
+    cache_insert_prefetch(ctx->readahead_spans[i].diskID, ctx->readahead_spans[i].blockID, ctx->readahead_spans[i].data);
+  }
+  ctx->readahead_issued += prefetch;
+  return 1;
+}
+
+//Splits a request into windows of at most WINDOW_BLOCKS blocks and returns the length of the first.
+static uint32_t window_length(uint32_t addr, uint32_t len){
+  uint32_t window = WINDOW_BLOCKS * JBOD_BLOCK_SIZE - addr % JBOD_BLOCK_SIZE;
+  return len < window ? len : window;
+}
+
+//Records a finished read or write in the trace: |start| is when it started, 0 when tracing
+//was off then, and the cache outcome comes from the request counters of |ctx|.
+static void trace_request(mdadm_ctx_t *ctx, uint8_t kind, uint32_t addr, uint32_t len, uint64_t start, int result){
+  if(start == 0 || !trace_enabled()){
+    return;
+  }
+  uint8_t outcome = TRACE_NO_CACHE;
+  if(ctx->request_misses == 0 && ctx->request_hits > 0){
+    outcome = TRACE_HIT;
+  }else if(ctx->request_misses > 0){
+    outcome = ctx->request_hits == 0 ? TRACE_MISS : TRACE_PARTIAL;
+  }
+  uint8_t disk = 0, block = 0;
+  if(ctx->mount_status == 2){
+    map_block(ctx, addr, &disk, &block);
+  }
+  uint8_t command = kind == TRACE_READ ? JBOD_READ_BLOCK : JBOD_WRITE_BLOCK;
+  trace_event(kind, block_constructor(block, 0, disk, command), addr, len, start, outcome, result);
+}
+
+static int read_vector(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt){
+  int64_t len = iov_length(iov, iovcnt);
+  if(len == -1 || !valid_request(ctx, addr, len, JBOD_DISK_SIZE * JBOD_NUM_DISKS, iov)){
+    return -1;
+  }
+  iov_cursor_t cur = {.iov = iov, .iovcnt = iovcnt, .index = 0, .offset = 0};
+  uint32_t ticket = ctx->next_ticket++;
+  uint32_t done = 0;
+  int prefetch = plan_readahead(ctx, addr, len);
+  while(done < len){
+    uint32_t window = window_length(addr + done, len - done);
+    //The readahead goes out with the last window
+    if(read_window(ctx, addr + done, window, &cur, ticket, done + window == len ? prefetch : 0) == -1){
+      return -1;
+    }
+    done += window;
   }
-  jbod.block_pointer = 0; 
   return len;
 }
 
-int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
- // If Disc is Unmounted, Dont Write, System Call Fails.
-  if(mount_status==1){
+int mdadm_ctx_readv(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt) {
+  writeback_ctx = ctx;
+  uint64_t start = trace_enabled() ? trace_now() : 0;
+  ctx->request_hits = 0;
+  ctx->request_misses = 0;
+  int result = read_vector(ctx, addr, iov, iovcnt);
+  trace_request(ctx, TRACE_READ, addr, iov_length(iov, iovcnt), start, result);
+  return result;
+}
+
+int mdadm_readv(uint32_t addr, const struct iovec *iov, int iovcnt) {
+  return mdadm_ctx_readv(legacy_ctx(), addr, iov, iovcnt);
+}
+
+int mdadm_ctx_read(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf) {
+  if(!valid_request(ctx, addr, len, 1024, buf)){
     return -1;
-  }  
-  //If Test Any of the parameters do not meet the assignment/test requirements or is out of bounds, System Call Fails.
-  if((len > 1024)|| (len < 0)||((len != 0) && (buf==NULL))||(addr + len > (JBOD_DISK_SIZE * JBOD_NUM_DISKS))){
+  }
+  struct iovec iov = {.iov_base = buf, .iov_len = len};
+  return mdadm_ctx_readv(ctx, addr, &iov, 1);
+}
+
+int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
+  return mdadm_ctx_read(legacy_ctx(), addr, len, buf);
+}
+
+//Prepares the blocks of a write and queues the operations writing them out. The current
+//contents of partially written blocks are fetched from the server right away.
+//Write-back absorbs the write into the cache and queues nothing. |cached| tells which
+//blocks the cache already holds.
+static int start_write(mdadm_ctx_t *ctx, block_span_t *spans, int count, uint32_t ticket, bool *cached, op_queue_t *queue){
+  bool absorb = ctx->write_back && cache_enabled();
+  op_queue_t fetch = {.n = 0, .error = NULL};
+
+  //Gather the current contents of partially written blocks. A write that covers the
+  //whole block replaces it, its old contents are never needed.
+  for(int i = 0; i < count; i++){
+    cached[i] = false;
+    ctx->block_written[block_key(&spans[i])] = ticket;
+    if(absorb){
+      //Write-back: patch the cached copy and leave the disk alone until the block is evicted or flushed.
+      if(cache_write(spans[i].diskID, spans[i].blockID, spans[i].offset, spans[i].chunk, spans[i].src) == 1){
+        cached[i] = true;
+        ctx->request_hits += 1;
+        continue;
+      }
+    }else if(spans[i].chunk != JBOD_BLOCK_SIZE && cache_enabled()){
+      //Partial write to a cached block: merge with the cached copy, which matches the disk.
+      cached[i] = (cache_lookup(spans[i].diskID, spans[i].blockID, spans[i].data) == 1);
+    }
+    if(cached[i]){
+      ctx->request_hits += 1;
+    }else if(absorb || (spans[i].chunk != JBOD_BLOCK_SIZE && cache_enabled())){
+      ctx->request_misses += 1;
+    }
+    if(spans[i].chunk != JBOD_BLOCK_SIZE && !cached[i]){
+      //Partial write to an uncached block: read it first.
+      if(queue_block_op(ctx, &fetch, spans[i].diskID, spans[i].blockID, JBOD_READ_BLOCK, spans[i].data) == -1){
+        return -1;
+      }
+      spans[i].pending = true;
+    }
+  }
+  if(run_ops(ctx, &fetch) == -1){
     return -1;
   }
-  // Instantiate local buffer of 256 Bytes that will act as source array for mem copy
-  uint8_t localBuff[JBOD_BLOCK_SIZE];
-  //Identify which disc the address is located in.
-  jbod.targetDiskID = (addr / JBOD_DISK_SIZE);
-  //Identify which block in the disc the address is located.
-  jbod.targetBlockID = ((addr % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE);
-  //Count variable that keeps track of number of bytes left to read.
-  uint32_t length = len;
-  //Identify where in the block to start writing from, (specific location of address in block)
-  jbod.block_pointer = addr % JBOD_BLOCK_SIZE;
-  // While bits left to be written is greater than 0
-  //mdadm_read(addr, len,)
-  while (length > 0){
-    //seeks to block and disc of given address. 
-    seek(jbod.targetBlockID, jbod.targetDiskID);
-    //Construct Read Opcode
-    uint32_t read_op = block_constructor(jbod.targetBlockID, 0, jbod.targetDiskID, JBOD_READ_BLOCK);
-    
-    //Execute System Call which reads current block into localBuff
-      jbod_client_operation(read_op, localBuff);
-      //Seek again because read operation increments block internally.
-      seek(jbod.targetBlockID, jbod.targetDiskID);
-
-    //If addr + bytes to be written extends the bound of the current block:
-    if(jbod.block_pointer + length > JBOD_BLOCK_SIZE-1){
-      //Since LocalBuff is equivalent to current Block, add an offset of the block_pointer (current position in block) and from there I copied buf with an offset of number of bits read. 
-      //I did that for a number of bits equivalent to the difference from current block position to the end of the current block.
-      memcpy(localBuff+jbod.block_pointer, buf+(len-length), JBOD_BLOCK_SIZE-jbod.block_pointer);
-      //Update bytes left to be read
-      length -= (JBOD_BLOCK_SIZE-jbod.block_pointer);
-      if(cache_enabled()){
-        cache_insert(jbod.targetDiskID, jbod.targetBlockID, localBuff);
+
+  //Patch in the new bytes. Write-back caches the blocks as dirty, write-through queues them.
+  for(int i = 0; i < count; i++){
+    if(absorb && cached[i]){
+      continue;
+    }
+    //Blocks written straight from the caller's buffer need no patching
+    if(spans[i].block == spans[i].data && spans[i].src != spans[i].data){
+      memcpy(spans[i].data + spans[i].offset, spans[i].src, spans[i].chunk);
+    }
+    if(absorb){
+      //Another handle may have cached the block since it missed, then the write goes to its copy.
+      int rc;
+      while((rc = cache_insert_dirty(spans[i].diskID, spans[i].blockID, spans[i].block)) == -1 &&
+            cache_contains(spans[i].diskID, spans[i].blockID)){
+        if(cache_write(spans[i].diskID, spans[i].blockID, spans[i].offset, spans[i].chunk, spans[i].src) == 1){
+          rc = 1;
+          break;
+        }
       }
-      
-      //Check if the current block is the final block of the disc, if so increment disk number and set block id to zero.
-      if(jbod.targetBlockID < JBOD_NUM_BLOCKS_PER_DISK - 1){
-        jbod.targetBlockID ++;
-      //otherwise just increment the block ID.
-      }else{
-        jbod.targetDiskID ++;
-        jbod.targetBlockID = 0;
+      if(rc == -1){
+        return -1;
       }
-    //When moving on to next block set block pointer to zero to read from the beginning of the block.         
-    jbod.block_pointer = 0;
-    //If addr + bytes left to be read is within the the bounds of the current block.
-    }else{
-      memcpy(localBuff+jbod.block_pointer, buf+(len-length), length);
-      length -= length;
-    }
-    //construct opcode for write in current block jbod operation.
-    uint32_t write_op = block_constructor(jbod.targetBlockID, 0, jbod.targetDiskID, JBOD_WRITE_BLOCK);
-    //execute jbod operation where current block in Disk is rewritten from localBuff
-    jbod_client_operation(write_op,localBuff);
-    
-    //If Cache enabled, Update Cache with data in current block 
-    if (cache_enabled()){
-      cache_update(jbod.targetDiskID, jbod.targetBlockID, localBuff);
-    }
-  }
-  //Once write is complete and copied to current block, increment block by 1 for next I/O operation. If on final block of disc, move on to the beginning of the next disc.
-  if(jbod.targetBlockID < JBOD_NUM_BLOCKS_PER_DISK - 1){
-    jbod.targetBlockID ++;
-  }else{
-    jbod.targetDiskID ++;
-    jbod.targetBlockID = 0;
+    }else if(queue_block_op(ctx, queue, spans[i].diskID, spans[i].blockID, JBOD_WRITE_BLOCK, spans[i].block) == -1){
+      return -1;
+    }
+  }
+  return 1;
+}
+
+//Keeps the cached copy of the blocks of a write-through write in sync with the disk.
+static void finish_write(mdadm_ctx_t *ctx, block_span_t *spans, int count, const bool *cached){
+  if(ctx->write_back || !cache_enabled()){
+    return;
+  }
+  for(int i = 0; i < count; i++){
+    if(cached[i]){
+      cache_update(spans[i].diskID, spans[i].blockID, spans[i].block);
+    }else if(cache_insert(spans[i].diskID, spans[i].blockID, spans[i].block) == -1){
+      cache_update(spans[i].diskID, spans[i].blockID, spans[i].block);
+    }
+  }
+}
+
+//Writes the range [addr, addr + len), at most WINDOW_BLOCKS blocks, from the cursor. Whole blocks
+//that sit in one iovec are sent from there, the rest are gathered into the span's data.
+static int write_window(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, iov_cursor_t *cur, uint32_t ticket){
+  block_span_t spans[WINDOW_BLOCKS];
+  op_queue_t queue = {.n = 0, .error = NULL};
+  int count = split_request(ctx, addr, len, spans);
+  bool cached[WINDOW_BLOCKS];
+  //Only the first and last block of a request can be partial, this holds their new bytes
+  //when they are split across iovecs.
+  uint8_t edge[2][JBOD_BLOCK_SIZE];
+
+  for(int i = 0; i < count; i++){
+    uint8_t *direct = iov_direct(cur, spans[i].chunk);
+    if(direct == NULL){
+      uint8_t *gather = spans[i].chunk == JBOD_BLOCK_SIZE ? spans[i].data : edge[i == 0 ? 0 : 1];
+      iov_move(cur, spans[i].chunk, NULL, gather);
+      spans[i].src = gather;
+      continue;
+    }
+    spans[i].src = direct;
+    if(spans[i].chunk == JBOD_BLOCK_SIZE){
+      spans[i].block = direct;
+    }
+    iov_move(cur, spans[i].chunk, NULL, NULL);
+  }
+  if(start_write(ctx, spans, count, ticket, cached, &queue) == -1){
+    return -1;
+  }
+  if(run_ops(ctx, &queue) == -1){
+    return -1;
+  }
+  finish_write(ctx, spans, count, cached);
+  return 1;
+}
+
+static int write_vector(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt){
+  int64_t len = iov_length(iov, iovcnt);
+  if(len == -1 || !valid_request(ctx, addr, len, JBOD_DISK_SIZE * JBOD_NUM_DISKS, iov)){
+    return -1;
+  }
+  iov_cursor_t cur = {.iov = iov, .iovcnt = iovcnt, .index = 0, .offset = 0};
+  uint32_t ticket = ctx->next_ticket++;
+  uint32_t done = 0;
+  while(done < len){
+    uint32_t window = window_length(addr + done, len - done);
+    if(write_window(ctx, addr + done, window, &cur, ticket) == -1){
+      return -1;
+    }
+    done += window;
   }
-  jbod.block_pointer = 0; 
   return len;
 }
+
+int mdadm_ctx_writev(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt) {
+  writeback_ctx = ctx;
+  uint64_t start = trace_enabled() ? trace_now() : 0;
+  ctx->request_hits = 0;
+  ctx->request_misses = 0;
+  int result = write_vector(ctx, addr, iov, iovcnt);
+  trace_request(ctx, TRACE_WRITE, addr, iov_length(iov, iovcnt), start, result);
+  return result;
+}
+
+int mdadm_writev(uint32_t addr, const struct iovec *iov, int iovcnt) {
+  return mdadm_ctx_writev(legacy_ctx(), addr, iov, iovcnt);
+}
+
+int mdadm_ctx_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf) {
+  if(!valid_request(ctx, addr, len, 1024, buf)){
+    return -1;
+  }
+  struct iovec iov = {.iov_base = (void *)buf, .iov_len = len};
+  return mdadm_ctx_writev(ctx, addr, &iov, 1);
+}
+
+int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
+  return mdadm_ctx_write(legacy_ctx(), addr, len, buf);
+}
+
+//Returns true once the net layer has read the replies to every operation of |req|.
+static bool async_done(mdadm_ctx_t *ctx, const async_request_t *req){
+  return (int32_t)(jbod_conn_completed(ctx->conn) - req->last_seq) >= 0;
+}
+
+//Completes the oldest requests in flight whose replies have all arrived, in submission order.
+static int finish_async(mdadm_ctx_t *ctx){
+  int done = 0;
+  while(ctx->async_count > 0 && async_done(ctx, &ctx->async_requests[ctx->async_head])){
+    async_request_t *req = &ctx->async_requests[ctx->async_head];
+    int result = req->iov.iov_len;
+    ctx->async_head = (ctx->async_head + 1) % MAX_ASYNC_REQUESTS;
+    ctx->async_count -= 1;
+    if(req->error != 0){
+      //The head stopped somewhere in the middle of the request.
+      ctx->jbod.head_known = false;
+      result = -1;
+    }else if(!req->write){
+      iov_cursor_t cur = {.iov = &req->iov, .iovcnt = 1, .index = 0, .offset = 0};
+      finish_read(ctx, req->spans, req->count, &cur, req->ticket);
+    }
+    if(req->start_ns != 0){
+      //The counters may belong to a request being submitted
+      uint32_t hits = ctx->request_hits, misses = ctx->request_misses;
+      ctx->request_hits = req->hits;
+      ctx->request_misses = req->misses;
+      trace_request(ctx, req->write ? TRACE_WRITE : TRACE_READ, req->addr, req->iov.iov_len, req->start_ns, result);
+      ctx->request_hits = hits;
+      ctx->request_misses = misses;
+    }
+    if(req->callback != NULL){
+      req->callback(result, req->arg);
+      //The callback may have used another context
+      writeback_ctx = ctx;
+    }
+    done += 1;
+  }
+  return done;
+}
+
+//Takes a free slot for a new asynchronous request, completing the oldest one if all are taken.
+static async_request_t *alloc_async(mdadm_ctx_t *ctx, mdadm_callback_t callback, void *arg){
+  if(ctx->async_count == MAX_ASYNC_REQUESTS){
+    mdadm_ctx_wait(ctx, MAX_ASYNC_REQUESTS - 1);
+  }
+  async_request_t *req = &ctx->async_requests[(ctx->async_head + ctx->async_count) % MAX_ASYNC_REQUESTS];
+  req->error = 0;
+  req->callback = callback;
+  req->arg = arg;
+  req->start_ns = trace_enabled() ? trace_now() : 0;
+  ctx->request_hits = 0;
+  ctx->request_misses = 0;
+  return req;
+}
+
+//Sends the queued operations of |req| without waiting and puts it in flight.
+static int submit_async(mdadm_ctx_t *ctx, async_request_t *req, op_queue_t *queue){
+  queue->error = &req->error;
+  if(run_ops(ctx, queue) == -1){
+    return -1;
+  }
+  req->last_seq = jbod_conn_submitted(ctx->conn);
+  req->hits = ctx->request_hits;
+  req->misses = ctx->request_misses;
+  ctx->async_count += 1;
+  return 1;
+}
+
+int mdadm_ctx_read_async(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf, mdadm_callback_t callback, void *arg) {
+  writeback_ctx = ctx;
+  if(!valid_request(ctx, addr, len, 1024, buf)){
+    return -1;
+  }
+  async_request_t *req = alloc_async(ctx, callback, arg);
+  op_queue_t queue = {.n = 0, .error = &req->error};
+  req->write = false;
+  req->addr = addr;
+  req->iov.iov_base = buf;
+  req->iov.iov_len = len;
+  req->count = split_request(ctx, addr, len, req->spans);
+  req->ticket = ctx->next_ticket++;
+
+  if(start_read(ctx, req->spans, req->count, &queue) == -1){
+    return -1;
+  }
+  return submit_async(ctx, req, &queue);
+}
+
+int mdadm_read_async(uint32_t addr, uint32_t len, uint8_t *buf, mdadm_callback_t callback, void *arg) {
+  return mdadm_ctx_read_async(legacy_ctx(), addr, len, buf, callback, arg);
+}
+
+int mdadm_ctx_write_async(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf, mdadm_callback_t callback, void *arg) {
+  writeback_ctx = ctx;
+  if(!valid_request(ctx, addr, len, 1024, buf)){
+    return -1;
+  }
+  async_request_t *req = alloc_async(ctx, callback, arg);
+  op_queue_t queue = {.n = 0, .error = &req->error};
+  bool cached[MAX_REQUEST_BLOCKS];
+  req->write = true;
+  req->addr = addr;
+  req->iov.iov_base = NULL;
+  req->iov.iov_len = len;
+  req->count = split_request(ctx, addr, len, req->spans);
+  req->ticket = ctx->next_ticket++;
+
+  //The new bytes are copied into the spans, buf can be reused as soon as this returns
+  uint32_t copied = 0;
+  for(int i = 0; i < req->count; i++){
+    req->spans[i].src = buf + copied;
+    copied += req->spans[i].chunk;
+  }
+  if(start_write(ctx, req->spans, req->count, req->ticket, cached, &queue) == -1){
+    return -1;
+  }
+  //Later reads are served from the cache or queued behind this write, so the cache can
+  //take the new contents before the server has written them.
+  finish_write(ctx, req->spans, req->count, cached);
+  return submit_async(ctx, req, &queue);
+}
+
+int mdadm_write_async(uint32_t addr, uint32_t len, const uint8_t *buf, mdadm_callback_t callback, void *arg) {
+  return mdadm_ctx_write_async(legacy_ctx(), addr, len, buf, callback, arg);
+}
+
+int mdadm_ctx_poll(mdadm_ctx_t *ctx) {
+  writeback_ctx = ctx;
+  //Read whatever replies have arrived without blocking
+  while(jbod_conn_complete(ctx->conn, false) != 0);
+  return finish_async(ctx);
+}
+
+int mdadm_poll(void) {
+  return mdadm_ctx_poll(legacy_ctx());
+}
+
+int mdadm_ctx_wait(mdadm_ctx_t *ctx, int max_pending) {
+  writeback_ctx = ctx;
+  int done = finish_async(ctx);
+  while(ctx->async_count > max_pending){
+    jbod_conn_complete(ctx->conn, true);
+    done += finish_async(ctx);
+  }
+  return done;
+}
+
+int mdadm_wait(int max_pending) {
+  return mdadm_ctx_wait(legacy_ctx(), max_pending);
+}
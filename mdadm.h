@@ -1,9 +1,13 @@
 #ifndef MDADM_H_
 #define MDADM_H_
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
 #include "jbod.h"
 #include "cache.h"
+#include "net.h"
 
 /* Return 1 on success and -1 on failure */
 int mdadm_mount(void);
@@ -17,4 +21,154 @@ int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf);
 /* Return the number of bytes written on success, -1 on failure. */
 int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf);
 
+/* Vectored versions of mdadm_read and mdadm_write: the bytes starting at addr
+ * are scattered into (gathered from) the iovcnt buffers of iov in order. The
+ * request can be any length up to the size of the JBOD and span several
+ * disks. Whole blocks that fit in one iovec are transferred in place.
+ * Return the number of bytes read or written on success, -1 on failure. */
+int mdadm_readv(uint32_t addr, const struct iovec *iov, int iovcnt);
+int mdadm_writev(uint32_t addr, const struct iovec *iov, int iovcnt);
+
+/* Called when an asynchronous read or write completes, with the number of
+ * bytes transferred or -1 on failure. */
+typedef void (*mdadm_callback_t)(int result, void *arg);
+
+/* Asynchronous versions of mdadm_read and mdadm_write. The operations are
+ * pipelined on the server connection and the call returns without waiting
+ * for their replies; |callback| (may be NULL) runs from mdadm_poll or
+ * mdadm_wait once the request is done. Requests complete in the order they
+ * were submitted. A read fills |buf| just before its callback, so |buf| must
+ * stay valid until then. A write copies |buf| before returning; a partial
+ * write to a block that is not cached waits for the block to be read first.
+ * Return 1 on success and -1 on failure. */
+int mdadm_read_async(uint32_t addr, uint32_t len, uint8_t *buf, mdadm_callback_t callback, void *arg);
+int mdadm_write_async(uint32_t addr, uint32_t len, const uint8_t *buf, mdadm_callback_t callback, void *arg);
+
+/* Completes the asynchronous requests whose replies have arrived, without
+ * blocking. Return the number of requests completed. */
+int mdadm_poll(void);
+
+/* Blocks until at most |max_pending| asynchronous requests are in flight;
+ * mdadm_wait(0) completes them all. Return the number of requests completed. */
+int mdadm_wait(int max_pending);
+
+/* Selects write-back mode. When enabled and the cache is on, writes only
+ * update the cache; dirty blocks are written to the disks when they are
+ * evicted, on mdadm_flush and on mdadm_unmount. Off (write-through) by default. */
+void mdadm_set_write_back(bool enabled);
+
+/* Selects batching. When enabled, the server operations needed by one read or
+ * write (seeks and block transfers) are sent in a single batch packet instead
+ * of one round trip each. Requires a server built from server.c. */
+void mdadm_set_batching(bool enabled);
+
+/* Sets the readahead window limit in blocks (at most 64, 0 turns readahead
+ * off, the default). With the cache enabled, mdadm_read and mdadm_readv
+ * detect sequential streams on each disk and prefetch the blocks following
+ * the stream into the cache, in the same round trip as the read. The window
+ * starts at 4 blocks and doubles while the stream goes on, up to the limit.
+ * A read that breaks the stream drops the window to 0. */
+void mdadm_set_readahead(int max_blocks);
+
+/* Selects the address layout of the volumes mounted from now on. With
+ * |stripe_unit| 0, the default, addresses are linear: disk addr / 65536 holds
+ * them. Otherwise the volume is striped (RAID-0): the addresses are cut into
+ * chunks of |stripe_unit| bytes, a power of two from 256 to 65536, dealt round
+ * robin to the 16 disks. A striped mount reads the last block of the last
+ * disk, in case the volume was formatted with a label (see below): a labelled
+ * volume is one block smaller and does not mount with another stripe unit.
+ * Return 1 on success and -1 if |stripe_unit| is invalid. */
+int mdadm_set_stripe_unit(uint32_t stripe_unit);
+
+/* Selects labels for the volumes mounted from now on. With labels on, every
+ * mount reads the label, and a labelled volume mounts with the recorded stripe
+ * unit even if none is selected. Mounting a striped volume without a label
+ * formats it: the stripe unit is written into a label in the last block of
+ * the last disk. The mount fails instead if that block holds data. Off by
+ * default. */
+void mdadm_set_layout_label(bool enabled);
+
+/* Returns the stripe unit of the mounted volume, 0 for the linear layout. */
+uint32_t mdadm_get_stripe_unit(void);
+
+/* Reports how many blocks were prefetched, and how many of them were used
+ * or evicted unused (counted by the cache since it was created). */
+void mdadm_get_readahead_stats(uint32_t *prefetched, uint32_t *used, uint32_t *wasted);
+
+/* Reports how many seek operations were sent to the server and how many were
+ * skipped because the tracked head position already matched. */
+void mdadm_get_seek_stats(uint32_t *issued, uint32_t *avoided);
+
+/* Runtime statistics of a connection. The counters are plain increments on
+ * paths that already do a round trip or take the cache lock, cheap enough
+ * to leave on. */
+typedef struct mdadm_stats {
+  uint32_t seeks_issued;                /* see mdadm_get_seek_stats */
+  uint32_t seeks_avoided;
+  uint32_t readahead_issued;            /* blocks read ahead of time */
+  uint64_t disk_reads[JBOD_NUM_DISKS];  /* blocks read from each disk */
+  uint64_t disk_writes[JBOD_NUM_DISKS]; /* blocks written to each disk */
+  jbod_net_stats_t net;                 /* operations by command, bytes, round trip times */
+  cache_counters_t cache;               /* the shared cache, counted for every connection */
+} mdadm_stats_t;
+
+/* Fills |stats| with the statistics gathered since the connection was opened
+ * (the cache counters since the cache was created). */
+void mdadm_get_stats(mdadm_stats_t *stats);
+
+/* Writes |stats| to |f| as one line of JSON. Return 1 on success and -1 on
+ * failure. */
+int mdadm_write_stats_json(const mdadm_stats_t *stats, FILE *f);
+
+/* Writes all dirty cached blocks to the disks, sorted by disk and block.
+ * Return the number of blocks written on success, -1 on failure. */
+int mdadm_flush(void);
+
+/* Handles
+ *
+ * The functions above work on the connection opened by jbod_connect. A handle
+ * carries its own connection, head position, readahead streams, asynchronous
+ * requests and statistics, so several threads can each drive the JBOD through
+ * their own handle. A handle must only be used by one thread at a time. The
+ * cache is shared by all handles and by the functions above; it is locked
+ * internally, and dirty blocks are written back through the handle of the
+ * thread that evicts or flushes them, so every handle must talk to the same
+ * JBOD. */
+typedef struct mdadm_ctx mdadm_ctx_t;
+
+typedef struct {
+  bool write_back;  /* see mdadm_set_write_back */
+  bool batching;    /* see mdadm_set_batching */
+  int readahead;    /* see mdadm_set_readahead */
+  uint32_t stripe_unit; /* see mdadm_set_stripe_unit */
+  bool layout_label;    /* see mdadm_set_layout_label */
+} mdadm_opts_t;
+
+/* Connects to the server at ip:port and mounts the JBOD. |opts| may be NULL
+ * for the defaults. Return the new handle, or NULL on failure. */
+mdadm_ctx_t *mdadm_open(const char *ip, uint16_t port, const mdadm_opts_t *opts);
+
+/* Completes the asynchronous requests, flushes the cache, unmounts the JBOD,
+ * closes the connection and frees the handle. Return 1 on success and -1 if
+ * flushing or unmounting failed; the handle is freed either way. */
+int mdadm_close(mdadm_ctx_t *ctx);
+
+/* Same as the functions above, on the connection of |ctx|. */
+int mdadm_ctx_read(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf);
+int mdadm_ctx_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf);
+int mdadm_ctx_readv(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt);
+int mdadm_ctx_writev(mdadm_ctx_t *ctx, uint32_t addr, const struct iovec *iov, int iovcnt);
+int mdadm_ctx_read_async(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf, mdadm_callback_t callback, void *arg);
+int mdadm_ctx_write_async(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf, mdadm_callback_t callback, void *arg);
+int mdadm_ctx_poll(mdadm_ctx_t *ctx);
+int mdadm_ctx_wait(mdadm_ctx_t *ctx, int max_pending);
+int mdadm_ctx_flush(mdadm_ctx_t *ctx);
+void mdadm_ctx_set_readahead(mdadm_ctx_t *ctx, int max_blocks);
+void mdadm_ctx_get_readahead_stats(mdadm_ctx_t *ctx, uint32_t *prefetched, uint32_t *used, uint32_t *wasted);
+void mdadm_ctx_get_seek_stats(mdadm_ctx_t *ctx, uint32_t *issued, uint32_t *avoided);
+void mdadm_ctx_get_stats(mdadm_ctx_t *ctx, mdadm_stats_t *stats);
+int mdadm_ctx_set_stripe_unit(mdadm_ctx_t *ctx, uint32_t stripe_unit);
+uint32_t mdadm_ctx_get_stripe_unit(mdadm_ctx_t *ctx);
+void mdadm_ctx_set_layout_label(mdadm_ctx_t *ctx, bool enabled);
+
 #endif
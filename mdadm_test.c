@@ -0,0 +1,568 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "cache.h"
+#include "jbod.h"
+#include "mdadm.h"
+#include "net.h"
+
+#define VOLUME_SIZE (JBOD_NUM_DISKS * JBOD_DISK_SIZE)
+#define TEST_CLIENTS 4
+#define TEST_BLOCKS 256
+#define TEST_ROUNDS 8
+#define TEST_CACHE_SIZE 64
+#define SLOT_SIZE (JBOD_BLOCK_SIZE / TEST_CLIENTS)
+
+//A test of the table below. The JBOD is reset when it is mounted again after the last
+//handle closed, so every test starts on empty disks and keeps one handle open while it
+//needs the data.
+typedef struct {
+  const char *name;
+  bool (*run)(void);
+} test_t;
+
+//Every client owns one slot of each block and rewrites it every round, with
+//write-back on and a cache smaller than the blocks, so the blocks are fetched,
+//cached dirty and written back over and over while the others do the same.
+typedef struct {
+  int id;
+  pthread_t thread;
+  bool failed;
+} client_t;
+
+//The bytes client |id| writes to its slot of |block| in |round|.
+static void fill_slot(uint8_t *buf, int id, int block, int round) {
+  for (int i = 0; i < SLOT_SIZE; i++)
+    buf[i] = (uint8_t)(block + i + id * 61 + round * 17);
+}
+
+static void *client(void *arg) {
+  client_t *c = arg;
+  mdadm_opts_t opts = { .write_back = true };
+  uint8_t buf[SLOT_SIZE];
+
+  mdadm_ctx_t *ctx = mdadm_open(JBOD_SERVER, JBOD_PORT, &opts);
+  if (ctx == NULL) {
+    c->failed = true;
+    return NULL;
+  }
+  for (int round = 0; round < TEST_ROUNDS && !c->failed; round++) {
+    //The clients sweep the blocks in step, so they miss on the same block together
+    for (int block = 0; block < TEST_BLOCKS; block++) {
+      fill_slot(buf, c->id, block, round);
+      if (mdadm_ctx_write(ctx, block * JBOD_BLOCK_SIZE + c->id * SLOT_SIZE, SLOT_SIZE, buf) != SLOT_SIZE) {
+        warnx("client %d failed to write block %d in round %d", c->id, block, round);
+        c->failed = true;
+        break;
+      }
+    }
+  }
+  if (mdadm_close(ctx) == -1)
+    c->failed = true;
+  return NULL;
+}
+
+//Reads the blocks straight from the disks through |ctx| and checks the last round of every client.
+static int check_disks(mdadm_ctx_t *ctx) {
+  uint8_t block[JBOD_BLOCK_SIZE], want[SLOT_SIZE];
+  int errors = 0;
+
+  for (int b = 0; b < TEST_BLOCKS; b++) {
+    if (mdadm_ctx_read(ctx, b * JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE, block) != JBOD_BLOCK_SIZE)
+      errx(1, "failed to read block %d", b);
+    for (int id = 0; id < TEST_CLIENTS; id++) {
+      fill_slot(want, id, b, TEST_ROUNDS - 1);
+      if (memcmp(block + id * SLOT_SIZE, want, SLOT_SIZE) != 0) {
+        warnx("block %d: the last write of client %d was lost", b, id);
+        errors++;
+      }
+    }
+  }
+  return errors;
+}
+
+//Concurrent write-back clients on the same blocks lose no write.
+static bool test_writeback_clients(void) {
+  client_t clients[TEST_CLIENTS];
+  bool failed = false;
+
+  //The JBOD is reset when it is mounted again, this handle keeps it mounted for the check
+  mdadm_ctx_t *ctx = mdadm_open(JBOD_SERVER, JBOD_PORT, NULL);
+  if (ctx == NULL)
+    errx(1, "failed to connect and mount");
+  if (cache_create(TEST_CACHE_SIZE) != 1)
+    errx(1, "failed to create the cache");
+  for (int i = 0; i < TEST_CLIENTS; i++) {
+    clients[i].id = i;
+    clients[i].failed = false;
+    if (pthread_create(&clients[i].thread, NULL, client, &clients[i]) != 0)
+      errx(1, "failed to start client %d", i);
+  }
+  for (int i = 0; i < TEST_CLIENTS; i++) {
+    pthread_join(clients[i].thread, NULL);
+    failed |= clients[i].failed;
+  }
+  cache_destroy();
+
+  int errors = check_disks(ctx);
+  mdadm_close(ctx);
+  return !failed && errors == 0;
+}
+
+//Opens a handle with stripe unit |unit|, formatting or checking the label if |label|.
+static mdadm_ctx_t *open_layout(uint32_t unit, bool label) {
+  mdadm_opts_t opts = { .stripe_unit = unit, .layout_label = label };
+  return mdadm_open(JBOD_SERVER, JBOD_PORT, &opts);
+}
+
+//Writes |len| bytes of |fill| at |addr| through |ctx|.
+static bool write_fill(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t fill) {
+  uint8_t buf[1024];
+  memset(buf, fill, len);
+  return mdadm_ctx_write(ctx, addr, len, buf) == (int)len;
+}
+
+//Checks that disk |disk|, blocks [first, first + count) hold |fill|, read through linear handle |linear|.
+static bool blocks_hold(mdadm_ctx_t *linear, int disk, int first, int count, uint8_t fill) {
+  uint8_t buf[1024];
+  uint32_t addr = disk * JBOD_DISK_SIZE + first * JBOD_BLOCK_SIZE;
+  if (mdadm_ctx_read(linear, addr, count * JBOD_BLOCK_SIZE, buf) != count * JBOD_BLOCK_SIZE)
+    return false;
+  for (int i = 0; i < count * JBOD_BLOCK_SIZE; i++)
+    if (buf[i] != fill)
+      return false;
+  return true;
+}
+
+//Chunk c of the striped volume is row c / 16 of disk c % 16, checked block by block
+//through a linear handle on the same disks. Without a label the volume keeps its last block.
+static bool test_striping_map(void) {
+  bool ok = true;
+  mdadm_ctx_t *linear = open_layout(0, false);
+  mdadm_ctx_t *striped = open_layout(1024, false);
+  if (linear == NULL || striped == NULL)
+    errx(1, "failed to connect and mount");
+  if (mdadm_ctx_get_stripe_unit(striped) != 1024 || mdadm_ctx_get_stripe_unit(linear) != 0) {
+    warnx("the handles did not mount with the selected layouts");
+    ok = false;
+  }
+  //The second half of chunk 0 and the first half of chunk 1, then chunk 17, row 1 of disk 1
+  if (!write_fill(striped, 512, 1024, 0x11) || !write_fill(striped, 17 * 1024 + 256, 256, 0x22)) {
+    warnx("writing to the striped volume failed");
+    ok = false;
+  }
+  if (!blocks_hold(linear, 0, 2, 2, 0x11) || !blocks_hold(linear, 1, 0, 2, 0x11) ||
+      !blocks_hold(linear, 0, 0, 2, 0) || !blocks_hold(linear, 1, 2, 2, 0)) {
+    warnx("a write over two chunks did not land on disks 0 and 1");
+    ok = false;
+  }
+  if (!blocks_hold(linear, 1, 5, 1, 0x22) || !blocks_hold(linear, 1, 4, 1, 0)) {
+    warnx("chunk 17 is not row 1 of disk 1");
+    ok = false;
+  }
+  if (!write_fill(striped, VOLUME_SIZE - JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE, 0x33) ||
+      !blocks_hold(linear, JBOD_NUM_DISKS - 1, JBOD_NUM_BLOCKS_PER_DISK - 1, 1, 0x33)) {
+    warnx("the last block of an unlabelled striped volume is not the last block of disk 15");
+    ok = false;
+  }
+  mdadm_close(striped);
+  mdadm_close(linear);
+  return ok;
+}
+
+//Formatting writes the label into the empty last block and takes that block from the
+//volume. A labelled volume refuses another stripe unit, lends its own to a handle that
+//selects none, and formatting refuses a volume whose last block holds data.
+static bool test_striping_label(void) {
+  bool ok = true;
+  mdadm_ctx_t *linear = open_layout(0, false);
+  if (linear == NULL)
+    errx(1, "failed to connect and mount");
+  mdadm_ctx_t *formatted = open_layout(512, true);
+  if (formatted == NULL || mdadm_ctx_get_stripe_unit(formatted) != 512) {
+    warnx("formatting the empty volume failed");
+    mdadm_close(linear);
+    return false;
+  }
+  if (!write_fill(formatted, VOLUME_SIZE - 2 * JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE, 0x44) ||
+      write_fill(formatted, VOLUME_SIZE - JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE, 0x55)) {
+    warnx("the label block is not cut from the labelled volume");
+    ok = false;
+  }
+  mdadm_close(formatted);
+
+  mdadm_ctx_t *other = open_layout(1024, false);
+  if (other != NULL) {
+    warnx("the labelled volume mounted with another stripe unit");
+    mdadm_close(other);
+    ok = false;
+  }
+  mdadm_ctx_t *recorded = open_layout(0, true);
+  if (recorded == NULL || mdadm_ctx_get_stripe_unit(recorded) != 512) {
+    warnx("the labelled volume did not mount with its recorded stripe unit");
+    ok = false;
+  }
+  if (recorded != NULL)
+    mdadm_close(recorded);
+
+  //Data in the last block, where a linear volume keeps its last bytes
+  if (!write_fill(linear, VOLUME_SIZE - JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE, 0x66))
+    errx(1, "failed to write the last block");
+  mdadm_ctx_t *refused = open_layout(512, true);
+  if (refused != NULL) {
+    warnx("formatting overwrote the data in the last block");
+    mdadm_close(refused);
+    ok = false;
+  }
+  if (!blocks_hold(linear, JBOD_NUM_DISKS - 1, JBOD_NUM_BLOCKS_PER_DISK - 1, 1, 0x66)) {
+    warnx("the data in the last block changed");
+    ok = false;
+  }
+  mdadm_close(linear);
+  return ok;
+}
+
+//The JBOD operation |cmd| on |disk| and |block|.
+static uint32_t op_of(jbod_cmd_t cmd, int disk, int block) {
+  return block | disk << 22 | (uint32_t)cmd << 26;
+}
+
+//Puts a request header for |op| and a packet of |len| bytes at |packet|.
+static void put_request(uint8_t *packet, uint16_t len, uint32_t op) {
+  uint16_t nLength = htons(len);
+  uint32_t nOp = htonl(op);
+  memset(packet, 0, HEADER_LEN);
+  memcpy(packet, &nLength, sizeof(nLength));
+  memcpy(packet + sizeof(nLength), &nOp, sizeof(nOp));
+}
+
+//Mounts on a new connection, sends the raw packet |packet| of |len| bytes and returns
+//true if the server closes the connection without replying to it.
+static bool server_drops(const uint8_t *packet, int len) {
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(JBOD_PORT) };
+  struct timeval timeout = { .tv_sec = 2 };
+  uint8_t mount[HEADER_LEN], reply[HEADER_LEN];
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  inet_pton(AF_INET, JBOD_SERVER, &addr.sin_addr);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    errx(1, "failed to connect");
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  put_request(mount, HEADER_LEN, op_of(JBOD_MOUNT, 0, 0));
+  if (write(fd, mount, HEADER_LEN) != HEADER_LEN || read(fd, reply, HEADER_LEN) != HEADER_LEN)
+    errx(1, "failed to mount");
+  //A reset counts as closed too, the server may drop the connection with the packet unread
+  errno = 0;
+  bool dropped = write(fd, packet, len) == len && read(fd, reply, sizeof(reply)) <= 0 && errno != EAGAIN;
+  close(fd);
+  return dropped;
+}
+
+//A batch runs its operations in order, returns the blocks of its reads and signatures,
+//and stops at the first failing operation. Packets whose payload is shorter than their
+//operations need are rejected.
+static bool test_batch_framing(void) {
+  uint8_t a[JBOD_BLOCK_SIZE], b[JBOD_BLOCK_SIZE], read_a[JBOD_BLOCK_SIZE], read_b[JBOD_BLOCK_SIZE];
+  uint8_t sig[JBOD_BLOCK_SIZE], packet[HEADER_LEN + 2 * (sizeof(uint32_t) + JBOD_BLOCK_SIZE)];
+  bool ok = true;
+
+  jbod_conn_t *conn = jbod_conn_open(JBOD_SERVER, JBOD_PORT);
+  if (conn == NULL || jbod_conn_operation(conn, op_of(JBOD_MOUNT, 0, 0), NULL) == -1)
+    errx(1, "failed to connect and mount");
+  memset(a, 0xa1, sizeof(a));
+  memset(b, 0xb2, sizeof(b));
+  uint32_t writes[] = { op_of(JBOD_SEEK_TO_DISK, 3, 0), op_of(JBOD_SEEK_TO_BLOCK, 0, 10),
+                        op_of(JBOD_WRITE_BLOCK, 0, 0), op_of(JBOD_WRITE_BLOCK, 0, 0) };
+  uint8_t *write_blocks[] = { NULL, NULL, a, b };
+  uint32_t reads[] = { op_of(JBOD_SEEK_TO_BLOCK, 0, 10), op_of(JBOD_READ_BLOCK, 0, 0),
+                       op_of(JBOD_READ_BLOCK, 0, 0), op_of(JBOD_SIGN_BLOCK, 3, 10) };
+  uint8_t *read_blocks[] = { NULL, read_a, read_b, sig };
+  if (jbod_conn_operation_batch(conn, writes, write_blocks, 4) == -1 ||
+      jbod_conn_operation_batch(conn, reads, read_blocks, 4) == -1) {
+    warnx("a valid batch failed");
+    ok = false;
+  }
+  if (memcmp(read_a, a, sizeof(a)) != 0 || memcmp(read_b, b, sizeof(b)) != 0) {
+    warnx("the blocks read back in a batch are not the ones written in a batch");
+    ok = false;
+  }
+  if (strncmp((char *)sig, "SIG(disk,block)  3  10 :", 24) != 0) {
+    warnx("the signature in the batch reply is not the one of block 10 of disk 3");
+    ok = false;
+  }
+
+  //The bad command stops the batch before the write after it
+  uint32_t failing[] = { op_of(JBOD_SEEK_TO_BLOCK, 0, 10), op_of(JBOD_NUM_CMDS, 0, 0), op_of(JBOD_WRITE_BLOCK, 0, 0) };
+  uint8_t *failing_blocks[] = { NULL, NULL, b };
+  if (jbod_conn_operation_batch(conn, failing, failing_blocks, 3) != -1) {
+    warnx("a batch with a bad command succeeded");
+    ok = false;
+  }
+  uint32_t check[] = { op_of(JBOD_SEEK_TO_BLOCK, 0, 10), op_of(JBOD_READ_BLOCK, 0, 0) };
+  uint8_t *check_blocks[] = { NULL, read_a };
+  if (jbod_conn_operation_batch(conn, check, check_blocks, 2) == -1 || memcmp(read_a, a, sizeof(a)) != 0) {
+    warnx("the operations after the failing one ran");
+    ok = false;
+  }
+
+  //A single write without its block, and a batch of two writes carrying one
+  put_request(packet, HEADER_LEN, op_of(JBOD_WRITE_BLOCK, 0, 0));
+  if (!server_drops(packet, HEADER_LEN)) {
+    warnx("a write packet without a block was accepted");
+    ok = false;
+  }
+  int len = HEADER_LEN + sizeof(uint32_t) + JBOD_BLOCK_SIZE + sizeof(uint32_t);
+  uint32_t nOp = htonl(op_of(JBOD_WRITE_BLOCK, 0, 0));
+  put_request(packet, len, JBOD_BATCH << 26 | 2);
+  memcpy(packet + HEADER_LEN, &nOp, sizeof(nOp));
+  memcpy(packet + HEADER_LEN + sizeof(nOp), b, JBOD_BLOCK_SIZE);
+  memcpy(packet + HEADER_LEN + sizeof(nOp) + JBOD_BLOCK_SIZE, &nOp, sizeof(nOp));
+  if (!server_drops(packet, len)) {
+    warnx("a batch shorter than its operations was accepted");
+    ok = false;
+  }
+  jbod_conn_operation(conn, op_of(JBOD_UNMOUNT, 0, 0), NULL);
+  jbod_conn_close(conn);
+  return ok;
+}
+
+//Completion order and results recorded by the asynchronous requests of test_async_ordering.
+#define ASYNC_REQUESTS 5
+static int async_order[ASYNC_REQUESTS];
+static int async_results[ASYNC_REQUESTS];
+static int async_done = 0;
+
+static void async_callback(int result, void *arg) {
+  int id = (int)(intptr_t)arg;
+  if (async_done < ASYNC_REQUESTS) {
+    async_order[async_done] = id;
+    async_results[async_done] = result;
+  }
+  async_done++;
+}
+
+//Asynchronous requests on one block complete in the order they were submitted, each read
+//sees the writes submitted before it, and a read answered after a later write does not
+//leave its old copy in the cache.
+static bool test_async_ordering(void) {
+  uint8_t a[JBOD_BLOCK_SIZE], b[JBOD_BLOCK_SIZE], first[JBOD_BLOCK_SIZE], second[JBOD_BLOCK_SIZE];
+  uint8_t span[300], buf[JBOD_BLOCK_SIZE];
+  uint32_t addr = 5 * JBOD_BLOCK_SIZE;
+  bool ok = true;
+
+  memset(a, 0xa1, sizeof(a));
+  memset(b, 0xb2, sizeof(b));
+  for (int cached = 0; cached < 2; cached++) {
+    const char *mode = cached ? "with the cache" : "without the cache";
+    if (cached && cache_create(TEST_CACHE_SIZE) != 1)
+      errx(1, "failed to create the cache");
+    mdadm_ctx_t *ctx = mdadm_open(JBOD_SERVER, JBOD_PORT, NULL);
+    if (ctx == NULL)
+      errx(1, "failed to connect and mount");
+    async_done = 0;
+    if (mdadm_ctx_write_async(ctx, addr, sizeof(a), a, async_callback, (void *)0) == -1 ||
+        mdadm_ctx_read_async(ctx, addr, sizeof(first), first, async_callback, (void *)1) == -1 ||
+        mdadm_ctx_write_async(ctx, addr, sizeof(b), b, async_callback, (void *)2) == -1 ||
+        mdadm_ctx_read_async(ctx, addr, sizeof(second), second, async_callback, (void *)3) == -1 ||
+        mdadm_ctx_read_async(ctx, addr + 100, sizeof(span), span, async_callback, (void *)4) == -1) {
+      warnx("submitting the requests failed %s", mode);
+      ok = false;
+    }
+    mdadm_ctx_wait(ctx, 0);
+    if (async_done != ASYNC_REQUESTS) {
+      warnx("%d of %d callbacks ran %s", async_done, ASYNC_REQUESTS, mode);
+      ok = false;
+    }
+    for (int i = 0; i < ASYNC_REQUESTS && i < async_done; i++) {
+      if (async_order[i] != i) {
+        warnx("request %d completed in place %d %s", async_order[i], i, mode);
+        ok = false;
+      }
+    }
+    if (async_results[0] != JBOD_BLOCK_SIZE || async_results[4] != (int)sizeof(span)) {
+      warnx("the callbacks did not get the request lengths %s", mode);
+      ok = false;
+    }
+    if (memcmp(first, a, sizeof(a)) != 0 || memcmp(second, b, sizeof(b)) != 0) {
+      warnx("a read did not see the write submitted before it %s", mode);
+      ok = false;
+    }
+    bool next_empty = true;
+    for (int i = JBOD_BLOCK_SIZE - 100; i < (int)sizeof(span); i++)
+      next_empty &= (span[i] == 0);
+    if (memcmp(span, b + 100, JBOD_BLOCK_SIZE - 100) != 0 || !next_empty) {
+      warnx("the read across two blocks did not see the last write %s", mode);
+      ok = false;
+    }
+    if (mdadm_ctx_read(ctx, addr, sizeof(buf), buf) != sizeof(buf) || memcmp(buf, b, sizeof(b)) != 0) {
+      warnx("the block reads back as an older write %s", mode);
+      ok = false;
+    }
+    mdadm_close(ctx);
+    if (cached)
+      cache_destroy();
+  }
+  return ok;
+}
+
+//Splits |len| bytes of |buf| into iovecs of the |sizes| given, the last one taking the
+//rest. Returns the number of iovecs.
+static int split_iov(struct iovec *iov, uint8_t *buf, int len, const int *sizes, int count) {
+  int n = 0;
+  for (int i = 0; i < count && len > 0; i++, n++) {
+    int size = (i == count - 1 || sizes[i] > len) ? len : sizes[i];
+    iov[n].iov_base = buf;
+    iov[n].iov_len = size;
+    buf += size;
+    len -= size;
+  }
+  return n;
+}
+
+//A vectored write and read of over 64 blocks across a disk boundary, with iovecs that
+//split blocks in different places, move the same bytes as 1024-byte reads, with and
+//without the cache. Requests past the end of the volume are refused.
+static bool test_vectored_splits(void) {
+  static const int write_sizes[] = { 1, 255, 256, 3000, 17, 0 };
+  static const int read_sizes[] = { 700, 1, 512, 20000, 0 };
+  static uint8_t data[40000], back[sizeof(data)];
+  struct iovec iov[8];
+  //Starts mid-block, 20000 bytes before the end of disk 0
+  uint32_t addr = JBOD_DISK_SIZE - 20000;
+  bool ok = true;
+
+  for (int i = 0; i < (int)sizeof(data); i++)
+    data[i] = (uint8_t)(i * 7 + i / 256);
+  for (int cached = 0; cached < 2; cached++) {
+    const char *mode = cached ? "with the cache" : "without the cache";
+    if (cached && cache_create(TEST_CACHE_SIZE) != 1)
+      errx(1, "failed to create the cache");
+    mdadm_ctx_t *ctx = mdadm_open(JBOD_SERVER, JBOD_PORT, NULL);
+    if (ctx == NULL)
+      errx(1, "failed to connect and mount");
+    int n = split_iov(iov, data, sizeof(data), write_sizes, 6);
+    if (mdadm_ctx_writev(ctx, addr, iov, n) != (int)sizeof(data)) {
+      warnx("the vectored write failed %s", mode);
+      ok = false;
+    }
+    memset(back, 0, sizeof(back));
+    n = split_iov(iov, back, sizeof(back), read_sizes, 5);
+    if (mdadm_ctx_readv(ctx, addr, iov, n) != (int)sizeof(back) || memcmp(back, data, sizeof(data)) != 0) {
+      warnx("the vectored read did not return what the vectored write wrote %s", mode);
+      ok = false;
+    }
+    memset(back, 0, sizeof(back));
+    for (int off = 0; off < (int)sizeof(back); off += 1024) {
+      int len = sizeof(back) - off < 1024 ? sizeof(back) - off : 1024;
+      if (mdadm_ctx_read(ctx, addr + off, len, back + off) != len) {
+        warnx("reading back at %d failed %s", off, mode);
+        ok = false;
+        break;
+      }
+    }
+    if (memcmp(back, data, sizeof(data)) != 0) {
+      warnx("plain reads do not return what the vectored write wrote %s", mode);
+      ok = false;
+    }
+    iov[0].iov_base = data;
+    iov[0].iov_len = sizeof(data);
+    if (mdadm_ctx_writev(ctx, VOLUME_SIZE - 100, iov, 1) != -1) {
+      warnx("a vectored write past the end of the volume succeeded %s", mode);
+      ok = false;
+    }
+    mdadm_close(ctx);
+    if (cached)
+      cache_destroy();
+  }
+  return ok;
+}
+
+//Reads the block at |disk|, |block| on |conn| and checks that it holds |fill|.
+static bool conn_block_holds(jbod_conn_t *conn, int disk, int block, uint8_t fill) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  if (jbod_conn_operation(conn, op_of(JBOD_SEEK_TO_DISK, disk, 0), NULL) == -1 ||
+      jbod_conn_operation(conn, op_of(JBOD_SEEK_TO_BLOCK, 0, block), NULL) == -1 ||
+      jbod_conn_operation(conn, op_of(JBOD_READ_BLOCK, 0, 0), buf) == -1)
+    return false;
+  for (int i = 0; i < JBOD_BLOCK_SIZE; i++)
+    if (buf[i] != fill)
+      return false;
+  return true;
+}
+
+//Writes a block of |fill| on |conn| wherever its head is.
+static bool conn_write(jbod_conn_t *conn, uint8_t fill) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  memset(buf, fill, sizeof(buf));
+  return jbod_conn_operation(conn, op_of(JBOD_WRITE_BLOCK, 0, 0), buf) != -1;
+}
+
+//The server keeps a head per client: two clients seek to different blocks, then take
+//turns writing without seeking, and each write lands after its own client's last one.
+static bool test_server_heads(void) {
+  jbod_conn_t *a = jbod_conn_open(JBOD_SERVER, JBOD_PORT);
+  jbod_conn_t *b = jbod_conn_open(JBOD_SERVER, JBOD_PORT);
+  bool ok = true;
+
+  if (a == NULL || b == NULL || jbod_conn_operation(a, op_of(JBOD_MOUNT, 0, 0), NULL) == -1 ||
+      jbod_conn_operation(b, op_of(JBOD_MOUNT, 0, 0), NULL) == -1)
+    errx(1, "failed to connect and mount");
+  if (jbod_conn_operation(a, op_of(JBOD_SEEK_TO_DISK, 1, 0), NULL) == -1 ||
+      jbod_conn_operation(a, op_of(JBOD_SEEK_TO_BLOCK, 0, 5), NULL) == -1 ||
+      jbod_conn_operation(b, op_of(JBOD_SEEK_TO_DISK, 2, 0), NULL) == -1 ||
+      jbod_conn_operation(b, op_of(JBOD_SEEK_TO_BLOCK, 0, 9), NULL) == -1) {
+    warnx("seeking failed");
+    ok = false;
+  }
+  if (!conn_write(a, 0x11) || !conn_write(b, 0x22) || !conn_write(a, 0x33) || !conn_write(b, 0x44)) {
+    warnx("writing failed");
+    ok = false;
+  }
+  if (!conn_block_holds(a, 1, 5, 0x11) || !conn_block_holds(a, 1, 6, 0x33)) {
+    warnx("the writes of the first client did not follow its own head");
+    ok = false;
+  }
+  if (!conn_block_holds(b, 2, 9, 0x22) || !conn_block_holds(b, 2, 10, 0x44)) {
+    warnx("the writes of the second client did not follow its own head");
+    ok = false;
+  }
+  jbod_conn_operation(b, op_of(JBOD_UNMOUNT, 0, 0), NULL);
+  jbod_conn_operation(a, op_of(JBOD_UNMOUNT, 0, 0), NULL);
+  jbod_conn_close(b);
+  jbod_conn_close(a);
+  return ok;
+}
+
+static const test_t tests[] = {
+  { "writeback_clients", test_writeback_clients },
+  { "striping_map", test_striping_map },
+  { "striping_label", test_striping_label },
+  { "batch_framing", test_batch_framing },
+  { "async_ordering", test_async_ordering },
+  { "vectored_splits", test_vectored_splits },
+  { "server_heads", test_server_heads },
+};
+
+int main(int argc, char *argv[]) {
+  int failures = 0;
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    bool passed = tests[i].run();
+    printf("%-20s %s\n", tests[i].name, passed ? "PASS" : "FAIL");
+    if (!passed)
+      failures++;
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <stdbool.h>
+
+#include "cache.h"
+#include "jbod.h"
+#include "trace.h"
+#include "workload.h"
+
+#define MRC_ARGUMENTS "haPc"
+#define USAGE                                                        \
+  "USAGE: mrc [-h] [-a] [-P] [-c] input...\n"                        \
+  "\n"                                                               \
+  "where:\n"                                                         \
+  "    -h - help mode (display this message)\n"                      \
+  "    -a - print every cache size from 2 to 4096, not only the powers of\n" \
+  "         two and the sizes halfway between them\n"                \
+  "    -P - also replay the accesses through the clock, 2q and arc caches\n" \
+  "         (and lru, as a check) at the powers of two\n"            \
+  "    -c - print comma separated values\n"                          \
+  "\n"                                                               \
+  "Computes the hit rate of the LRU cache at every size from 2 to 4096 entries\n" \
+  "in one pass, from the stack distance of each block access. An input is a\n" \
+  "tester workload, text (- for the standard input) or binary, or a binary\n" \
+  "trace written by tester -t, whose reads and writes are the mdadm requests\n" \
+  "it ran. The accesses are those of tester in write-through mode without\n" \
+  "readahead: every block of a read, and the partially written blocks of a\n" \
+  "write, is a lookup, and every block read or written is a use.\n"
+
+#define MIN_ENTRIES 2
+#define MAX_ENTRIES 4096
+#define NUM_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+#define VOLUME_SIZE (NUM_BLOCKS * JBOD_BLOCK_SIZE)
+
+//An access is a block number and how the cache sees it.
+#define ACCESS_LOOKUP 0x8000   //looked up, counts towards the hit rate
+#define ACCESS_WRITE 0x4000    //written, the cached copy is updated
+#define ACCESS_BLOCK 0x0fff
+
+static uint16_t *accesses = NULL;
+static size_t num_accesses = 0, accesses_cap = 0;
+static uint64_t requests = 0;
+
+static void add_access(uint16_t access) {
+  if (num_accesses == accesses_cap) {
+    accesses_cap = accesses_cap ? 2 * accesses_cap : 1 << 20;
+    accesses = realloc(accesses, accesses_cap * sizeof(uint16_t));
+    if (accesses == NULL)
+      err(1, "Out of memory");
+  }
+  accesses[num_accesses++] = access;
+}
+
+//Adds the block accesses of a read or write of |len| bytes at |addr|. Blocks are numbered
+//across the volume, which names them the same way under any layout.
+static void add_request(bool write, uint32_t addr, uint32_t len) {
+  if (len == 0 || addr >= VOLUME_SIZE || len > VOLUME_SIZE - addr)
+    return;
+  requests += 1;
+  for (uint32_t block = addr / JBOD_BLOCK_SIZE; block <= (addr + len - 1) / JBOD_BLOCK_SIZE; block++) {
+    uint32_t start = block * JBOD_BLOCK_SIZE;
+    bool whole = addr <= start && addr + len >= start + JBOD_BLOCK_SIZE;
+    if (!write)
+      add_access(block | ACCESS_LOOKUP);
+    else
+      add_access(block | ACCESS_WRITE | (whole ? 0 : ACCESS_LOOKUP));
+  }
+}
+
+static void load_workload(FILE *f, const char *path) {
+  char line[256], cmd[32];
+  uint32_t addr, len, ch;
+  int line_num = 0;
+
+  while (fgets(line, sizeof(line), f)) {
+    ++line_num;
+    if (strncmp(line, "MOUNT", 5) == 0 || strncmp(line, "UNMOUNT", 7) == 0 ||
+        strncmp(line, "SIGNALL", 7) == 0 || line[0] == '\n')
+      continue;
+    if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4 ||
+        (strcmp(cmd, "READ") != 0 && strcmp(cmd, "WRITE") != 0))
+      errx(1, "%s: cannot parse line %d: %s", path, line_num, line);
+    add_request(strcmp(cmd, "WRITE") == 0, addr, len);
+  }
+}
+
+static int compare_records(const void *a, const void *b) {
+  const trace_record_t *x = a, *y = b;
+  return x->ts_ns < y->ts_ns ? -1 : x->ts_ns > y->ts_ns;
+}
+
+//Takes the successful mdadm reads and writes of a binary trace, in the order they started.
+static void load_trace(FILE *f, const char *path) {
+  trace_header_t header;
+  trace_record_t *records = NULL;
+  size_t n = 0, cap = 0;
+
+  if (fread(&header, sizeof(header), 1, f) != 1 || header.version != TRACE_VERSION ||
+      header.record_size != sizeof(trace_record_t))
+    errx(1, "%s: not a trace this tool can read", path);
+  for (;;) {
+    if (n == cap) {
+      cap = cap ? 2 * cap : 1 << 16;
+      records = realloc(records, cap * sizeof(trace_record_t));
+      if (records == NULL)
+        err(1, "Out of memory");
+    }
+    if (fread(&records[n], sizeof(trace_record_t), 1, f) != 1)
+      break;
+    if ((records[n].kind == TRACE_READ || records[n].kind == TRACE_WRITE) && records[n].result >= 0)
+      n++;
+  }
+  //Every thread's ring is flushed on its own
+  qsort(records, n, sizeof(trace_record_t), compare_records);
+  for (size_t i = 0; i < n; i++)
+    add_request(records[i].kind == TRACE_WRITE, records[i].addr, records[i].len);
+  free(records);
+}
+
+static void load_binary(const workload_t *w) {
+  uint32_t next = 0;
+
+  for (uint64_t i = 0; i < w->header->records; i++) {
+    const workload_record_t *r = &w->records[i];
+    if (r->cmd == WORKLOAD_READ || r->cmd == WORKLOAD_WRITE)
+      add_request(r->cmd == WORKLOAD_WRITE, workload_addr(w, r, &next), r->len);
+  }
+}
+
+static void load_input(const char *path) {
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  workload_t w;
+  int binary = workload_map(path, &w);
+
+  if (binary == -1)
+    errx(1, "Cannot use the binary workload %s", path);
+  if (binary) {
+    load_binary(&w);
+    workload_unmap(&w);
+    return;
+  }
+  FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+
+  if (f == NULL)
+    err(1, "Cannot open %s", path);
+  if (f != stdin && fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+    rewind(f);
+    load_trace(f, path);
+  } else {
+    if (f != stdin)
+      rewind(f);
+    load_workload(f, path);
+  }
+  if (f != stdin)
+    fclose(f);
+}
+
+//Fenwick tree over the access times, with a 1 at the last use of every block so far. The
+//blocks used since time t are the 1s after t.
+static uint32_t *fenwick;
+
+static void fenwick_add(size_t i, int delta) {
+  for (; i <= num_accesses; i += i & -i)
+    fenwick[i] += delta;
+}
+
+static uint32_t fenwick_sum(size_t i) {
+  uint32_t sum = 0;
+  for (; i > 0; i -= i & -i)
+    sum += fenwick[i];
+  return sum;
+}
+
+//Fills hits[d] with the lookups at stack distance d: d other blocks were used since the
+//block was last used, so an LRU cache of more than d entries still holds it. Lookups of
+//blocks never used before are cold misses, counted in |cold|. Returns the number of
+//distinct blocks.
+static int stack_distances(uint64_t *hits, uint64_t *cold) {
+  static uint32_t last_use[NUM_BLOCKS];
+  int distinct = 0;
+
+  fenwick = calloc(num_accesses + 1, sizeof(uint32_t));
+  if (fenwick == NULL)
+    err(1, "Out of memory");
+  memset(last_use, 0, sizeof(last_use));
+  *cold = 0;
+  for (size_t t = 1; t <= num_accesses; t++) {
+    uint16_t access = accesses[t - 1];
+    int block = access & ACCESS_BLOCK;
+    if (last_use[block] == 0) {
+      distinct += 1;
+      if (access & ACCESS_LOOKUP)
+        *cold += 1;
+    } else {
+      //Blocks whose last use came after this block's, all of them other blocks
+      uint32_t distance = distinct - fenwick_sum(last_use[block]);
+      if (access & ACCESS_LOOKUP)
+        hits[distance < MAX_ENTRIES ? distance : MAX_ENTRIES] += 1;
+      fenwick_add(last_use[block], -1);
+    }
+    fenwick_add(t, 1);
+    last_use[block] = t;
+  }
+  free(fenwick);
+  return distinct;
+}
+
+//Replays the accesses through the cache of |policy| with |entries| entries, the way
+//mdadm drives it, and returns its hit rate.
+static double replay(cache_policy_t policy, int entries) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  cache_counters_t counters;
+
+  memset(buf, 0, sizeof(buf));
+  if (cache_create_ex(entries, policy) != 1)
+    errx(1, "Failed to create the %s cache of %d entries", cache_policy_name(policy), entries);
+  for (size_t i = 0; i < num_accesses; i++) {
+    int block = accesses[i] & ACCESS_BLOCK;
+    int disk_num = block / JBOD_NUM_BLOCKS_PER_DISK, block_num = block % JBOD_NUM_BLOCKS_PER_DISK;
+    if (accesses[i] & ACCESS_LOOKUP) {
+      if (cache_lookup(disk_num, block_num, buf) != 1)
+        cache_insert(disk_num, block_num, buf);
+      else if (accesses[i] & ACCESS_WRITE)
+        cache_update(disk_num, block_num, buf);
+    } else if (cache_insert(disk_num, block_num, buf) == -1) {
+      cache_update(disk_num, block_num, buf);
+    }
+  }
+  cache_get_stats(&counters);
+  cache_destroy();
+  return counters.lookups ? 100.0 * counters.hits / counters.lookups : 0;
+}
+
+//Sizes printed without -a: the powers of two and the sizes halfway between them.
+static bool printed(int entries, bool all) {
+  bool power = (entries & (entries - 1)) == 0;
+  return all || power || (entries % 3 == 0 && ((entries / 3) & (entries / 3 - 1)) == 0);
+}
+
+int main(int argc, char *argv[]) {
+  static uint64_t hits[MAX_ENTRIES + 1];
+  int ch;
+  bool all = false, policies = false, csv = false;
+
+  while ((ch = getopt(argc, argv, MRC_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'a':
+        all = true;
+        break;
+      case 'P':
+        policies = true;
+        break;
+      case 'c':
+        csv = true;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (optind == argc) {
+    fprintf(stderr, USAGE);
+    return -1;
+  }
+  for (int i = optind; i < argc; i++)
+    load_input(argv[i]);
+
+  uint64_t cold, lookups = 0;
+  int distinct = stack_distances(hits, &cold);
+  lookups = cold;
+  for (int d = 0; d <= MAX_ENTRIES; d++)
+    lookups += hits[d];
+  if (!csv)
+    printf("%llu requests, %zu block accesses, %llu lookups, %d distinct blocks, %llu cold misses\n",
+           (unsigned long long)requests, num_accesses, (unsigned long long)lookups, distinct,
+           (unsigned long long)cold);
+
+  printf(csv ? "entries,lru" : "%8s %8s", "entries", "lru");
+  if (policies)
+    for (int p = 0; p < CACHE_NUM_POLICIES; p++) {
+      char name[32];
+      snprintf(name, sizeof(name), "%s replay", cache_policy_name(p));
+      printf(csv ? ",%s" : " %16s", name);
+    }
+  printf("\n");
+
+  //An LRU cache of n entries hits the lookups at distance below n
+  uint64_t hit_sum = 0;
+  double best = 0;
+  int knee = 0;
+  for (int entries = 1; entries <= MAX_ENTRIES; entries++) {
+    hit_sum += hits[entries - 1];
+    double rate = lookups ? 100.0 * hit_sum / lookups : 0;
+    if (entries < MIN_ENTRIES || !printed(entries, all))
+      continue;
+    printf(csv ? "%d,%.4f" : "%8d %7.2f%%", entries, rate);
+    if (policies) {
+      bool power = (entries & (entries - 1)) == 0;
+      for (int p = 0; p < CACHE_NUM_POLICIES; p++) {
+        if (power)
+          printf(csv ? ",%.4f" : " %15.2f%%", replay(p, entries));
+        else
+          printf(csv ? "," : " %16s", "-");
+      }
+    }
+    printf("\n");
+    best = rate;
+  }
+  //The smallest cache that gets within a point of the largest one
+  hit_sum = 0;
+  for (knee = 1; knee < MAX_ENTRIES; knee++) {
+    hit_sum += hits[knee - 1];
+    if (lookups && 100.0 * hit_sum / lookups >= best - 1)
+      break;
+  }
+  if (!csv)
+    printf("%d entries get within 1 point of the hit rate of %d (%.2f%%)\n",
+           knee < MIN_ENTRIES ? MIN_ENTRIES : knee, MAX_ENTRIES, best);
+  free(accesses);
+  return 0;
+}
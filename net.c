@@ -8,170 +8,304 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <time.h>
 #include "net.h"
 #include "jbod.h"
+#include "trace.h"
  
 /* the client socket descriptor for the connection to the server */
 int cli_sd = -1;
 int lengthSize = 2;
 int opSize = 4;
 int retSize = 2;
+
+/* a request (single operation or batch) sent to the server whose reply has not been read yet */
+typedef struct {
+  int count;                       // number of operations, 0 for a single operation
+  uint32_t ops[JBOD_MAX_BATCH];
+  uint8_t *blocks[JBOD_MAX_BATCH];
+  int *ret;                        // where to report a failure, may be NULL
+  int reply_len;                   // size of the expected reply
+  uint64_t sent_ns;                // monotonic time the request went out, for its round trip time
+} pending_t;
+
+/* a connection to the server with its requests in flight, answered in the order they were sent */
+struct jbod_conn {
+  int sd;
+  pending_t pending[JBOD_MAX_PENDING];
+  int pending_head;                // oldest request in flight
+  int pending_count;
+  int pending_bytes;               // reply bytes the server may still send
+  uint32_t submitted_seq;          // number of requests sent so far
+  uint32_t completed_seq;          // number of requests whose reply has been read
+  uint8_t spill[JBOD_BLOCK_SIZE];  // bytes of the next replies read along with a short reply
+  int spill_off;
+  int spill_len;
+  jbod_net_stats_t stats;
+};
+
+/* the connection opened by jbod_connect, used by the jbod_client_* functions */
+static jbod_conn_t default_conn = { .sd = -1 };
+
+/* TCP_NODELAY for the connections opened from now on */
+static bool nodelay = true;
  
  
-/* attempts to read n (len) bytes from fd; returns true on success and false on failure. 
-It may need to call the system call "read" multiple times to reach the given size len. 
-*/
-static bool nread(int fd, int len, uint8_t *buf) {
-  int bytesRead = 0; //Counter variable for bytes read
-  int loopResult; //Bytes written as a result of the  while loop
-  while (bytesRead < len){
-    loopResult = read(fd, buf + bytesRead, len-bytesRead); //Reading from file descriptor
-    //If read fails return false
-    if(loopResult < 0){
+/* attempts to read all the bytes described by the |iovcnt| iovecs of |iov| from the
+connection; returns true on success and false on failure. Each readv call fills as many
+of the buffers as the socket has data for; |iov| is advanced past what was read. The
+bytes spilled by recv_packet come first. */
+static bool nreadv(jbod_conn_t *conn, struct iovec *iov, int iovcnt) {
+  while(iovcnt > 0 && conn->spill_len > 0){
+    int n = iov->iov_len < (size_t)conn->spill_len ? (int)iov->iov_len : conn->spill_len;
+    memcpy(iov->iov_base, conn->spill + conn->spill_off, n);
+    conn->spill_off += n;
+    conn->spill_len -= n;
+    if((size_t)n == iov->iov_len){
+      iov++;
+      iovcnt--;
+    }else{
+      iov->iov_base = (uint8_t *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  while(iovcnt > 0){
+    ssize_t loopResult = readv(conn->sd, iov, iovcnt);
+    conn->stats.syscalls += 1;
+    //If read fails or the server closed the connection return false
+    if(loopResult <= 0){
       return false;
     }
-    //Incrementing counter variable
-    bytesRead += loopResult;
+    conn->stats.bytes_received += loopResult;
+    //Skip the buffers filled in full and trim the one filled in part
+    while(iovcnt > 0 && (size_t)loopResult >= iov->iov_len){
+      loopResult -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if(iovcnt > 0){
+      iov->iov_base = (uint8_t *)iov->iov_base + loopResult;
+      iov->iov_len -= loopResult;
+    }
   }
   return true;
 }
- 
-/* attempts to write n bytes to fd; returns true on success and false on failure 
-It may need to call the system call "write" multiple times to reach the size len.
-*/
-static bool nwrite(int fd, int len, uint8_t *buf) {
-  int bytesWritten = 0; //Counter variable for bytes written
-  int loopResult; //Bytes written as a result of the  while loop
-  while (bytesWritten < len){
-    loopResult = write(fd, buf + bytesWritten, len-bytesWritten); //Reading from file descriptor
-    //If read fails return false
+
+/* attempts to write all the bytes described by the |iovcnt| iovecs of |iov| to the
+connection; returns true on success and false on failure. |iov| is advanced past what
+was written. */
+static bool nwritev(jbod_conn_t *conn, struct iovec *iov, int iovcnt) {
+  while(iovcnt > 0){
+    ssize_t loopResult = writev(conn->sd, iov, iovcnt);
+    conn->stats.syscalls += 1;
     if(loopResult < 0){
       return false;
     }
-    //Incrementing counter variable
-    bytesWritten += loopResult;
+    conn->stats.bytes_sent += loopResult;
+    while(iovcnt > 0 && (size_t)loopResult >= iov->iov_len){
+      loopResult -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if(iovcnt > 0){
+      iov->iov_base = (uint8_t *)iov->iov_base + loopResult;
+      iov->iov_len -= loopResult;
+    }
   }
   return true;
 }
-/* Through this function call the client attempts to receive a packet from sd 
-(i.e., receiving a response from the server.). It happens after the client previously 
-forwarded a jbod operation call via a request message to the server.  
-It returns true on success and false on failure. 
-The values of the parameters (including op, ret, block) will be returned to the caller of this function: 
- 
-op - the address to store the jbod "opcode"  
+
+//Returns true if the reply to |op| carries a block.
+static bool returns_block(uint32_t op) {
+  uint32_t cmd = op >> 26;
+  return cmd == JBOD_READ_BLOCK || cmd == JBOD_SIGN_BLOCK;
+}
+
+/* Through this function call the client attempts to receive a packet from the server
+(i.e., receiving a response to the jbod operation |sent_op| it previously forwarded).
+It returns true on success and false on failure.
+The values of the parameters (including op, ret, block) will be returned to the caller of this function:
+
+op - the address to store the jbod "opcode"
 ret - the address to store the return value of the server side calling the corresponding jbod_operation function.
 block - holds the received block content if existing (e.g., when the op command is JBOD_READ_BLOCK)
- 
-In your implementation, you can read the packet header first (i.e., read HEADER_LEN bytes first), 
-and then use the length field in the header to determine whether it is needed to read 
-a block of data from the server. You may use the above nread function here.  
+
+The length field of the header tells whether a block follows, it lands in |block| directly.
+When |sent_op| expects one, the first readv asks for the header and the block at once and
+takes whatever the socket has. If the header turns out to come alone (a failed read), the
+bytes read past it belong to the next replies and are spilled for nreadv.
 */
-static bool recv_packet(int sd, uint32_t *op, uint16_t *ret, uint8_t *block) {
+static bool recv_packet(jbod_conn_t *conn, uint32_t sent_op, uint32_t *op, uint16_t *ret, uint8_t *block) {
   uint8_t headbuff[HEADER_LEN]; //Array containing header content
-  uint16_t length;  //Length of Host, 
   uint16_t nLength; //Length of Network
-  uint16_t nReturn; //return 
+  uint16_t nReturn; //return
   uint32_t nOp; //Network opcode
- 
-  int headOffset = 0; //Offset used when reading from header
- 
-  //If unable to read Header return false
-  if (nread(sd, HEADER_LEN, headbuff) == false){
+  struct iovec iov[2] = {
+    { .iov_base = headbuff, .iov_len = HEADER_LEN },
+    { .iov_base = block, .iov_len = JBOD_BLOCK_SIZE },
+  };
+  int body = 0; //Bytes of the block already read
+
+  if(returns_block(sent_op) && block != NULL && conn->spill_len == 0){
+    ssize_t got = readv(conn->sd, iov, 2);
+    conn->stats.syscalls += 1;
+    if(got <= 0){
+      return false;
+    }
+    conn->stats.bytes_received += got;
+    if(got < HEADER_LEN){
+      iov[0].iov_base = headbuff + got;
+      iov[0].iov_len = HEADER_LEN - got;
+    }else{
+      body = got - HEADER_LEN;
+      iov[0].iov_len = 0;
+    }
+  }
+  if(iov[0].iov_len > 0 && nreadv(conn, iov, 1) == false){
     return false;
   }
- 
+
   //Get the length, opcode, and return from the header.
-  memcpy(&nLength, headbuff + headOffset, lengthSize);
-  headOffset += lengthSize;
-  memcpy(&nOp, headbuff + headOffset, opSize);
-  headOffset += opSize;
-  memcpy(&nReturn, headbuff + headOffset, retSize);
- 
-  //Assigning network values to host values
-  length = ntohs(nLength);
+  memcpy(&nLength, headbuff, lengthSize);
+  memcpy(&nOp, headbuff + lengthSize, opSize);
+  memcpy(&nReturn, headbuff + lengthSize + opSize, retSize);
   *ret = ntohs(nReturn);
   *op = ntohl(nOp);
- 
-  //When reading the block, set the size of read to JBOD Block Size
-  if (length > (HEADER_LEN)){
-    if (nread(sd, JBOD_BLOCK_SIZE, block) == false){
-      return false;
+
+  if(ntohs(nLength) == HEADER_LEN){
+    //Keep what was read of the next replies
+    if(body > 0){
+      memcpy(conn->spill, block, body);
+      conn->spill_off = 0;
+      conn->spill_len = body;
     }
+    return true;
   }
-  return true; 
+  //Only a single block can follow, and only when the caller has room for it
+  if(ntohs(nLength) != HEADER_LEN + JBOD_BLOCK_SIZE || block == NULL){
+    return false;
+  }
+  iov[1].iov_base = block + body;
+  iov[1].iov_len = JBOD_BLOCK_SIZE - body;
+  return body == JBOD_BLOCK_SIZE || nreadv(conn, &iov[1], 1);
 }
- 
- 
- 
-/* The client attempts to send a jbod request packet to sd (i.e., the server socket here); 
-returns true on success and false on failure. 
- 
-op - the opcode. 
+
+/* fills |headbuff| with a packet header for |op| and a packet of |length| bytes */
+static void put_header(uint8_t *headbuff, uint16_t length, uint32_t op) {
+  uint16_t nLength = htons(length); // Network length
+  uint32_t nOp = htonl(op); // Network op
+  memset(headbuff, 0, HEADER_LEN);
+  memcpy(headbuff, &nLength, lengthSize);
+  memcpy(headbuff + lengthSize, &nOp, opSize);
+}
+
+/* The client attempts to send a jbod request packet to the server;
+returns true on success and false on failure.
+
+op - the opcode.
 block- when the command is JBOD_WRITE_BLOCK, the block will contain data to write to the server jbod system;
 otherwise it is NULL.
- 
-The above information (when applicable) has to be wrapped into a jbod request packet (format specified in readme).
-You may call the above nwrite function to do the actual sending.  
+
+The header and the block go out in one writev, the block is sent from the caller's buffer.
 */
-static bool send_packet(int sd, uint32_t op, uint8_t *block) {
-  uint8_t buff[HEADER_LEN + JBOD_BLOCK_SIZE]; // Array containing Packet
-  uint16_t length = HEADER_LEN; // Host length
-  uint16_t nLength; // Network length
-  uint32_t nOp; // Network op
-  uint32_t cmd = op >> 26; // Bit shifting opcode 26 to the right to get cmd 
- 
-  //If cmd is a is the code for write system call add block size to the length
-  if(cmd == JBOD_WRITE_BLOCK){
-    length += JBOD_BLOCK_SIZE;
-    memcpy(buff + HEADER_LEN, block, JBOD_BLOCK_SIZE);
-  }
- 
-  //Assigning network values to host values
-  nLength = htons(length);
-  nOp = htonl(op);
- 
-  int headOffset = 0; //Offset used when reading from header
-  // Create Header via memcopying into packet using nlength and nOp 
-  memcpy(buff + headOffset, &nLength, lengthSize);
-  headOffset += lengthSize;
-  memcpy(buff + headOffset, &nOp, opSize);
-  return nwrite(sd, length, buff);
+static bool send_packet(jbod_conn_t *conn, uint32_t op, uint8_t *block) {
+  uint8_t headbuff[HEADER_LEN];
+  struct iovec iov[2] = {
+    { .iov_base = headbuff, .iov_len = HEADER_LEN },
+    { .iov_base = block, .iov_len = JBOD_BLOCK_SIZE },
+  };
+  //If cmd is a is the code for write system call the block follows the header
+  int iovcnt = (op >> 26) == JBOD_WRITE_BLOCK ? 2 : 1;
+
+  put_header(headbuff, HEADER_LEN + (iovcnt == 2 ? JBOD_BLOCK_SIZE : 0), op);
+  return nwritev(conn, iov, iovcnt);
 }
- 
- 
- 
-/* attempts to connect to server and set the global cli_sd variable to the
- * socket; returns true if successful and false if not. 
- * this function will be invoked by tester to connect to the server at given ip and port.
- * you will not call it in mdadm.c
-*/
-bool jbod_connect(const char *ip, uint16_t port) {
+
+
+
+/* opens a socket connected to the server at |ip| and |port|; returns -1 on failure */
+static int open_socket(const char *ip, uint16_t port) {
   //Create socket
-  cli_sd = socket(PF_INET, SOCK_STREAM, 0);
+  int sd = socket(PF_INET, SOCK_STREAM, 0);
  
   //If client socket descriptor = -1 return false as its unable to establish a connection
-  if(cli_sd == -1)
-    return false;
+  if(sd == -1)
+    return -1;
  
   // Setting up the IP address (covered in lecture)
   struct sockaddr_in ipv4_addr;
   ipv4_addr.sin_family = AF_INET;
   ipv4_addr.sin_port = htons(port);
  
-  //If unable to convert address
-  if(inet_aton(ip, &ipv4_addr.sin_addr) == 0){
-    return false;
+  //If unable to convert address or to connect
+  if(inet_aton(ip, &ipv4_addr.sin_addr) == 0 ||
+     connect(sd, (const struct sockaddr *)&ipv4_addr, sizeof(ipv4_addr)) == -1){
+    close(sd);
+    return -1;
   }
- 
-  // Connect socket
-  if(connect(cli_sd, (const struct sockaddr *)&ipv4_addr, sizeof(ipv4_addr)) == -1){
-    //If unable to connect
-    return false;
-  }else{
-  //If Connection successful
-    return true;
+  //Pipelined requests are small writes sent back to back, do not let Nagle's algorithm hold them back
+  int enable = nodelay ? 1 : 0;
+  setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  return sd;
+}
+
+/* resets the request tracking of |conn| around socket |sd| */
+static void init_conn(jbod_conn_t *conn, int sd) {
+  conn->sd = sd;
+  conn->pending_head = 0;
+  conn->pending_count = 0;
+  conn->pending_bytes = 0;
+  conn->submitted_seq = 0;
+  conn->completed_seq = 0;
+  conn->spill_off = 0;
+  conn->spill_len = 0;
+  memset(&conn->stats, 0, sizeof(conn->stats));
+}
+
+jbod_conn_t *jbod_conn_open(const char *ip, uint16_t port) {
+  jbod_conn_t *conn = malloc(sizeof(jbod_conn_t));
+  if(conn == NULL){
+    return NULL;
   }
+  int sd = open_socket(ip, port);
+  if(sd == -1){
+    free(conn);
+    return NULL;
+  }
+  init_conn(conn, sd);
+  return conn;
+}
+
+void jbod_conn_close(jbod_conn_t *conn) {
+  // Replies still in flight are lost with the connection
+  close(conn->sd);
+  free(conn);
+}
+
+jbod_conn_t *jbod_default_conn(void) {
+  return &default_conn;
+}
+
+void jbod_set_nodelay(bool enabled) {
+  nodelay = enabled;
+}
+
+void jbod_conn_get_stats(jbod_conn_t *conn, jbod_net_stats_t *stats) {
+  *stats = conn->stats;
+}
+
+/* attempts to connect to server and set the global cli_sd variable to the
+ * socket; returns true if successful and false if not. 
+ * this function will be invoked by tester to connect to the server at given ip and port.
+ * you will not call it in mdadm.c
+*/
+bool jbod_connect(const char *ip, uint16_t port) {
+  cli_sd = open_socket(ip, port);
+  init_conn(&default_conn, cli_sd);
+  return cli_sd != -1;
 }
  
 /* disconnects from the server and resets cli_sd */
@@ -180,28 +314,321 @@ void jbod_disconnect(void) {
   close(cli_sd);
   //Mark as closed
   cli_sd = -1;
+  // Replies still in flight are lost with the connection
+  init_conn(&default_conn, -1);
 }
- 
-/* sends the JBOD operation to the server (use the send_packet function) and receives 
-(use the recv_packet function) and processes the response. 
- 
+
+/* reads the reply to the batch |p| (format in net.h). Returns the result of the batch
+in |result|: 0 if every operation succeeded, -1 otherwise. The header is read first to
+learn how many operations ran, then one readv lands their return values in a local array
+and their blocks in the callers' buffers. */
+static bool recv_batch(jbod_conn_t *conn, pending_t *p, int *result) {
+  uint8_t headbuff[HEADER_LEN];
+  struct iovec iov[2 * JBOD_MAX_BATCH];
+  uint16_t returns[JBOD_MAX_BATCH];
+  uint32_t nOp;
+  uint16_t nReturn;
+  int iovcnt = 0;
+
+  //Reply header, the low bits of op tell how many operations the server ran
+  iov[0].iov_base = headbuff;
+  iov[0].iov_len = HEADER_LEN;
+  if(nreadv(conn, iov, 1) == false){
+    return false;
+  }
+  memcpy(&nOp, headbuff + lengthSize, opSize);
+  memcpy(&nReturn, headbuff + lengthSize + opSize, retSize);
+  int executed = ntohl(nOp) & JBOD_BATCH_COUNT_MASK;
+  if(executed > p->count){
+    return false;
+  }
+
+  //Per operation return value, followed by the block for reads
+  for(int i = 0; i < executed; i++){
+    iov[iovcnt].iov_base = &returns[i];
+    iov[iovcnt].iov_len = retSize;
+    iovcnt++;
+    if(returns_block(p->ops[i])){
+      iov[iovcnt].iov_base = p->blocks[i];
+      iov[iovcnt].iov_len = JBOD_BLOCK_SIZE;
+      iovcnt++;
+    }
+  }
+  if(iovcnt > 0 && nreadv(conn, iov, iovcnt) == false){
+    return false;
+  }
+  *result = (ntohs(nReturn) == 0 && executed == p->count) ? 0 : -1;
+  for(int i = 0; i < executed; i++){
+    if(ntohs(returns[i]) != 0){
+      *result = -1;
+    }
+  }
+  return true;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* counts the round trip time |ns| of a request in the histogram of |conn| */
+static void record_rtt(jbod_conn_t *conn, uint64_t ns) {
+  uint64_t us = ns / 1000;
+  int bucket = us < 2 ? 0 : 63 - __builtin_clzll(us);
+  conn->stats.rtt_ns += ns;
+  conn->stats.rtt_hist[bucket < JBOD_RTT_BUCKETS ? bucket : JBOD_RTT_BUCKETS - 1] += 1;
+}
+
+/* counts the operations of a request that has been sent */
+static void count_ops(jbod_conn_t *conn, const uint32_t *ops, int n) {
+  for(int i = 0; i < n; i++){
+    uint32_t cmd = ops[i] >> 26;
+    if(cmd < JBOD_NUM_CMDS){
+      conn->stats.op_counts[cmd] += 1;
+    }
+  }
+  conn->stats.ops += n;
+  conn->stats.requests += 1;
+}
+
+/* reads the reply to the oldest request in flight, if |wait| is false only when it has
+already started to arrive. Returns 1 if a reply was read, 0 if none was available and
+-1 on failure. */
+int jbod_conn_complete(jbod_conn_t *conn, bool wait) {
+  if(conn->pending_count == 0){
+    return 0;
+  }
+  //A reply that started in the spill buffer is ready to be read
+  if(!wait && conn->spill_len == 0){
+    struct pollfd pfd = { .fd = conn->sd, .events = POLLIN };
+    conn->stats.syscalls += 1;
+    if(poll(&pfd, 1, 0) <= 0){
+      return 0;
+    }
+  }
+
+  pending_t *p = &conn->pending[conn->pending_head];
+  int result;
+  bool ok;
+  if(p->count == 0){
+    uint32_t op;
+    uint16_t ret;
+    ok = recv_packet(conn, p->ops[0], &op, &ret, p->blocks[0]);
+    result = ret;
+  }else{
+    ok = recv_batch(conn, p, &result);
+  }
+  if(!ok){
+    result = -1;
+  }else{
+    uint64_t done_ns = now_ns();
+    record_rtt(conn, done_ns - p->sent_ns);
+    //A batch is traced with the disk and block of its first operation
+    uint32_t op = p->count == 0 ? p->ops[0] : (JBOD_BATCH << 26) | (p->ops[0] & 0x03ffffff);
+    trace_event_at(TRACE_NET, op, 0, p->count == 0 ? 1 : p->count, p->sent_ns, done_ns, TRACE_NO_CACHE, result);
+  }
+  if(result != 0 && p->ret != NULL){
+    *p->ret = result;
+  }
+
+  conn->pending_head = (conn->pending_head + 1) % JBOD_MAX_PENDING;
+  conn->pending_count -= 1;
+  conn->pending_bytes -= p->reply_len;
+  conn->completed_seq += 1;
+  return ok ? 1 : -1;
+}
+
+/* makes room for a request expecting |reply_len| bytes back by reading replies, so that
+neither the pending table nor the socket buffers can fill up. */
+static bool reserve_pending(jbod_conn_t *conn, int reply_len) {
+  while(conn->pending_count == JBOD_MAX_PENDING ||
+        (conn->pending_count > 0 && conn->pending_bytes + reply_len > JBOD_MAX_PENDING_BYTES)){
+    if(jbod_conn_complete(conn, true) == -1){
+      return false;
+    }
+  }
+  return true;
+}
+
+/* records a request that has been sent, starting at |sent_ns|, and returns its table entry */
+static pending_t *push_pending(jbod_conn_t *conn, int count, int reply_len, int *ret, uint64_t sent_ns) {
+  pending_t *p = &conn->pending[(conn->pending_head + conn->pending_count) % JBOD_MAX_PENDING];
+  p->count = count;
+  p->ret = ret;
+  p->reply_len = reply_len;
+  conn->pending_count += 1;
+  conn->pending_bytes += reply_len;
+  conn->submitted_seq += 1;
+  p->sent_ns = sent_ns;
+  return p;
+}
+
+/* sends the JBOD operation to the server without waiting for the reply. The reply is read
+by jbod_conn_complete or jbod_conn_wait, which stores a block into |block| and a
+nonzero return value into |ret|. return: 0 means success, -1 means failure.
+*/
+int jbod_conn_submit(jbod_conn_t *conn, uint32_t op, uint8_t *block, int *ret) {
+  int reply_len = HEADER_LEN + (returns_block(op) ? JBOD_BLOCK_SIZE : 0);
+  if(reserve_pending(conn, reply_len) == false){
+    return -1;
+  }
+  //The clock starts before the send, the reply can be in before writev returns
+  uint64_t sent_ns = now_ns();
+  // Send the JBOD operation to the server
+  if(send_packet(conn, op, block) == false){
+    return -1;
+  }
+  count_ops(conn, &op, 1);
+  pending_t *p = push_pending(conn, 0, reply_len, ret, sent_ns);
+  p->ops[0] = op;
+  p->blocks[0] = block;
+  return 0;
+}
+
+/* sends the |n| operations in |ops| to the server in one batch packet (format in net.h)
+without waiting for the reply, see jbod_conn_submit. blocks[i] holds the data to write for
+a JBOD_WRITE_BLOCK and receives the data of a JBOD_READ_BLOCK or JBOD_SIGN_BLOCK.
+return: 0 means success, -1 means failure.
+*/
+int jbod_conn_submit_batch(jbod_conn_t *conn, const uint32_t *ops, uint8_t **blocks, int n, int *ret) {
+  uint8_t headbuff[HEADER_LEN];
+  uint32_t nOps[JBOD_MAX_BATCH]; // Network ops
+  struct iovec iov[1 + 2 * JBOD_MAX_BATCH];
+  int iovcnt = 1;
+  int length = HEADER_LEN;
+  int reply_len = HEADER_LEN;
+
+  if(n <= 0 || n > JBOD_MAX_BATCH){
+    return -1;
+  }
+
+  //Each operation, followed by its block if it is a write, sent from the caller's buffer
+  for(int i = 0; i < n; i++){
+    nOps[i] = htonl(ops[i]);
+    iov[iovcnt].iov_base = &nOps[i];
+    iov[iovcnt].iov_len = opSize;
+    iovcnt++;
+    length += opSize;
+    if((ops[i] >> 26) == JBOD_WRITE_BLOCK){
+      iov[iovcnt].iov_base = blocks[i];
+      iov[iovcnt].iov_len = JBOD_BLOCK_SIZE;
+      iovcnt++;
+      length += JBOD_BLOCK_SIZE;
+    }
+    reply_len += retSize + (returns_block(ops[i]) ? JBOD_BLOCK_SIZE : 0);
+  }
+  if(reserve_pending(conn, reply_len) == false){
+    return -1;
+  }
+
+  //Header carrying the batch command and the number of operations
+  put_header(headbuff, length, (JBOD_BATCH << 26) | n);
+  iov[0].iov_base = headbuff;
+  iov[0].iov_len = HEADER_LEN;
+  uint64_t sent_ns = now_ns();
+  if(nwritev(conn, iov, iovcnt) == false){
+    return -1;
+  }
+  count_ops(conn, ops, n);
+
+  pending_t *p = push_pending(conn, n, reply_len, ret, sent_ns);
+  memcpy(p->ops, ops, n * sizeof(uint32_t));
+  memcpy(p->blocks, blocks, n * sizeof(uint8_t *));
+  return 0;
+}
+
+/* number of requests sent so far; a request is answered once jbod_conn_completed()
+has reached the value this returned right after it was submitted. */
+uint32_t jbod_conn_submitted(jbod_conn_t *conn) {
+  return conn->submitted_seq;
+}
+
+/* number of requests whose reply has been read */
+uint32_t jbod_conn_completed(jbod_conn_t *conn) {
+  return conn->completed_seq;
+}
+
+/* reads replies until the first |seq| requests have been answered.
+return: 0 means success, -1 means failure.
+*/
+int jbod_conn_wait(jbod_conn_t *conn, uint32_t seq) {
+  int rc = 0;
+  //Keep going after a failure so that no reply is left pointing at the caller's buffers
+  while((int32_t)(conn->completed_seq - seq) < 0){
+    if(jbod_conn_complete(conn, true) == -1){
+      rc = -1;
+    }
+  }
+  return rc;
+}
+
+/* sends the JBOD operation to the server and waits for its reply, after the replies to any
+requests already in flight.
+
 The meaning of each parameter is the same as in the original jbod_operation function. 
 return: 0 means success, -1 means failure.
 */
-int jbod_client_operation(uint32_t op, uint8_t *block) {
-  uint16_t ret; //Input  for recv_packet function
- 
-  // Send the JBOD operation to the server
-  if(send_packet(cli_sd, op, block) == false){
-    //if unable to send packet
+int jbod_conn_operation(jbod_conn_t *conn, uint32_t op, uint8_t *block) {
+  int ret = 0;
+  if(jbod_conn_submit(conn, op, block, &ret) == -1){
     return -1;
   }
- 
-  //If unable to recieve packet (response) return -1
-  if(recv_packet(cli_sd, &op, &ret, block) == false){
+  if(jbod_conn_wait(conn, conn->submitted_seq) == -1){
     return -1;
   }
-  else{
-    return ret;
+  return ret;
+}
+
+/* sends the |n| operations in |ops| to the server in one batch packet and waits for all
+of their results, see jbod_conn_submit_batch.
+return: 0 means every operation succeeded, -1 means failure.
+*/
+int jbod_conn_operation_batch(jbod_conn_t *conn, const uint32_t *ops, uint8_t **blocks, int n) {
+  int ret = 0;
+  if(jbod_conn_submit_batch(conn, ops, blocks, n, &ret) == -1){
+    return -1;
   }
-}
\ No newline at end of file
+  if(jbod_conn_wait(conn, conn->submitted_seq) == -1){
+    return -1;
+  }
+  return ret == 0 ? 0 : -1;
+}
+
+/* The jbod_client_* functions work on the connection opened by jbod_connect. */
+
+int jbod_client_operation(uint32_t op, uint8_t *block) {
+  return jbod_conn_operation(&default_conn, op, block);
+}
+
+int jbod_client_operation_batch(const uint32_t *ops, uint8_t **blocks, int n) {
+  return jbod_conn_operation_batch(&default_conn, ops, blocks, n);
+}
+
+int jbod_client_submit(uint32_t op, uint8_t *block, int *ret) {
+  return jbod_conn_submit(&default_conn, op, block, ret);
+}
+
+int jbod_client_submit_batch(const uint32_t *ops, uint8_t **blocks, int n, int *ret) {
+  return jbod_conn_submit_batch(&default_conn, ops, blocks, n, ret);
+}
+
+int jbod_client_complete(bool wait) {
+  return jbod_conn_complete(&default_conn, wait);
+}
+
+uint32_t jbod_client_submitted(void) {
+  return jbod_conn_submitted(&default_conn);
+}
+
+uint32_t jbod_client_completed(void) {
+  return jbod_conn_completed(&default_conn);
+}
+
+int jbod_client_wait(uint32_t seq) {
+  return jbod_conn_wait(&default_conn, seq);
+}
+
+void jbod_client_get_stats(jbod_net_stats_t *stats) {
+  jbod_conn_get_stats(&default_conn, stats);
+}
@@ -3,13 +3,111 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "jbod.h"
 
 #define HEADER_LEN (sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint16_t))
 #define JBOD_SERVER "127.0.0.1"
 #define JBOD_PORT 3333
 
+/* Batched requests. A batch carries up to JBOD_MAX_BATCH operations in one
+ * packet; the command field of its header op is JBOD_BATCH and the low bits
+ * hold the number of operations. The request payload is, per operation, the
+ * 4-byte op followed by the block for JBOD_WRITE_BLOCK. The server runs the
+ * operations in order and stops at the first one that fails. The reply header
+ * carries the number of operations run in the low bits of op and a nonzero
+ * return if one failed; its payload is, per operation run, the 2-byte return
+ * followed by the block for JBOD_READ_BLOCK and JBOD_SIGN_BLOCK. Only servers
+ * built from server.c understand batches. */
+#define JBOD_BATCH 0x3f
+#define JBOD_BATCH_COUNT_MASK 0xff
+#define JBOD_MAX_BATCH 64
+
+/* Pipelining. Up to JBOD_MAX_PENDING requests, with at most
+ * JBOD_MAX_PENDING_BYTES of replies, can be in flight; submitting more first
+ * reads the oldest replies. */
+#define JBOD_MAX_PENDING 128
+#define JBOD_MAX_PENDING_BYTES 65536
+
 int jbod_client_operation(uint32_t op, uint8_t *block);
+
+/* Sends an operation without waiting for its reply. Once the reply is read
+ * (jbod_client_complete/jbod_client_wait) a returned block is stored into
+ * |block| and, if the operation failed, its return value into |*ret|.
+ * Returns 0 on success and -1 on failure. */
+int jbod_client_submit(uint32_t op, uint8_t *block, int *ret);
+
+/* Batch version of jbod_client_submit, |*ret| is set to -1 if an operation fails. */
+int jbod_client_submit_batch(const uint32_t *ops, uint8_t **blocks, int n, int *ret);
+
+/* Reads the reply to the oldest request in flight. Without |wait| only if it
+ * has started to arrive. Returns 1 if a reply was read, 0 if none and -1 on
+ * failure. */
+int jbod_client_complete(bool wait);
+
+/* Number of requests sent and answered so far. */
+uint32_t jbod_client_submitted(void);
+uint32_t jbod_client_completed(void);
+
+/* Reads replies until the first |seq| requests are answered. Returns 0 on
+ * success and -1 on failure. */
+int jbod_client_wait(uint32_t seq);
+
+/* Sends |n| operations in a single batch. blocks[i] is the block for ops[i]
+ * as in jbod_client_operation. Returns 0 if every operation succeeded and -1
+ * otherwise. */
+int jbod_client_operation_batch(const uint32_t *ops, uint8_t **blocks, int n);
 bool jbod_connect(const char *ip, uint16_t port);
 void jbod_disconnect(void);
 
+/* Round trip time histogram buckets: bucket 0 counts requests answered in
+ * under 2 us, bucket i those answered in 2^i to 2^(i+1) us, and the last
+ * bucket everything slower. */
+#define JBOD_RTT_BUCKETS 24
+
+/* Transport counters of a connection, reset when it is opened. The round trip
+ * time of a request runs from when it was sent until its reply is read, so it
+ * includes the time spent behind earlier pipelined requests. */
+typedef struct {
+  uint64_t ops;            /* operations sent, each operation of a batch counts */
+  uint64_t op_counts[JBOD_NUM_CMDS]; /* operations sent per command */
+  uint64_t requests;       /* packets sent, a batch is one */
+  uint64_t syscalls;       /* readv, writev and poll calls */
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t rtt_ns;         /* round trip times of the answered requests, added up */
+  uint64_t rtt_hist[JBOD_RTT_BUCKETS];
+} jbod_net_stats_t;
+
+void jbod_client_get_stats(jbod_net_stats_t *stats);
+
+/* Selects TCP_NODELAY for the connections opened from now on. On by default:
+ * pipelined and batched requests are small writes that Nagle's algorithm would
+ * hold back until the previous reply is acknowledged. */
+void jbod_set_nodelay(bool enabled);
+
+/* Connections. The jbod_client_* functions above use the connection opened
+ * by jbod_connect; the jbod_conn_* functions below do the same on a
+ * connection of their own, so that several can be open at once. A connection
+ * must only be used by one thread at a time. */
+typedef struct jbod_conn jbod_conn_t;
+
+/* Connects to the server at |ip| and |port|. Returns NULL on failure. */
+jbod_conn_t *jbod_conn_open(const char *ip, uint16_t port);
+
+/* Closes |conn|; replies still in flight are dropped. */
+void jbod_conn_close(jbod_conn_t *conn);
+
+/* Returns the connection the jbod_client_* functions use. */
+jbod_conn_t *jbod_default_conn(void);
+
+int jbod_conn_operation(jbod_conn_t *conn, uint32_t op, uint8_t *block);
+int jbod_conn_operation_batch(jbod_conn_t *conn, const uint32_t *ops, uint8_t **blocks, int n);
+int jbod_conn_submit(jbod_conn_t *conn, uint32_t op, uint8_t *block, int *ret);
+int jbod_conn_submit_batch(jbod_conn_t *conn, const uint32_t *ops, uint8_t **blocks, int n, int *ret);
+int jbod_conn_complete(jbod_conn_t *conn, bool wait);
+uint32_t jbod_conn_submitted(jbod_conn_t *conn);
+uint32_t jbod_conn_completed(jbod_conn_t *conn);
+int jbod_conn_wait(jbod_conn_t *conn, uint32_t seq);
+void jbod_conn_get_stats(jbod_conn_t *conn, jbod_net_stats_t *stats);
+
 #endif
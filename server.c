@@ -0,0 +1,645 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+
+#include "jbod.h"
+#include "net.h"
+#include "util.h"
+#include "tester.h"
+#include "image.h"
+#include "trace.h"
+
+#define SERVER_ARGUMENTS "hp:vnd:s:t:"
+#define USAGE                                               \
+  "USAGE: server [-h] [-p port] [-v] [-n] [-d dir] [-s sync_ms] [-t trace]\n" \
+  "\n"                                                      \
+  "where:\n"                                                \
+  "    -h - help mode (display this message)\n"             \
+  "    -p - port to listen on (default 3333)\n"             \
+  "    -v - log every operation to stderr\n"                \
+  "    -n - leave Nagle's algorithm on (no TCP_NODELAY)\n"   \
+  "    -d - keep the disks in image files diskNN.img in dir, created\n" \
+  "         empty if missing, instead of in memory\n"        \
+  "    -s - sync written blocks to the images every sync_ms\n" \
+  "         milliseconds, 0 before every reply (default 1000)\n" \
+  "    -t - record every operation in the binary trace file trace,\n" \
+  "         see trace_decode\n"                                \
+  "\n"                                                      \
+  "Serves any number of clients at once from one epoll loop. Every client\n" \
+  "sees the JBOD as if it had it to itself: it mounts and unmounts it and\n" \
+  "moves its own head, the server seeks back to it before its reads and\n" \
+  "writes when another client moved the real head.\n"
+
+//Largest request the server accepts, a full batch of writes.
+#define MAX_PACKET_LEN (HEADER_LEN + JBOD_MAX_BATCH * (sizeof(uint32_t) + JBOD_BLOCK_SIZE))
+
+//Largest reply to one request, a full batch of reads.
+#define MAX_REPLY_LEN (HEADER_LEN + JBOD_MAX_BATCH * (sizeof(uint16_t) + JBOD_BLOCK_SIZE))
+
+//A client stops being read while this many reply bytes wait to be sent to it.
+#define MAX_PENDING_OUT (64 * MAX_REPLY_LEN)
+
+#define MAX_EVENTS 64
+
+//One client connection. Requests are read into |in| until a whole packet is
+//there, replies are queued in |out| until the socket takes them.
+typedef struct conn {
+  int fd;
+  struct sockaddr_in addr;
+  uint8_t in[MAX_PACKET_LEN];
+  int in_len;
+  uint8_t *out;
+  int out_len;
+  int out_sent;
+  int out_cap;
+  uint32_t events;      //events the connection is registered for in epoll
+  bool mounted;         //the client mounted the JBOD
+  int disk;             //the client's head, valid while mounted
+  int block;            //JBOD_NUM_BLOCKS_PER_DISK past the last block of a disk
+  uint64_t ops;         //operations run for the client
+  uint64_t cost;        //JBOD cost of those operations, seeks back to its head included
+  struct conn *prev, *next;
+} conn_t;
+
+static volatile sig_atomic_t shutting_down = 0;
+static int epfd = -1;
+static conn_t *conns = NULL;
+
+//The real head of the JBOD. Unknown after a failed operation or an unknown command.
+static int head_disk, head_block;
+static bool head_known = false;
+static int mounts = 0;          //clients that have the JBOD mounted
+static uint64_t restores = 0;   //seeks run to bring the head back to a client
+
+/* jbod.o keeps its cost counter to itself and only prints it to stderr, so
+ * read it by pointing stderr at a memory stream for the duration of the call. */
+static uint64_t jbod_cost(void) {
+  static char text[64];
+  static FILE *mem = NULL;
+  unsigned long long cost = 0;
+
+  if (mem == NULL) {
+    mem = fmemopen(text, sizeof(text), "w");
+    if (mem == NULL)
+      err(1, "fmemopen failed");
+  }
+  FILE *saved = stderr;
+  rewind(mem);
+  stderr = mem;
+  jbod_print_cost();
+  fflush(mem);
+  stderr = saved;
+  sscanf(text, "Cost: %llu", &cost);
+  return cost;
+}
+
+//Returns true if the reply to |op| carries a block.
+static bool returns_block(uint32_t op) {
+  uint32_t cmd = op >> 26;
+  return cmd == JBOD_READ_BLOCK || cmd == JBOD_SIGN_BLOCK;
+}
+
+//Writes a packet header with the given fields into |buf|.
+static void put_header(uint8_t *buf, uint16_t length, uint32_t op, uint16_t ret) {
+  uint16_t nLength = htons(length);
+  uint32_t nOp = htonl(op);
+  uint16_t nReturn = htons(ret);
+  memcpy(buf, &nLength, sizeof(nLength));
+  memcpy(buf + sizeof(nLength), &nOp, sizeof(nOp));
+  memcpy(buf + sizeof(nLength) + sizeof(nOp), &nReturn, sizeof(nReturn));
+}
+
+//Runs |op| on the JBOD and returns its result.
+static int jbod_run(uint32_t op, uint8_t *block) {
+  int ret = jbod_operation(op, block);
+  if (ret != 0)
+    head_known = false;
+  return ret;
+}
+
+//Moves the real head to the head of |c| if another client moved it, so that the
+//next read or write lands where |c| expects. Returns false if a seek failed.
+static bool restore_head(conn_t *c) {
+  if (!head_known || head_disk != c->disk) {
+    restores += 1;
+    if (jbod_run((JBOD_SEEK_TO_DISK << 26) | (c->disk << 22), NULL) != 0)
+      return false;
+    head_disk = c->disk;
+    head_block = 0;
+    head_known = true;
+  }
+  //A head past the last block can not be sought to, the read or write fails anyway
+  if (head_block != c->block && c->block < JBOD_NUM_BLOCKS_PER_DISK) {
+    restores += 1;
+    if (jbod_run((JBOD_SEEK_TO_BLOCK << 26) | c->block, NULL) != 0)
+      return false;
+    head_block = c->block;
+  }
+  return true;
+}
+
+//Runs one operation of client |c|. Mounting and unmounting are counted per
+//client: the JBOD is mounted by the first client that mounts it and unmounted
+//when the last one unmounts. A client can only use the JBOD while it has it
+//mounted, and only ever sees its own head.
+static int run_op(conn_t *c, uint32_t op, uint8_t *block) {
+  uint32_t cmd = op >> 26;
+  int ret = -1;
+
+  if (cmd == JBOD_MOUNT) {
+    if (c->mounted)
+      return -1;
+    if (mounts == 0) {
+      if (jbod_run(op, block) != 0)
+        return -1;
+      head_disk = head_block = 0;
+      head_known = true;
+    }
+    mounts += 1;
+    c->mounted = true;
+    c->disk = c->block = 0;
+    return 0;
+  }
+  if (!c->mounted)
+    return -1;
+  switch (cmd) {
+    case JBOD_UNMOUNT:
+      if (mounts == 1 && jbod_run(op, block) != 0)
+        return -1;
+      mounts -= 1;
+      c->mounted = false;
+      if (mounts == 0) {
+        head_known = false;
+        if (image_enabled() && image_sync() == -1)
+          warn("syncing the disk images failed");
+      }
+      return 0;
+    case JBOD_SEEK_TO_DISK:
+      ret = jbod_run(op, block);
+      if (ret == 0) {
+        c->disk = head_disk = (op >> 22) & 0xf;
+        c->block = head_block = 0;
+        head_known = true;
+      }
+      return ret;
+    case JBOD_SEEK_TO_BLOCK:
+      //Only the disk has to be the client's, the block is set right here
+      if (!head_known || head_disk != c->disk) {
+        restores += 1;
+        if (jbod_run((JBOD_SEEK_TO_DISK << 26) | (c->disk << 22), NULL) != 0)
+          return -1;
+        head_disk = c->disk;
+        head_known = true;
+      }
+      ret = jbod_run(op, block);
+      if (ret == 0)
+        c->block = head_block = op & 0xff;
+      return ret;
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+      if (!restore_head(c))
+        return -1;
+      ret = jbod_run(op, block);
+      if (ret == 0 && image_enabled()) {
+        //The JBOD only checks the operation and charges for it, the data is in the images
+        if (cmd == JBOD_READ_BLOCK)
+          memcpy(block, image_block(c->disk, c->block), JBOD_BLOCK_SIZE);
+        else if (image_write(c->disk, c->block, block) == -1)
+          ret = -1;
+      }
+      if (ret == 0)
+        head_block = c->block += 1;
+      return ret;
+    case JBOD_SIGN_BLOCK:
+      //Signing names the block in the opcode and leaves the head alone
+      ret = jbod_run(op, block);
+      if (ret == 0 && image_enabled()) {
+        int disk = (op >> 22) & 0xf, blk = op & 0xff;
+        memset(block, 0, JBOD_BLOCK_SIZE);
+        snprintf((char *)block, JBOD_BLOCK_SIZE, "SIG(disk,block) %2d %3d : %s\n", disk, blk,
+                 sha1_sig((uint8_t *)image_block(disk, blk), JBOD_BLOCK_SIZE));
+      }
+      return ret;
+    default:
+      return jbod_run(op, block);
+  }
+}
+
+//Makes room for |len| more reply bytes of |c| and returns where they go, or NULL
+//if memory ran out.
+static uint8_t *reserve(conn_t *c, int len) {
+  if (c->out_len + len > c->out_cap) {
+    int cap = c->out_cap ? c->out_cap : MAX_REPLY_LEN;
+    while (cap < c->out_len + len)
+      cap *= 2;
+    uint8_t *out = realloc(c->out, cap);
+    if (out == NULL)
+      return NULL;
+    c->out = out;
+    c->out_cap = cap;
+  }
+  uint8_t *buf = c->out + c->out_len;
+  c->out_len += len;
+  return buf;
+}
+
+//Runs a single operation and queues its reply. |payload| holds the block of a write,
+//a write packet without a whole block is invalid.
+static bool handle_single(conn_t *c, uint32_t op, uint8_t *payload, int payload_len) {
+  if ((op >> 26) == JBOD_WRITE_BLOCK && payload_len < JBOD_BLOCK_SIZE) {
+    return false;
+  }
+  uint8_t *reply = reserve(c, HEADER_LEN + JBOD_BLOCK_SIZE);
+  if (reply == NULL) {
+    return false;
+  }
+  uint8_t *block = reply + HEADER_LEN;
+  uint16_t length = HEADER_LEN;
+
+  if ((op >> 26) == JBOD_WRITE_BLOCK) {
+    memcpy(block, payload, JBOD_BLOCK_SIZE);
+  }
+  uint64_t start = trace_enabled() ? trace_now() : 0;
+  int ret = run_op(c, op, block);
+  trace_event(TRACE_SERVER, op, c->fd, 1, start, TRACE_NO_CACHE, ret);
+  debug_log("client %d: cmd id = %d [disk id = %d block id = %d], result = %d",
+            c->fd, op >> 26, (op >> 22) & 0xf, op & 0xff, ret);
+  c->ops += 1;
+  if (returns_block(op)) {
+    length += JBOD_BLOCK_SIZE;
+  }
+  put_header(reply, length, op, (uint16_t)ret);
+  //Give back the space of the block the reply does not carry
+  c->out_len -= HEADER_LEN + JBOD_BLOCK_SIZE - length;
+  return true;
+}
+
+//Runs the operations of a batch in order and queues all their results in one
+//reply. Execution stops at the first failing operation, see net.h.
+static bool handle_batch(conn_t *c, uint32_t op, uint8_t *payload, int payload_len) {
+  int count = op & JBOD_BATCH_COUNT_MASK;
+  int offset = 0;
+  int executed = 0;
+  bool failed = false;
+
+  if (count > JBOD_MAX_BATCH) {
+    return false;
+  }
+  uint8_t *reply = reserve(c, MAX_REPLY_LEN);
+  if (reply == NULL) {
+    return false;
+  }
+  int length = HEADER_LEN;
+  for (int i = 0; i < count && !failed; i++) {
+    uint32_t nOp, subOp;
+    uint8_t block[JBOD_BLOCK_SIZE];
+
+    if (offset + (int)sizeof(nOp) > payload_len) {
+      return false;
+    }
+    memcpy(&nOp, payload + offset, sizeof(nOp));
+    offset += sizeof(nOp);
+    subOp = ntohl(nOp);
+    if ((subOp >> 26) == JBOD_WRITE_BLOCK) {
+      if (offset + JBOD_BLOCK_SIZE > payload_len) {
+        return false;
+      }
+      memcpy(block, payload + offset, JBOD_BLOCK_SIZE);
+      offset += JBOD_BLOCK_SIZE;
+    }
+
+    uint64_t start = trace_enabled() ? trace_now() : 0;
+    int ret = run_op(c, subOp, block);
+    trace_event(TRACE_SERVER, subOp, c->fd, 1, start, TRACE_NO_CACHE, ret);
+    debug_log("client %d: batched cmd id = %d [disk id = %d block id = %d], result = %d",
+              c->fd, subOp >> 26, (subOp >> 22) & 0xf, subOp & 0xff, ret);
+    c->ops += 1;
+    uint16_t nReturn = htons((uint16_t)ret);
+    memcpy(reply + length, &nReturn, sizeof(nReturn));
+    length += sizeof(nReturn);
+    if (returns_block(subOp)) {
+      memcpy(reply + length, block, JBOD_BLOCK_SIZE);
+      length += JBOD_BLOCK_SIZE;
+    }
+    executed += 1;
+    failed = (ret != 0);
+  }
+  put_header(reply, length, (JBOD_BATCH << 26) | executed, failed ? 1 : 0);
+  c->out_len -= MAX_REPLY_LEN - length;
+  return true;
+}
+
+//Runs the whole requests in the input buffer of |c|, while its replies fit.
+//Returns false if the client sent an invalid packet or memory ran out.
+static bool handle_requests(conn_t *c) {
+  int offset = 0;
+  bool ok = true;
+
+  while (ok && c->out_len - c->out_sent < MAX_PENDING_OUT && c->in_len - offset >= HEADER_LEN) {
+    uint8_t *packet = c->in + offset;
+    uint16_t nLength;
+    uint32_t nOp;
+
+    memcpy(&nLength, packet, sizeof(nLength));
+    memcpy(&nOp, packet + sizeof(nLength), sizeof(nOp));
+    uint16_t length = ntohs(nLength);
+    uint32_t op = ntohl(nOp);
+
+    if (length < HEADER_LEN || length > MAX_PACKET_LEN) {
+      fprintf(stderr, "received invalid packet length from client\n");
+      return false;
+    }
+    if (c->in_len - offset < length) {
+      break;
+    }
+    //The cost of a request is what the JBOD charged while running it
+    uint64_t cost = jbod_cost();
+    if ((op >> 26) == JBOD_BATCH) {
+      ok = handle_batch(c, op, packet + HEADER_LEN, length - HEADER_LEN);
+    } else {
+      ok = handle_single(c, op, packet + HEADER_LEN, length - HEADER_LEN);
+    }
+    c->cost += jbod_cost() - cost;
+    offset += length;
+  }
+  memmove(c->in, c->in + offset, c->in_len - offset);
+  c->in_len -= offset;
+  return ok;
+}
+
+//Registers |c| in epoll for reading while it has room for replies, and for
+//writing while it has replies queued.
+static void update_events(conn_t *c) {
+  uint32_t events = 0;
+  if (c->out_len - c->out_sent < MAX_PENDING_OUT)
+    events |= EPOLLIN;
+  if (c->out_sent < c->out_len)
+    events |= EPOLLOUT;
+  if (events != c->events) {
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+  }
+}
+
+//Sends as much of the queued replies of |c| as the socket takes. Returns false
+//if the connection failed.
+static bool flush_replies(conn_t *c) {
+  while (c->out_sent < c->out_len) {
+    int n = write(c->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    c->out_sent += n;
+  }
+  c->out_len = c->out_sent = 0;
+  return true;
+}
+
+//Reads what arrived from |c|. Returns false if the client closed the connection
+//or it failed.
+static bool read_requests(conn_t *c) {
+  while (c->in_len < MAX_PACKET_LEN) {
+    int n = read(c->fd, c->in + c->in_len, MAX_PACKET_LEN - c->in_len);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "reading from client failed: %s\n", strerror(errno));
+      return false;
+    }
+    if (n == 0) {
+      fprintf(stderr, "client closed connection\n");
+      return false;
+    }
+    c->in_len += n;
+    //A short read means the socket is drained
+    if (c->in_len < MAX_PACKET_LEN)
+      return true;
+  }
+  return true;
+}
+
+//Closes the connection of |c|. A client that leaves with the JBOD mounted
+//unmounts it.
+static void close_conn(conn_t *c) {
+  if (c->mounted)
+    run_op(c, JBOD_UNMOUNT << 26, NULL);
+  fprintf(stderr, "closing connection to %s port %d (%llu ops, cost %llu)\n",
+          inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port),
+          (unsigned long long)c->ops, (unsigned long long)c->cost);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    conns = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+  free(c->out);
+  free(c);
+}
+
+//Accepts the clients waiting on the listening socket |sd|.
+static void accept_clients(int sd, int nodelay) {
+  while (1) {
+    struct sockaddr_in caddr;
+    socklen_t clen = sizeof(caddr);
+    int cli = accept4(sd, (struct sockaddr *)&caddr, &clen, SOCK_NONBLOCK);
+    if (cli == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        warn("accept failed");
+      return;
+    }
+    conn_t *c = calloc(1, sizeof(conn_t));
+    if (c == NULL) {
+      warnx("out of memory, dropping client");
+      close(cli);
+      continue;
+    }
+    c->fd = cli;
+    c->addr = caddr;
+    c->events = EPOLLIN;
+    struct epoll_event ev = { .events = c->events, .data.ptr = c };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, cli, &ev) == -1) {
+      warn("epoll_ctl failed");
+      close(cli);
+      free(c);
+      continue;
+    }
+    c->next = conns;
+    if (conns)
+      conns->prev = c;
+    conns = c;
+    fprintf(stderr, "new client connection from %s port %d\n",
+            inet_ntoa(caddr.sin_addr), ntohs(caddr.sin_port));
+    //Replies to pipelined requests go out one after another, do not hold them back for ACKs
+    setsockopt(cli, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  }
+}
+
+//Handles the epoll events |events| of client |c|.
+static void handle_events(conn_t *c, uint32_t events) {
+  bool ok = true;
+
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+    ok = read_requests(c);
+  //Requests held back while replies were queued go on once these are sent
+  while (ok) {
+    int in_len = c->in_len;
+    ok = handle_requests(c);
+    if (ok && !flush_replies(c)) {
+      fprintf(stderr, "writing to client failed: %s\n", strerror(errno));
+      ok = false;
+    }
+    if (c->out_len > 0 || c->in_len == in_len)
+      break;
+  }
+  if (!ok) {
+    close_conn(c);
+    return;
+  }
+  update_events(c);
+}
+
+static void signal_handler(int signo) {
+  shutting_down = 1;
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+  uint16_t port = JBOD_PORT;
+  int nodelay = 1;
+  const char *image_dir = NULL;
+  int sync_ms = 1000;
+  const char *trace_path = NULL;
+
+  while ((ch = getopt(argc, argv, SERVER_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'v':
+        enable_debug_log();
+        break;
+      case 'n':
+        nodelay = 0;
+        break;
+      case 'd':
+        image_dir = optarg;
+        break;
+      case 's':
+        sync_ms = atoi(optarg);
+        break;
+      case 't':
+        trace_path = optarg;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  //Stop on Ctrl-C and report the cost, without SA_RESTART so epoll_wait() returns.
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = signal_handler;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  //A client that vanishes with replies queued must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  jbod_initialize_drives_contents();
+  if (image_dir != NULL) {
+    if (image_open(image_dir, sync_ms) == -1)
+      err(1, "Failed to open the disk images in %s", image_dir);
+    fprintf(stderr, "disks kept in images in %s, synced every %d ms\n", image_dir, sync_ms);
+  }
+
+  if (trace_path != NULL && trace_open(trace_path) == -1)
+    err(1, "Failed to open the trace %s", trace_path);
+
+  int sd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (sd == -1)
+    err(1, "Failed to create a socket");
+  int enable = 1;
+  if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1)
+    err(1, "setsockopt failed");
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    err(1, "bind failed");
+  if (listen(sd, SOMAXCONN) == -1)
+    err(1, "listen failed");
+
+  epfd = epoll_create1(0);
+  if (epfd == -1)
+    err(1, "epoll_create1 failed");
+  //The listening socket is the event without a connection
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, sd, &ev) == -1)
+    err(1, "epoll_ctl failed");
+  fprintf(stderr, "JBOD server listening on port %d...\n", port);
+
+  while (!shutting_down) {
+    struct epoll_event events[MAX_EVENTS];
+    //Wake up when written blocks are due to be synced
+    int n = epoll_wait(epfd, events, MAX_EVENTS, image_sync_timeout());
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      err(1, "epoll_wait failed");
+    }
+    if (image_sync_timeout() == 0 && image_sync() == -1)
+      warn("syncing the disk images failed");
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == NULL)
+        accept_clients(sd, nodelay);
+      else
+        handle_events(events[i].data.ptr, events[i].events);
+    }
+  }
+
+  fprintf(stderr, "shutting down JBOD server...\n");
+  while (conns)
+    close_conn(conns);
+  close(epfd);
+  close(sd);
+  fprintf(stderr, "%llu seeks run to restore client heads\n", (unsigned long long)restores);
+  if (image_enabled()) {
+    uint32_t syncs, pages;
+    image_close();
+    image_get_stats(&syncs, &pages);
+    fprintf(stderr, "%u syncs wrote %u pages to the disk images\n", syncs, pages);
+  }
+  if (trace_path != NULL && trace_close() == -1)
+    warn("writing the trace %s failed", trace_path);
+  jbod_print_cost();
+  return 0;
+}
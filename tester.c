@@ -10,6 +10,8 @@
 #include <fcntl.h>
 #include <err.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "cache.h"
 #include "jbod.h"
@@ -17,20 +19,71 @@
 #include "util.h"
 #include "tester.h"
 #include "net.h"
+#include "trace.h"
+#include "workload.h"
 
-#define TESTER_ARGUMENTS "hw:s:"
+#define TESTER_ARGUMENTS "hw:s:p:S:A:EX:P:L:FbBa:r:nT:J:j:t:"
 #define USAGE                                               \
-  "USAGE: test [-h] [-w workload-file] [-s cache_size] \n"  \
+  "USAGE: test [-h] [-w workload-file] [-s cache_size] [-p policy] [-S shards] [-A ways] [-E] [-X name] [-P snapshot] [-L stripe_unit] [-F] [-b] [-B] [-a depth] [-r blocks] [-n] [-T clients] [-J file] [-j file] [-t trace] \n"  \
   "\n"                                                      \
   "where:\n"                                                \
   "    -h - help mode (display this message)\n"             \
+  "    -w - workload file to run, text or binary (see workload_convert),\n" \
+  "         - for the standard input\n"                      \
+  "    -p - cache replacement policy: lru (default), clock, 2q or arc\n" \
+  "    -S - use the concurrent cache split into shards shards (CLOCK, ignores -p)\n" \
+  "    -A - use the set-associative cache with ways ways per set (LRU, ignores -p)\n" \
+  "    -E - use the extent cache, runs of consecutive blocks (LRU, ignores -p)\n" \
+  "    -X - use the cache in shared memory segment name, shared with other testers\n" \
+  "    -P - load the cache from snapshot if it exists and save it there at the end\n" \
+  "    -L - stripe the volume over the disks in chunks of stripe_unit bytes\n" \
+  "    -F - keep the layout in a label: format a striped volume that has none, if\n" \
+  "         its last block is empty, and mount a labelled one with its own layout\n" \
+  "    -b - write-back mode (writes stay in the cache until evicted or flushed)\n" \
+  "    -B - send the operations of each request in one batch (needs ./server)\n" \
+  "    -a - submit reads and writes asynchronously, keeping up to depth in flight\n" \
+  "    -r - read ahead up to blocks blocks on sequential reads (needs the cache)\n" \
+  "    -n - leave Nagle's algorithm on (no TCP_NODELAY) on the server connection\n" \
+  "    -T - benchmark mode: replay the reads and writes of the workload from clients\n" \
+  "         concurrent connections and report throughput and latency percentiles\n" \
+  "    -J - with -T, also write the benchmark report as JSON to file (- for stdout)\n" \
+  "    -j - write the runtime statistics (mdadm_get_stats) as JSON to file\n" \
+  "    -t - record every read, write and round trip in the binary trace file\n" \
+  "         trace, see trace_decode\n"                        \
   "\n"                                                      \
 
-int run_workload(char *workload, int cache_size);
+int run_workload(char *workload, int cache_size, cache_policy_t policy);
+int run_benchmark(char *workload, int cache_size, cache_policy_t policy);
+
+//Asynchronous requests kept in flight by run_workload, 0 runs the workload synchronously.
+static int async_depth = 0;
+//Largest readahead window, 0 when readahead is off.
+static int readahead = 0;
+//Shards of the concurrent cache, 0 for the regular cache.
+static int cache_shards = 0;
+//Ways per set of the set-associative cache, 0 for the regular cache.
+static int cache_ways = 0;
+//Use the extent cache instead of the regular cache.
+static bool cache_extents = false;
+//Shared memory segment of the shared cache, NULL for a private cache.
+static const char *cache_segment = NULL;
+//Cache snapshot file, NULL when the cache starts cold and is not saved.
+static const char *snapshot = NULL;
+//Concurrent clients of the benchmark mode, 0 runs the workload normally.
+static int bench_clients = 0;
+//File the benchmark report is written to as JSON, NULL for none.
+static const char *bench_json = NULL;
+//Options of the handles the benchmark clients open, set along with the global ones.
+static mdadm_opts_t bench_opts;
+//File the runtime statistics are written to as JSON, NULL for none.
+static const char *stats_json = NULL;
+//Binary trace file, NULL when not tracing.
+static const char *trace_path = NULL;
 
 int main(int argc, char *argv[])
 {
   int ch, cache_size = 0;
+  int policy = CACHE_POLICY_LRU;
   char *workload = NULL;
 
   while ((ch = getopt(argc, argv, TESTER_ARGUMENTS)) != -1) {
@@ -44,6 +97,70 @@ int main(int argc, char *argv[])
       case 'w':
         workload = optarg;
         break;
+      case 'b':
+        mdadm_set_write_back(true);
+        bench_opts.write_back = true;
+        break;
+      case 'B':
+        mdadm_set_batching(true);
+        bench_opts.batching = true;
+        break;
+      case 'a':
+        async_depth = atoi(optarg);
+        break;
+      case 'r':
+        readahead = atoi(optarg);
+        mdadm_set_readahead(readahead);
+        bench_opts.readahead = readahead;
+        break;
+      case 'S':
+        cache_shards = atoi(optarg);
+        break;
+      case 'A':
+        cache_ways = atoi(optarg);
+        break;
+      case 'E':
+        cache_extents = true;
+        break;
+      case 'X':
+        cache_segment = optarg;
+        break;
+      case 'P':
+        snapshot = optarg;
+        break;
+      case 'L':
+        if (mdadm_set_stripe_unit(atoi(optarg)) == -1)
+          errx(1, "Invalid stripe unit %s, aborting.", optarg);
+        bench_opts.stripe_unit = atoi(optarg);
+        break;
+      case 'F':
+        mdadm_set_layout_label(true);
+        bench_opts.layout_label = true;
+        break;
+      case 'n':
+        jbod_set_nodelay(false);
+        break;
+      case 'T':
+        bench_clients = atoi(optarg);
+        if (bench_clients < 1)
+          errx(1, "Invalid number of clients %s, aborting.", optarg);
+        break;
+      case 'J':
+        bench_json = optarg;
+        break;
+      case 'j':
+        stats_json = optarg;
+        break;
+      case 't':
+        trace_path = optarg;
+        break;
+      case 'p':
+        policy = cache_policy_from_name(optarg);
+        if (policy == -1) {
+          fprintf(stderr, "Unknown cache policy (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
       default:
         fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
         return -1;
@@ -55,13 +172,23 @@ int main(int argc, char *argv[])
     return -1;
   }
 
-  if (!jbod_connect(JBOD_SERVER, JBOD_PORT))
-    return -1;
-  
-  run_workload(workload, cache_size);
-  jbod_disconnect();
+  if (trace_path && trace_open(trace_path) == -1)
+    err(1, "Cannot open the trace %s", trace_path);
 
-  return 0;
+  int rc = 0;
+  //The benchmark clients open their own connections
+  if (bench_clients) {
+    rc = run_benchmark(workload, cache_size, policy);
+  } else {
+    if (!jbod_connect(JBOD_SERVER, JBOD_PORT))
+      return -1;
+    run_workload(workload, cache_size, policy);
+    jbod_disconnect();
+  }
+
+  if (trace_path && trace_close() == -1)
+    err(1, "Cannot write the trace %s", trace_path);
+  return rc;
 }
 
 int equals(const char *s1, const char *s2) {
@@ -80,62 +207,503 @@ static uint32_t encode_op(jbod_cmd_t cmd, int disk_num, int block_num) {
   return op;
 }
 
-int run_workload(char *workload, int cache_size) {
-  char line[256], cmd[32];
-  uint8_t buf[MAX_IO_SIZE];
-  uint32_t addr, len, ch;
-  int rc;
-
-  memset(buf, 0, MAX_IO_SIZE);
+//Completion callback of the asynchronous requests, |arg| holds the workload line number.
+static void async_done(int result, void *arg) {
+  if (result == -1)
+    errx(1, "tester failed when processing the command on line %d", (int)(intptr_t)arg);
+}
 
-  FILE *f = fopen(workload, "r");
+//Opens the workload file, - for the standard input.
+static FILE *open_workload(const char *workload) {
+  FILE *f = strcmp(workload, "-") == 0 ? stdin : fopen(workload, "r");
   if (!f)
     err(1, "Cannot open workload file %s", workload);
+  return f;
+}
+
+//Creates the cache selected on the command line, if |cache_size| is not 0, and loads the
+//snapshot into it. Returns the number of blocks loaded from the snapshot.
+static int create_cache(int cache_size, cache_policy_t policy) {
+  int rc, loaded = 0;
 
   if (cache_size) {
-    rc = cache_create(cache_size);
+    if (cache_shards)
+      rc = cache_create_sharded(cache_size, cache_shards);
+    else if (cache_ways)
+      rc = cache_create_assoc(cache_size, cache_ways, false);
+    else if (cache_segment)
+      rc = cache_create_shared(cache_segment, cache_size);
+    else if (cache_extents)
+      rc = cache_create_extent(cache_size);
+    else
+      rc = cache_create_ex(cache_size, policy);
     if (rc != 1)
       errx(1, "Failed to create cache.");
+    //A missing snapshot is a cold start, a broken one is an error
+    if (snapshot && access(snapshot, F_OK) == 0 && (loaded = cache_load(snapshot)) == -1)
+      errx(1, "Failed to load the cache snapshot %s.", snapshot);
   }
+  return loaded;
+}
 
-  int line_num = 0;
-  while (fgets(line, 256, f)) {
-    ++line_num;
-    line[strlen(line)-1] = '\0';
-    if (equals(line, "MOUNT")) {
+//Runs one command of the workload, a WORKLOAD_* command. |line_num| identifies it to the
+//completion callback of asynchronous requests.
+static int run_command(int cmd, uint32_t addr, uint32_t len, uint32_t ch, int line_num) {
+  static uint8_t buf[MAX_IO_SIZE];
+  static uint8_t async_buf[MAX_IO_SIZE];
+  int rc;
+
+  //Commands other than reads and writes see every earlier request completed
+  if (async_depth && cmd != WORKLOAD_READ && cmd != WORKLOAD_WRITE)
+    mdadm_wait(0);
+  switch (cmd) {
+    case WORKLOAD_MOUNT:
       rc = mdadm_mount();
-    } else if (equals(line, "UNMOUNT")) {
+      break;
+    case WORKLOAD_UNMOUNT:
       rc = mdadm_unmount();
-    } else if (equals(line, "SIGNALL")) {
+      break;
+    case WORKLOAD_SIGNALL:
+      //Signatures are taken on the server, push out blocks held back by write-back first
+      if (mdadm_flush() == -1)
+        errx(1, "Failed to flush the cache on line %d, aborting.", line_num);
       for (int i = 0; i < JBOD_NUM_DISKS; ++i)
         for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j) {
           uint8_t b[JBOD_BLOCK_SIZE];
           jbod_client_operation(encode_op(JBOD_SIGN_BLOCK, i, j), b);
           fprintf(stdout, "%s", b);
         }
+      rc = 1;
+      break;
+    case WORKLOAD_READ:
+      //The data read is not checked, all asynchronous reads can share async_buf. It is
+      //filled whenever a read completes, so it cannot be the buffer writes are built in.
+      if (async_depth)
+        rc = mdadm_read_async(addr, len, async_buf, async_done, (void *)(intptr_t)line_num);
+      else
+        rc = mdadm_read(addr, len, buf);
+      break;
+    case WORKLOAD_WRITE:
+      if (len > MAX_IO_SIZE)
+        return -1;
+      memset(buf, ch, len);
+      if (async_depth)
+        rc = mdadm_write_async(addr, len, buf, async_done, (void *)(intptr_t)line_num);
+      else
+        rc = mdadm_write(addr, len, buf);
+      break;
+    default:
+      return -1;
+  }
+  if (rc != -1 && async_depth)
+    mdadm_wait(async_depth);
+  return rc;
+}
+
+//Runs a text workload, one command per line.
+static void run_text(FILE *f) {
+  char line[256], cmd[32];
+  uint32_t addr = 0, len = 0, ch = 0;
+  int command, line_num = 0;
+
+  while (fgets(line, 256, f)) {
+    ++line_num;
+    line[strlen(line)-1] = '\0';
+    if (equals(line, "MOUNT")) {
+      command = WORKLOAD_MOUNT;
+    } else if (equals(line, "UNMOUNT")) {
+      command = WORKLOAD_UNMOUNT;
+    } else if (equals(line, "SIGNALL")) {
+      command = WORKLOAD_SIGNALL;
     } else {
       if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
         errx(1, "Failed to parse command: [%s\n], aborting.", line);
-      if (equals(cmd, "READ")) {
-        rc = mdadm_read(addr, len, buf);
-      } else if (equals(cmd, "WRITE")) {
-        memset(buf, ch, len);
-        rc = mdadm_write(addr, len, buf);
-      } else {
+      if (equals(cmd, "READ"))
+        command = WORKLOAD_READ;
+      else if (equals(cmd, "WRITE"))
+        command = WORKLOAD_WRITE;
+      else
         errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
-      }
     }
-
-    if (rc == -1)
+    if (run_command(command, addr, len, ch, line_num) == -1)
       errx(1, "tester failed when processing command [%s] on line %d", line, line_num);
   }
-  fclose(f);
+}
+
+//Runs a binary workload straight from its mapping. Records are numbered from 1 in
+//error messages, like lines.
+static void run_binary(const workload_t *w) {
+  uint32_t next = 0;
+
+  for (uint64_t i = 0; i < w->header->records; i++) {
+    const workload_record_t *r = &w->records[i];
+    uint32_t addr = workload_addr(w, r, &next);
+    if (run_command(r->cmd, addr, r->len, r->fill, i + 1) == -1)
+      errx(1, "tester failed when processing record %llu (command %u, addr %u, len %u)",
+           (unsigned long long)i + 1, r->cmd, addr, r->len);
+  }
+}
 
+int run_workload(char *workload, int cache_size, cache_policy_t policy) {
+  workload_t w;
+  FILE *f = NULL;
+
+  int binary = workload_map(workload, &w);
+  if (binary == -1)
+    errx(1, "Cannot use the binary workload %s", workload);
+  if (!binary)
+    f = open_workload(workload);
+
+  int loaded = create_cache(cache_size, policy);
+
+  if (binary)
+    run_binary(&w);
+  else
+    run_text(f);
+  mdadm_wait(0);
+  if (binary)
+    workload_unmap(&w);
+  else if (f != stdin)
+    fclose(f);
+
+  int saved = 0;
+  if (cache_size && snapshot && (saved = cache_save(snapshot)) == -1)
+    errx(1, "Failed to save the cache snapshot %s.", snapshot);
   if (cache_size)
     cache_destroy();
 
   jbod_print_cost();
   cache_print_hit_rate();
 
+  uint32_t seeks_issued, seeks_avoided;
+  mdadm_get_seek_stats(&seeks_issued, &seeks_avoided);
+  fprintf(stderr, "Seeks: %u issued, %u avoided\n", seeks_issued, seeks_avoided);
+
+  if (readahead) {
+    uint32_t prefetched, used, wasted;
+    mdadm_get_readahead_stats(&prefetched, &used, &wasted);
+    fprintf(stderr, "Readahead: %u prefetched, %u used, %u wasted\n", prefetched, used, wasted);
+  }
+  if (mdadm_get_stripe_unit())
+    fprintf(stderr, "Layout: striped, %u-byte stripe unit\n", mdadm_get_stripe_unit());
+  if (snapshot) {
+    int validated, stale;
+    cache_get_validation_stats(&validated, &stale);
+    fprintf(stderr, "Snapshot: %d loaded, %d validated, %d stale, %d saved\n", loaded, validated, stale, saved);
+  }
+
+  jbod_net_stats_t net;
+  jbod_client_get_stats(&net);
+  fprintf(stderr, "Net: %llu ops, %.2f syscalls per op, %llu bytes sent, %llu received\n",
+          (unsigned long long)net.ops, net.ops ? (double)net.syscalls / net.ops : 0.0,
+          (unsigned long long)net.bytes_sent, (unsigned long long)net.bytes_received);
+
+  if (stats_json) {
+    mdadm_stats_t stats;
+    mdadm_get_stats(&stats);
+    FILE *json = fopen(stats_json, "w");
+    if (json == NULL || mdadm_write_stats_json(&stats, json) == -1)
+      err(1, "Cannot write the statistics to %s", stats_json);
+    fclose(json);
+  }
+
+  return 0;
+}
+
+//Benchmark mode
+//
+//The reads and writes of the workload are parsed up front, then every client replays all
+//of them on its own handle. MOUNT and UNMOUNT are left to mdadm_open and mdadm_close, and
+//SIGNALL is skipped: signatures are not comparable while clients overwrite each other.
+
+enum { BENCH_READ, BENCH_WRITE, BENCH_NUM_OPS };
+
+//One read or write of the workload.
+typedef struct {
+  uint8_t type;
+  uint8_t ch;       //byte a write fills its buffer with
+  uint16_t len;
+  uint32_t addr;
+  int line;
+} bench_op_t;
+
+//Latencies of the operations of one type, in nanoseconds.
+typedef struct {
+  uint64_t *ns;
+  int count;
+  int cap;
+  uint64_t bytes;
+} latencies_t;
+
+//An asynchronous request in flight, the argument of its completion callback.
+typedef struct bench_client bench_client_t;
+typedef struct {
+  bench_client_t *client;
+  const bench_op_t *op;
+  uint64_t start;
+} bench_request_t;
+
+struct bench_client {
+  pthread_t thread;
+  int id;
+  latencies_t lat[BENCH_NUM_OPS];
+  bench_request_t *requests;  //async_depth + 1 slots, reused in submission order
+};
+
+static bench_op_t *bench_ops;
+static int bench_num_ops;
+static pthread_barrier_t bench_start;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void record_latency(latencies_t *lat, uint64_t ns, uint32_t len) {
+  if (lat->count == lat->cap) {
+    lat->cap = lat->cap ? 2 * lat->cap : 1024;
+    lat->ns = realloc(lat->ns, lat->cap * sizeof(uint64_t));
+    if (lat->ns == NULL)
+      errx(1, "Out of memory recording latencies.");
+  }
+  lat->ns[lat->count++] = ns;
+  lat->bytes += len;
+}
+
+//Takes the reads and writes of the binary workload |w| into bench_ops.
+static void load_bench_binary(const workload_t *w) {
+  uint32_t next = 0;
+  uint64_t n = w->header->counts[WORKLOAD_READ] + w->header->counts[WORKLOAD_WRITE];
+
+  bench_ops = malloc((n ? n : 1) * sizeof(bench_op_t));
+  if (bench_ops == NULL)
+    errx(1, "Out of memory loading the workload.");
+  for (uint64_t i = 0; i < w->header->records; i++) {
+    const workload_record_t *r = &w->records[i];
+    if (r->cmd != WORKLOAD_READ && r->cmd != WORKLOAD_WRITE)
+      continue;
+    if (r->len > MAX_IO_SIZE || bench_num_ops == n)
+      errx(1, "Invalid record %llu, aborting.", (unsigned long long)i + 1);
+    bench_op_t *op = &bench_ops[bench_num_ops++];
+    op->type = r->cmd == WORKLOAD_READ ? BENCH_READ : BENCH_WRITE;
+    op->addr = workload_addr(w, r, &next);
+    op->len = r->len;
+    op->ch = r->fill;
+    op->line = i + 1;
+  }
+}
+
+//Reads the reads and writes of |workload| into bench_ops.
+static void load_bench_ops(const char *workload) {
+  char line[256], cmd[32];
+  uint32_t addr, len, ch;
+  int cap = 0, line_num = 0;
+  workload_t w;
+
+  int binary = workload_map(workload, &w);
+  if (binary == -1)
+    errx(1, "Cannot use the binary workload %s", workload);
+  if (binary) {
+    load_bench_binary(&w);
+    workload_unmap(&w);
+    return;
+  }
+  FILE *f = open_workload(workload);
+  while (fgets(line, 256, f)) {
+    ++line_num;
+    line[strlen(line)-1] = '\0';
+    if (equals(line, "MOUNT") || equals(line, "UNMOUNT") || equals(line, "SIGNALL"))
+      continue;
+    if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
+      errx(1, "Failed to parse command: [%s\n], aborting.", line);
+    if (!equals(cmd, "READ") && !equals(cmd, "WRITE"))
+      errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
+    if (len > MAX_IO_SIZE)
+      errx(1, "Request larger than %d bytes on line %d, aborting.", MAX_IO_SIZE, line_num);
+    if (bench_num_ops == cap) {
+      cap = cap ? 2 * cap : 1024;
+      bench_ops = realloc(bench_ops, cap * sizeof(bench_op_t));
+      if (bench_ops == NULL)
+        errx(1, "Out of memory loading the workload.");
+    }
+    bench_op_t *op = &bench_ops[bench_num_ops++];
+    op->type = equals(cmd, "READ") ? BENCH_READ : BENCH_WRITE;
+    op->addr = addr;
+    op->len = len;
+    op->ch = ch;
+    op->line = line_num;
+  }
+  if (f != stdin)
+    fclose(f);
+}
+
+//Completion callback of the asynchronous benchmark requests.
+static void bench_done(int result, void *arg) {
+  bench_request_t *req = arg;
+  if (result == -1)
+    errx(1, "client %d failed when processing the command on line %d", req->client->id, req->op->line);
+  record_latency(&req->client->lat[req->op->type], now_ns() - req->start, req->op->len);
+}
+
+//Replays bench_ops on a handle of its own.
+static void *bench_client(void *arg) {
+  bench_client_t *client = arg;
+  uint8_t buf[MAX_IO_SIZE];
+  static __thread uint8_t async_buf[MAX_IO_SIZE];
+
+  mdadm_ctx_t *ctx = mdadm_open(JBOD_SERVER, JBOD_PORT, &bench_opts);
+  if (ctx == NULL)
+    errx(1, "client %d failed to connect and mount", client->id);
+  pthread_barrier_wait(&bench_start);
+  for (int i = 0; i < bench_num_ops; i++) {
+    const bench_op_t *op = &bench_ops[i];
+    int rc;
+
+    if (op->type == BENCH_WRITE)
+      memset(buf, op->ch, op->len);
+    if (async_depth) {
+      bench_request_t *req = &client->requests[i % (async_depth + 1)];
+      req->client = client;
+      req->op = op;
+      req->start = now_ns();
+      if (op->type == BENCH_READ)
+        rc = mdadm_ctx_read_async(ctx, op->addr, op->len, async_buf, bench_done, req);
+      else
+        rc = mdadm_ctx_write_async(ctx, op->addr, op->len, buf, bench_done, req);
+      if (rc != -1)
+        mdadm_ctx_wait(ctx, async_depth);
+    } else {
+      uint64_t start = now_ns();
+      if (op->type == BENCH_READ)
+        rc = mdadm_ctx_read(ctx, op->addr, op->len, buf);
+      else
+        rc = mdadm_ctx_write(ctx, op->addr, op->len, buf);
+      if (rc != -1)
+        record_latency(&client->lat[op->type], now_ns() - start, op->len);
+    }
+    if (rc == -1)
+      errx(1, "client %d failed when processing the command on line %d", client->id, op->line);
+  }
+  mdadm_ctx_wait(ctx, 0);
+  if (mdadm_close(ctx) == -1)
+    errx(1, "client %d failed to unmount", client->id);
+  return NULL;
+}
+
+static int compare_ns(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+//Nearest-rank percentile |p| of the sorted latencies, in microseconds.
+static double percentile_us(const latencies_t *lat, double p) {
+  if (lat->count == 0)
+    return 0.0;
+  double exact = p / 100.0 * lat->count;
+  int rank = (int)exact;
+  if (rank < exact)
+    rank += 1;
+  return lat->ns[rank > 0 ? rank - 1 : 0] / 1e3;
+}
+
+//Appends the latencies of |from| to |to|.
+static void merge_latencies(latencies_t *to, const latencies_t *from) {
+  for (int i = 0; i < from->count; i++)
+    record_latency(to, from->ns[i], 0);
+  to->bytes += from->bytes;
+}
+
+static const double bench_percentiles[] = { 50, 90, 99, 99.9 };
+#define BENCH_NUM_PERCENTILES (sizeof(bench_percentiles) / sizeof(bench_percentiles[0]))
+
+//Prints the report of the latencies |lat| of every type and of all operations, taken
+//over |seconds|, on stderr and as JSON to bench_json.
+static void print_bench_report(latencies_t *lat, double seconds, int cache_size) {
+  static const char *names[BENCH_NUM_OPS + 1] = { "read", "write", "all" };
+  FILE *json = NULL;
+
+  fprintf(stderr, "Benchmark: %d clients, %d requests each, %.3f s\n", bench_clients, bench_num_ops, seconds);
+  fprintf(stderr, "%-6s %9s %11s %9s %9s %9s %9s %9s\n", "op", "count", "ops/s", "MB/s",
+          "p50 us", "p90 us", "p99 us", "p99.9 us");
+  if (bench_json) {
+    json = strcmp(bench_json, "-") == 0 ? stdout : fopen(bench_json, "w");
+    if (json == NULL)
+      err(1, "Cannot open %s", bench_json);
+    fprintf(json, "{\"workload_requests\": %d, \"clients\": %d, \"async_depth\": %d, \"cache_size\": %d, "
+            "\"seconds\": %.6f, \"ops\": {", bench_num_ops, bench_clients, async_depth, cache_size, seconds);
+  }
+  for (int type = 0; type <= BENCH_NUM_OPS; type++) {
+    latencies_t *l = &lat[type];
+    double ops = l->count / seconds, mb = l->bytes / seconds / 1e6;
+
+    qsort(l->ns, l->count, sizeof(uint64_t), compare_ns);
+    fprintf(stderr, "%-6s %9d %11.1f %9.3f", names[type], l->count, ops, mb);
+    for (int i = 0; i < BENCH_NUM_PERCENTILES; i++)
+      fprintf(stderr, " %9.1f", percentile_us(l, bench_percentiles[i]));
+    fprintf(stderr, "\n");
+    if (json) {
+      fprintf(json, "%s\"%s\": {\"count\": %d, \"bytes\": %llu, \"ops_per_sec\": %.3f, \"mb_per_sec\": %.6f",
+              type ? ", " : "", names[type], l->count, (unsigned long long)l->bytes, ops, mb);
+      fprintf(json, ", \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"p99_9_us\": %.3f}",
+              percentile_us(l, 50), percentile_us(l, 90), percentile_us(l, 99), percentile_us(l, 99.9));
+    }
+  }
+  if (json) {
+    fprintf(json, "}}\n");
+    if (json != stdout)
+      fclose(json);
+  }
+}
+
+int run_benchmark(char *workload, int cache_size, cache_policy_t policy) {
+  bench_client_t *clients = calloc(bench_clients, sizeof(bench_client_t));
+  latencies_t lat[BENCH_NUM_OPS + 1];
+
+  if (clients == NULL)
+    errx(1, "Out of memory starting the clients.");
+  load_bench_ops(workload);
+  create_cache(cache_size, policy);
+
+  pthread_barrier_init(&bench_start, NULL, bench_clients + 1);
+  for (int i = 0; i < bench_clients; i++) {
+    clients[i].id = i;
+    if (async_depth) {
+      clients[i].requests = calloc(async_depth + 1, sizeof(bench_request_t));
+      if (clients[i].requests == NULL)
+        errx(1, "Out of memory starting the clients.");
+    }
+    if (pthread_create(&clients[i].thread, NULL, bench_client, &clients[i]) != 0)
+      errx(1, "Failed to start client %d", i);
+  }
+  //The clock starts once every client is connected and mounted
+  pthread_barrier_wait(&bench_start);
+  uint64_t begin = now_ns();
+  for (int i = 0; i < bench_clients; i++)
+    pthread_join(clients[i].thread, NULL);
+  double seconds = (now_ns() - begin) / 1e9;
+  pthread_barrier_destroy(&bench_start);
+
+  if (cache_size && snapshot && cache_save(snapshot) == -1)
+    errx(1, "Failed to save the cache snapshot %s.", snapshot);
+  if (cache_size)
+    cache_destroy();
+
+  memset(lat, 0, sizeof(lat));
+  for (int i = 0; i < bench_clients; i++) {
+    for (int type = 0; type < BENCH_NUM_OPS; type++) {
+      merge_latencies(&lat[type], &clients[i].lat[type]);
+      merge_latencies(&lat[BENCH_NUM_OPS], &clients[i].lat[type]);
+      free(clients[i].lat[type].ns);
+    }
+    free(clients[i].requests);
+  }
+  print_bench_report(lat, seconds, cache_size);
+  cache_print_hit_rate();
+
+  for (int type = 0; type <= BENCH_NUM_OPS; type++)
+    free(lat[type].ns);
+  free(clients);
+  free(bench_ops);
   return 0;
 }
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/uio.h>
+
+#include "trace.h"
+
+//Records per ring, a power of two: 512 KiB per recording thread.
+#define RING_RECORDS 16384
+#define TRACE_MAX_THREADS 64
+//The flusher writes the rings out this often, or as soon as one is half full.
+#define FLUSH_MS 10
+
+//A single-producer single-consumer ring. Only its thread moves head and only the
+//flusher moves tail, each publishing with a release store, so neither takes a lock.
+typedef struct {
+  trace_record_t records[RING_RECORDS];
+  uint64_t head __attribute__((aligned(64)));
+  uint64_t dropped;
+  uint64_t tail __attribute__((aligned(64)));
+} ring_t;
+
+//Rings are kept for the life of the process and reused by the next trace.
+static ring_t *rings[TRACE_MAX_THREADS];
+static int num_rings = 0;
+static __thread ring_t *local_ring = NULL;
+static __thread uint16_t local_thread;
+static __thread bool no_ring = false;
+//Records of threads past TRACE_MAX_THREADS.
+static uint64_t lost = 0;
+
+static bool tracing = false;
+static int trace_fd = -1;
+static pthread_t flush_thread;
+//Never destroyed, a thread that saw the trace open may still post it after it closed.
+static sem_t wakeup;
+static bool wakeup_ready = false;
+static uint64_t start_ns;
+static uint64_t written;
+static bool write_failed;
+
+uint64_t trace_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Returns the ring of the calling thread, allocating it on its first record, or NULL
+//if there are too many threads or memory ran out.
+static ring_t *thread_ring(void) {
+  if(local_ring != NULL || no_ring) {
+    return local_ring;
+  }
+  int slot = __atomic_fetch_add(&num_rings, 1, __ATOMIC_RELAXED);
+  ring_t *ring = slot < TRACE_MAX_THREADS ? calloc(1, sizeof(ring_t)) : NULL;
+  if(ring == NULL) {
+    no_ring = true;
+    return NULL;
+  }
+  __atomic_store_n(&rings[slot], ring, __ATOMIC_RELEASE);
+  local_ring = ring;
+  local_thread = slot;
+  return ring;
+}
+
+//Writes the records |ring| holds to the file. Runs on the flusher, or once it stopped.
+static void flush_ring(ring_t *ring) {
+  uint64_t tail = ring->tail;
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if(head == tail) {
+    return;
+  }
+  //The records from tail to head, in two pieces when they wrap around the end of the ring
+  uint64_t first = tail % RING_RECORDS;
+  uint64_t count = head - tail;
+  uint64_t piece = count < RING_RECORDS - first ? count : RING_RECORDS - first;
+  struct iovec iov[2] = {
+    {.iov_base = ring->records + first, .iov_len = piece * sizeof(trace_record_t)},
+    {.iov_base = ring->records, .iov_len = (count - piece) * sizeof(trace_record_t)},
+  };
+  ssize_t len = count * sizeof(trace_record_t);
+  if(writev(trace_fd, iov, count > piece ? 2 : 1) != len) {
+    write_failed = true;
+  } else {
+    written += count;
+  }
+  __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+}
+
+static void flush_rings(void) {
+  int n = __atomic_load_n(&num_rings, __ATOMIC_RELAXED);
+  for(int i = 0; i < n && i < TRACE_MAX_THREADS; i++) {
+    ring_t *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+    if(ring != NULL) {
+      flush_ring(ring);
+    }
+  }
+}
+
+static void *flusher(void *arg) {
+  while(__atomic_load_n(&tracing, __ATOMIC_ACQUIRE)) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += FLUSH_MS * 1000000L;
+    if(ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec += 1;
+      ts.tv_nsec -= 1000000000L;
+    }
+    sem_timedwait(&wakeup, &ts);
+    flush_rings();
+  }
+  return NULL;
+}
+
+int trace_open(const char *path) {
+  if(tracing) {
+    return -1;
+  }
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(trace_fd == -1) {
+    return -1;
+  }
+  //Records start after the header, written for real by trace_close
+  trace_header_t header;
+  memset(&header, 0, sizeof(header));
+  if(write(trace_fd, &header, sizeof(header)) != sizeof(header) || (!wakeup_ready && sem_init(&wakeup, 0, 0) == -1)) {
+    close(trace_fd);
+    trace_fd = -1;
+    return -1;
+  }
+  wakeup_ready = true;
+  //Forget what the rings held from an earlier trace
+  for(int i = 0; i < num_rings && i < TRACE_MAX_THREADS; i++) {
+    if(rings[i] != NULL) {
+      rings[i]->tail = rings[i]->head;
+      rings[i]->dropped = 0;
+    }
+  }
+  lost = 0;
+  written = 0;
+  write_failed = false;
+  start_ns = trace_now();
+  __atomic_store_n(&tracing, true, __ATOMIC_RELEASE);
+  if(pthread_create(&flush_thread, NULL, flusher, NULL) != 0) {
+    tracing = false;
+    close(trace_fd);
+    trace_fd = -1;
+    return -1;
+  }
+  return 1;
+}
+
+int trace_close(void) {
+  if(!tracing) {
+    return -1;
+  }
+  __atomic_store_n(&tracing, false, __ATOMIC_RELEASE);
+  sem_post(&wakeup);
+  pthread_join(flush_thread, NULL);
+  flush_rings();
+
+  trace_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof(trace_record_t);
+  header.start_ns = start_ns;
+  header.records = written;
+  header.dropped = __atomic_load_n(&lost, __ATOMIC_RELAXED);
+  for(int i = 0; i < num_rings && i < TRACE_MAX_THREADS; i++) {
+    if(rings[i] != NULL) {
+      header.dropped += __atomic_load_n(&rings[i]->dropped, __ATOMIC_RELAXED);
+    }
+  }
+  if(pwrite(trace_fd, &header, sizeof(header), 0) != sizeof(header)) {
+    write_failed = true;
+  }
+  if(close(trace_fd) == -1) {
+    write_failed = true;
+  }
+  trace_fd = -1;
+  return write_failed ? -1 : 1;
+}
+
+bool trace_enabled(void) {
+  return __atomic_load_n(&tracing, __ATOMIC_RELAXED);
+}
+
+void trace_event_at(uint8_t kind, uint32_t op, uint32_t addr, uint32_t len, uint64_t start, uint64_t end, uint8_t outcome, int32_t result) {
+  if(!trace_enabled()) {
+    return;
+  }
+  ring_t *ring = thread_ring();
+  if(ring == NULL) {
+    __atomic_fetch_add(&lost, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  uint64_t head = ring->head;
+  uint64_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if(used == RING_RECORDS) {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+  trace_record_t *r = &ring->records[head % RING_RECORDS];
+  r->ts_ns = start;
+  r->latency_ns = end - start > UINT32_MAX ? UINT32_MAX : end - start;
+  r->op = op;
+  r->addr = addr;
+  r->len = len;
+  r->result = result;
+  r->thread = local_thread;
+  r->kind = kind;
+  r->outcome = outcome;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  //Wake the flusher early once, when the ring fills up to half
+  if(used + 1 == RING_RECORDS / 2) {
+    sem_post(&wakeup);
+  }
+}
+
+void trace_event(uint8_t kind, uint32_t op, uint32_t addr, uint32_t len, uint64_t start, uint8_t outcome, int32_t result) {
+  if(trace_enabled()) {
+    trace_event_at(kind, op, addr, len, start, trace_now(), outcome, result);
+  }
+}
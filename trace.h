@@ -0,0 +1,78 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Binary tracing
+ *
+ * Every thread that records an event gets its own ring of fixed-size binary
+ * records. Recording takes a clock read and a copy into the ring, with no
+ * lock and no syscall; a background thread writes the rings to the trace
+ * file. A record that finds its ring full is dropped and counted. The file
+ * is a trace_header_t followed by the records, in the order they were
+ * flushed; trace_decode turns it into text or a Chrome trace timeline. */
+
+#define TRACE_MAGIC "JBODTRC1"
+#define TRACE_VERSION 1
+
+/* What a record describes. */
+enum {
+  TRACE_READ = 1,   /* an mdadm read, addr and len are the request's */
+  TRACE_WRITE,      /* an mdadm write */
+  TRACE_NET,        /* a round trip to the server, len operations */
+  TRACE_SERVER,     /* an operation run by the server, addr is the client */
+};
+
+/* Whether the cache held the blocks of a read or write it was asked for. */
+enum {
+  TRACE_NO_CACHE = 0, /* the cache is off or was not asked */
+  TRACE_HIT,        /* every block */
+  TRACE_MISS,       /* none of them */
+  TRACE_PARTIAL,    /* some of them */
+};
+
+typedef struct {
+  uint64_t ts_ns;       /* start, CLOCK_MONOTONIC */
+  uint32_t latency_ns;
+  uint32_t op;          /* JBOD op: command, disk and block of the first block */
+  uint32_t addr;
+  uint32_t len;
+  int32_t result;
+  uint16_t thread;      /* ring the record came from, in the order threads started recording */
+  uint8_t kind;
+  uint8_t outcome;
+} trace_record_t;
+
+typedef struct {
+  char magic[8];        /* TRACE_MAGIC */
+  uint32_t version;
+  uint32_t record_size; /* sizeof(trace_record_t) */
+  uint64_t start_ns;    /* CLOCK_MONOTONIC when the trace was opened */
+  uint64_t records;     /* records written, filled in by trace_close */
+  uint64_t dropped;     /* records lost to full rings, filled in by trace_close */
+  uint64_t reserved;
+} trace_header_t;
+
+/* Starts recording to |path|, which is created or truncated. Return 1 on
+ * success and -1 on failure. */
+int trace_open(const char *path);
+
+/* Stops recording, writes what the rings hold and closes the file. Return 1
+ * on success and -1 if writing failed. */
+int trace_close(void);
+
+/* Returns true while a trace is open. */
+bool trace_enabled(void);
+
+/* Returns the CLOCK_MONOTONIC time in nanoseconds, to pass as |start_ns|. */
+uint64_t trace_now(void);
+
+/* Records an event that started at |start_ns| and ends now. Does nothing
+ * when no trace is open. */
+void trace_event(uint8_t kind, uint32_t op, uint32_t addr, uint32_t len, uint64_t start_ns, uint8_t outcome, int32_t result);
+
+/* Same as trace_event, for an event that ended at |end_ns|. */
+void trace_event_at(uint8_t kind, uint32_t op, uint32_t addr, uint32_t len, uint64_t start_ns, uint64_t end_ns, uint8_t outcome, int32_t result);
+
+#endif
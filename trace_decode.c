@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "jbod.h"
+#include "net.h"
+#include "trace.h"
+
+#define DECODE_ARGUMENTS "hjo:"
+#define USAGE                                                        \
+  "USAGE: trace_decode [-h] [-j] [-o file] trace...\n"               \
+  "\n"                                                               \
+  "where:\n"                                                         \
+  "    -h - help mode (display this message)\n"                      \
+  "    -j - write a Chrome trace (JSON) for chrome://tracing or\n"   \
+  "         ui.perfetto.dev instead of text\n"                       \
+  "    -o - write to file instead of stdout\n"                       \
+  "\n"                                                               \
+  "Decodes the binary traces written by tester -t and server -t. The records\n" \
+  "of all the traces are merged in time order; every trace becomes a process\n" \
+  "of the timeline and every recording thread one of its threads.\n"
+
+//A record and the trace it came from.
+typedef struct {
+  trace_record_t r;
+  int trace;
+} event_t;
+
+static const char *kind_names[] = { "?", "read", "write", "net", "server" };
+static const char *outcome_names[] = { "-", "hit", "miss", "partial" };
+static const char *command_names[JBOD_NUM_CMDS] = {
+  "MOUNT", "UNMOUNT", "SEEK_TO_DISK", "SEEK_TO_BLOCK", "READ_BLOCK", "WRITE_BLOCK", "SIGN_BLOCK",
+};
+
+static event_t *events = NULL;
+static size_t num_events = 0;
+
+static const char *kind_name(uint8_t kind) {
+  return kind < sizeof(kind_names) / sizeof(kind_names[0]) ? kind_names[kind] : "?";
+}
+
+static const char *outcome_name(uint8_t outcome) {
+  return outcome < sizeof(outcome_names) / sizeof(outcome_names[0]) ? outcome_names[outcome] : "?";
+}
+
+static const char *command_name(uint32_t op) {
+  uint32_t cmd = op >> 26;
+  if (cmd == JBOD_BATCH)
+    return "BATCH";
+  return cmd < JBOD_NUM_CMDS ? command_names[cmd] : "?";
+}
+
+//Appends the records of the trace at |path| to the events. Returns its start time.
+static uint64_t load_trace(const char *path, int trace) {
+  trace_header_t header;
+  struct stat st;
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL)
+    err(1, "Cannot open %s", path);
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+    errx(1, "%s is not a finished trace", path);
+  if (header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t))
+    errx(1, "%s is a trace of version %u, this decoder reads version %d", path, header.version, TRACE_VERSION);
+  if (fstat(fileno(f), &st) == -1)
+    err(1, "Cannot stat %s", path);
+  size_t count = (st.st_size - sizeof(header)) / sizeof(trace_record_t);
+  if (count != header.records)
+    warnx("%s: the header counts %llu records, the file holds %zu", path,
+          (unsigned long long)header.records, count);
+  if (header.dropped)
+    warnx("%s: %llu records were dropped, the rings were full", path, (unsigned long long)header.dropped);
+
+  events = realloc(events, (num_events + count) * sizeof(event_t));
+  if (events == NULL && num_events + count > 0)
+    err(1, "Out of memory");
+  for (size_t i = 0; i < count; i++) {
+    if (fread(&events[num_events].r, sizeof(trace_record_t), 1, f) != 1)
+      err(1, "Reading %s failed", path);
+    events[num_events++].trace = trace;
+  }
+  fclose(f);
+  return header.start_ns;
+}
+
+static int compare_events(const void *a, const void *b) {
+  const event_t *x = a, *y = b;
+  if (x->r.ts_ns != y->r.ts_ns)
+    return x->r.ts_ns < y->r.ts_ns ? -1 : 1;
+  if (x->trace != y->trace)
+    return x->trace - y->trace;
+  return x->r.thread - y->r.thread;
+}
+
+//Prints the name of the event of |r|: the request kind for mdadm, the command otherwise.
+static const char *event_name(const trace_record_t *r) {
+  return r->kind == TRACE_READ || r->kind == TRACE_WRITE ? kind_name(r->kind) : command_name(r->op);
+}
+
+static void write_text(FILE *out, uint64_t origin) {
+  fprintf(out, "%14s %5s %6s %-7s %-13s %4s %5s %8s %7s %12s %6s %s\n", "time_us", "trace", "thread",
+          "kind", "command", "disk", "block", "addr", "len", "latency_us", "result", "cache");
+  for (size_t i = 0; i < num_events; i++) {
+    const trace_record_t *r = &events[i].r;
+    fprintf(out, "%14.3f %5d %6u %-7s %-13s %4u %5u %8u %7u %12.3f %6d %s\n",
+            (r->ts_ns - origin) / 1e3, events[i].trace, r->thread, kind_name(r->kind),
+            command_name(r->op), (r->op >> 22) & 0xf, r->op & 0xff, r->addr, r->len,
+            r->latency_ns / 1e3, r->result, outcome_name(r->outcome));
+  }
+}
+
+//Writes the Chrome trace event format: one complete ("X") event per record, with
+//timestamps in microseconds, and the trace file names as process names.
+static void write_json(FILE *out, uint64_t origin, char **paths, int num_traces) {
+  fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  for (int i = 0; i < num_traces; i++)
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+            i + 1, paths[i]);
+  for (size_t i = 0; i < num_events; i++) {
+    const trace_record_t *r = &events[i].r;
+    fprintf(out, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+            "\"pid\": %d, \"tid\": %u, \"args\": {\"command\": \"%s\", \"disk\": %u, \"block\": %u, "
+            "\"addr\": %u, \"len\": %u, \"result\": %d, \"cache\": \"%s\"}}%s\n",
+            event_name(r), kind_name(r->kind), (r->ts_ns - origin) / 1e3, r->latency_ns / 1e3,
+            events[i].trace + 1, r->thread, command_name(r->op), (r->op >> 22) & 0xf, r->op & 0xff,
+            r->addr, r->len, r->result, outcome_name(r->outcome), i + 1 < num_events ? "," : "");
+  }
+  fprintf(out, "]}\n");
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+  bool json = false;
+  const char *output = NULL;
+
+  while ((ch = getopt(argc, argv, DECODE_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'j':
+        json = true;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (optind == argc) {
+    fprintf(stderr, USAGE);
+    return -1;
+  }
+
+  //The traces share CLOCK_MONOTONIC, time 0 is when the first of them was opened
+  uint64_t origin = UINT64_MAX;
+  for (int i = optind; i < argc; i++) {
+    uint64_t start = load_trace(argv[i], i - optind);
+    if (start < origin)
+      origin = start;
+  }
+  qsort(events, num_events, sizeof(event_t), compare_events);
+
+  FILE *out = output ? fopen(output, "w") : stdout;
+  if (out == NULL)
+    err(1, "Cannot open %s", output);
+  if (json)
+    write_json(out, origin, argv + optind, argc - optind);
+  else
+    write_text(out, origin);
+  if (out != stdout && fclose(out) != 0)
+    err(1, "Writing %s failed", output);
+  free(events);
+  return 0;
+}
@@ -1,5 +1,6 @@
 #include <err.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <stdarg.h>
 #include <fcntl.h>
 #include <stdint.h>
@@ -26,29 +27,79 @@ void debug_log(const char *fmt, ...) {
   if (!debug_log_enabled)
     return;
 
+  /* Format the line and its newline into one buffer, so each line costs a
+   * single write. Longer lines are cut. */
+  char line[512];
   va_list args;
   va_start(args, fmt);
-  vdprintf(debug_log_fd, fmt, args);
+  int len = vsnprintf(line, sizeof(line) - 1, fmt, args);
   va_end(args);
-  dprintf(debug_log_fd, "\n");
+  if (len < 0)
+    return;
+  if (len > (int)sizeof(line) - 2)
+    len = sizeof(line) - 2;
+  line[len] = '\n';
+  write(debug_log_fd, line, len + 1);
 }
 
 const char *sha1_sig(uint8_t *buf, uint32_t size) {
-  static char sig[80];
+  static char sig[SHA1_SIG_LEN];
+
+  return sha1_sig_r(buf, size, sig);
+}
+
+char *sha1_sig_r(const uint8_t *buf, uint32_t size, char *sig) {
   uint8_t obuf[20];
 
   SHA1(buf, size, obuf);
   for (int i = 0; i < 15; ++i) {
-    char *p = (char *)sig + i * 5;
+    char *p = sig + i * 5;
     sprintf(p, "0x%02x ", obuf[i]);
   }
   return sig;
 }
 
+/* xoshiro256** state of the seeded generator, all zero until set_rand_seed. */
+static uint64_t rand_state[4];
+static int rand_seeded = 0;
+
+static uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+void set_rand_seed(uint64_t seed) {
+  /* splitmix64 spreads the seed over the whole state */
+  for (int i = 0; i < 4; ++i) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    rand_state[i] = z ^ (z >> 31);
+  }
+  rand_seeded = 1;
+}
+
+static uint32_t seeded_rand(void) {
+  uint64_t *s = rand_state;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  return (uint32_t)(result >> 32);
+}
+
 uint32_t get_rand(uint32_t min, uint32_t max) {
   uint32_t v;
-  int rc = RAND_bytes((uint8_t *)&v, sizeof(v));
-  assert(rc);
+  if (rand_seeded) {
+    v = seeded_rand();
+  } else {
+    int rc = RAND_bytes((uint8_t *)&v, sizeof(v));
+    assert(rc);
+  }
 
   v = (uint32_t)(v/(UINT32_MAX/(max - min + 1))) + min;
   if (v == max+1)
@@ -8,6 +8,15 @@ void set_debug_logfile(const char *filename);
 void debug_log(const char *fmt, ...);
 
 const char *sha1_sig(uint8_t *buf, uint32_t size);
+
+/* Same as sha1_sig, but formats the signature into |sig|, which holds
+ * SHA1_SIG_LEN bytes, instead of a static buffer shared by all threads. */
+#define SHA1_SIG_LEN 80
+char *sha1_sig_r(const uint8_t *buf, uint32_t size, char *sig);
 uint32_t get_rand(uint32_t min, uint32_t max);
 
+/* Makes get_rand a reproducible generator seeded with |seed|, instead of
+ * drawing from RAND_bytes. */
+void set_rand_seed(uint64_t seed);
+
 #endif
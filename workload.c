@@ -0,0 +1,60 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "workload.h"
+
+int workload_map(const char *path, workload_t *w) {
+  struct stat st;
+  char magic[sizeof(w->header->magic)];
+
+  if(strcmp(path, "-") == 0) {
+    return 0;
+  }
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) {
+    return -1;
+  }
+  //Anything without the magic is left to the text parser
+  if(read(fd, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, WORKLOAD_MAGIC, sizeof(magic)) != 0) {
+    close(fd);
+    return 0;
+  }
+  if(fstat(fd, &st) == -1 || st.st_size < sizeof(workload_header_t)) {
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    return -1;
+  }
+  const workload_header_t *header = map;
+  if(header->version != WORKLOAD_VERSION ||
+     st.st_size != sizeof(workload_header_t) + header->records * sizeof(workload_record_t)) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+  //The records are read once, front to back
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  w->header = header;
+  w->records = (const workload_record_t *)(header + 1);
+  w->map_len = st.st_size;
+  return 1;
+}
+
+void workload_unmap(workload_t *w) {
+  if(w->header != NULL) {
+    munmap((void *)w->header, w->map_len);
+    w->header = NULL;
+    w->records = NULL;
+  }
+}
+
+uint32_t workload_addr(const workload_t *w, const workload_record_t *r, uint32_t *next) {
+  uint32_t addr = (w->header->flags & WORKLOAD_DELTA) ? *next + r->addr : r->addr;
+  *next = addr + r->len;
+  return addr;
+}
@@ -0,0 +1,68 @@
+#ifndef WORKLOAD_H_
+#define WORKLOAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Binary workloads
+ *
+ * The commands of a tester workload as fixed 8-byte records after a header
+ * that counts them, in host byte order. tester maps the file and runs the
+ * records in place. workload_convert writes them from the text format and
+ * back. */
+
+#define WORKLOAD_MAGIC "JBODWKL1"
+#define WORKLOAD_VERSION 1
+
+/* Flags of the header. With WORKLOAD_DELTA, the addr of a read or write is
+ * the signed distance from the end of the previous read or write (0 at the
+ * start), so sequential runs are all zeros and compress well. */
+#define WORKLOAD_DELTA 0x1
+
+/* Commands, in the order of the text format's keywords. */
+enum {
+  WORKLOAD_MOUNT,
+  WORKLOAD_UNMOUNT,
+  WORKLOAD_SIGNALL,
+  WORKLOAD_READ,
+  WORKLOAD_WRITE,
+  WORKLOAD_NUM_CMDS,
+};
+
+typedef struct {
+  uint32_t addr;    /* absolute, or the distance described under WORKLOAD_DELTA */
+  uint16_t len;
+  uint8_t cmd;
+  uint8_t fill;     /* byte a write fills its buffer with */
+} workload_record_t;
+
+typedef struct {
+  char magic[8];    /* WORKLOAD_MAGIC */
+  uint32_t version;
+  uint32_t flags;
+  uint64_t records;
+  uint64_t counts[WORKLOAD_NUM_CMDS]; /* records of each command */
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+} workload_header_t;
+
+/* A binary workload mapped into memory. */
+typedef struct {
+  const workload_header_t *header;
+  const workload_record_t *records;
+  size_t map_len;
+} workload_t;
+
+/* Maps the binary workload at |path|. Return 1 on success, 0 if |path| is not
+ * a binary workload (a text one, or - for the standard input) and -1 if it is
+ * one but cannot be used: unreadable, of another version or truncated. */
+int workload_map(const char *path, workload_t *w);
+
+/* Unmaps a workload mapped by workload_map. */
+void workload_unmap(workload_t *w);
+
+/* Returns the address of the read or write |r| of |w|. |next| holds the end
+ * of the previous read or write, it starts at 0 and is moved past |r|. */
+uint32_t workload_addr(const workload_t *w, const workload_record_t *r, uint32_t *next);
+
+#endif
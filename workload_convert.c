@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <stdbool.h>
+
+#include "tester.h"
+#include "workload.h"
+
+#define CONVERT_ARGUMENTS "hdxo:"
+#define USAGE                                                        \
+  "USAGE: workload_convert [-h] [-d] [-x] [-o file] [input]\n"       \
+  "\n"                                                               \
+  "where:\n"                                                         \
+  "    -h - help mode (display this message)\n"                      \
+  "    -d - delta-encode the addresses of reads and writes\n"        \
+  "    -x - convert a binary workload back to text\n"                \
+  "    -o - write to file (required for a binary workload, its header\n" \
+  "         is written last; text goes to stdout by default)\n"      \
+  "\n"                                                               \
+  "Converts a tester workload (input, or the standard input) to the binary\n" \
+  "format of workload.h, which tester -w runs without parsing it.\n"
+
+static const char *command_names[WORKLOAD_NUM_CMDS] = { "MOUNT", "UNMOUNT", "SIGNALL", "READ", "WRITE" };
+
+//Reads the text workload from |in| and writes it to |out| as records after |header|.
+static void to_binary(FILE *in, FILE *out, workload_header_t *header) {
+  char line[256], cmd[32];
+  uint32_t addr, len, ch, next = 0;
+  int line_num = 0;
+
+  while (fgets(line, sizeof(line), in)) {
+    ++line_num;
+    line[strcspn(line, "\n")] = '\0';
+    workload_record_t r = { .addr = 0, .len = 0, .cmd = WORKLOAD_NUM_CMDS, .fill = 0 };
+    for (int c = WORKLOAD_MOUNT; c <= WORKLOAD_SIGNALL; c++)
+      if (strcmp(line, command_names[c]) == 0)
+        r.cmd = c;
+    if (r.cmd == WORKLOAD_NUM_CMDS) {
+      if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
+        errx(1, "Failed to parse line %d: [%s], aborting.", line_num, line);
+      if (strcmp(cmd, "READ") == 0)
+        r.cmd = WORKLOAD_READ;
+      else if (strcmp(cmd, "WRITE") == 0)
+        r.cmd = WORKLOAD_WRITE;
+      else
+        errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
+      if (len > MAX_IO_SIZE || ch > 255)
+        errx(1, "Invalid request on line %d: [%s], aborting.", line_num, line);
+      r.addr = (header->flags & WORKLOAD_DELTA) ? addr - next : addr;
+      r.len = len;
+      r.fill = ch;
+      next = addr + len;
+      if (r.cmd == WORKLOAD_READ)
+        header->read_bytes += len;
+      else
+        header->write_bytes += len;
+    }
+    header->counts[r.cmd] += 1;
+    header->records += 1;
+    if (fwrite(&r, sizeof(r), 1, out) != 1)
+      err(1, "Writing the workload failed");
+  }
+}
+
+//Writes the records of the binary workload |w| to |out| as text.
+static void to_text(const workload_t *w, FILE *out) {
+  uint32_t next = 0;
+
+  for (uint64_t i = 0; i < w->header->records; i++) {
+    const workload_record_t *r = &w->records[i];
+    if (r->cmd >= WORKLOAD_NUM_CMDS)
+      errx(1, "Unknown command %u in record %llu, aborting.", r->cmd, (unsigned long long)i);
+    if (r->cmd == WORKLOAD_READ || r->cmd == WORKLOAD_WRITE)
+      fprintf(out, "%s %u %u %u\n", command_names[r->cmd], workload_addr(w, r, &next), r->len, r->fill);
+    else
+      fprintf(out, "%s\n", command_names[r->cmd]);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+  bool delta = false, text = false;
+  const char *output = NULL, *input = "-";
+
+  while ((ch = getopt(argc, argv, CONVERT_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'd':
+        delta = true;
+        break;
+      case 'x':
+        text = true;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (optind < argc)
+    input = argv[optind];
+  if (!text && output == NULL) {
+    fprintf(stderr, USAGE);
+    return -1;
+  }
+
+  if (text) {
+    workload_t w;
+    if (workload_map(input, &w) != 1)
+      errx(1, "%s is not a binary workload", input);
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (out == NULL)
+      err(1, "Cannot open %s", output);
+    to_text(&w, out);
+    if (out != stdout && fclose(out) != 0)
+      err(1, "Writing %s failed", output);
+    workload_unmap(&w);
+    return 0;
+  }
+
+  FILE *in = strcmp(input, "-") == 0 ? stdin : fopen(input, "r");
+  if (in == NULL)
+    err(1, "Cannot open %s", input);
+  FILE *out = fopen(output, "w");
+  if (out == NULL)
+    err(1, "Cannot open %s", output);
+  workload_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.version = WORKLOAD_VERSION;
+  header.flags = delta ? WORKLOAD_DELTA : 0;
+  //The header goes in first without its magic, so a failed conversion is not taken for a workload
+  if (fwrite(&header, sizeof(header), 1, out) != 1)
+    err(1, "Writing %s failed", output);
+  to_binary(in, out, &header);
+  memcpy(header.magic, WORKLOAD_MAGIC, sizeof(header.magic));
+  if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1 || fclose(out) != 0)
+    err(1, "Writing %s failed", output);
+  if (in != stdin)
+    fclose(in);
+  fprintf(stderr, "%llu records: %llu reads (%llu bytes), %llu writes (%llu bytes)\n",
+          (unsigned long long)header.records,
+          (unsigned long long)header.counts[WORKLOAD_READ], (unsigned long long)header.read_bytes,
+          (unsigned long long)header.counts[WORKLOAD_WRITE], (unsigned long long)header.write_bytes);
+  return 0;
+}
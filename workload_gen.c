@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <err.h>
+#include <stdbool.h>
+
+#include "jbod.h"
+#include "util.h"
+#include "tester.h"
+
+#define GEN_ARGUMENTS "hn:p:r:i:z:q:m:H:s:o:G"
+#define USAGE                                                        \
+  "USAGE: workload_gen [-h] [-n requests] [-p profile] [-r read_pct] [-i size] [-z skew]\n" \
+  "                    [-q run_length] [-m seq_pct] [-H start:length:pct] [-s seed] [-o file] [-G]\n" \
+  "\n"                                                               \
+  "where:\n"                                                         \
+  "    -h - help mode (display this message)\n"                      \
+  "    -n - number of reads and writes (default 100000)\n"           \
+  "    -p - address profile (default zipf):\n"                       \
+  "           uniform    - every block is as likely\n"               \
+  "           zipf       - block popularity follows a Zipf law of skew -z\n" \
+  "           sequential - runs of -q consecutive requests from uniform starts\n" \
+  "           mixed      - -m percent of the requests continue a run, the rest are zipf\n" \
+  "    -r - percentage of reads (default 70)\n"                      \
+  "    -i - request size in bytes, n or min-max drawn uniformly, at most 1024\n" \
+  "         (default 1-1024)\n"                                      \
+  "    -z - Zipf skew, 0 is uniform (default 0.99)\n"                \
+  "    -q - requests per sequential run (default 64)\n"              \
+  "    -m - percentage of sequential requests of the mixed profile (default 50)\n" \
+  "    -H - send pct percent of the requests uniformly to the length bytes\n" \
+  "         from start, can be given up to 8 times\n"                \
+  "    -s - seed, the same seed and options give the same workload\n" \
+  "         (default random, printed on stderr)\n"                   \
+  "    -o - write the workload to file instead of stdout\n"          \
+  "    -G - leave out the final SIGNALL\n"                           \
+  "\n"                                                               \
+  "Writes a workload for tester: MOUNT, the reads and writes, SIGNALL and\n" \
+  "UNMOUNT, one per line. Pipe it into tester -w - to run it directly.\n"
+
+#define VOLUME_SIZE (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK * JBOD_BLOCK_SIZE)
+#define NUM_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+#define MAX_HOTSPOTS 8
+
+typedef enum { PROFILE_UNIFORM, PROFILE_ZIPF, PROFILE_SEQUENTIAL, PROFILE_MIXED } profile_t;
+
+static const char *profile_names[] = { "uniform", "zipf", "sequential", "mixed" };
+
+//A range of addresses that receives a share of the requests.
+typedef struct {
+  uint32_t start;
+  uint32_t length;
+  double pct;
+} hotspot_t;
+
+static hotspot_t hotspots[MAX_HOTSPOTS];
+static int num_hotspots = 0;
+//Cumulative Zipf probabilities of the block ranks.
+static double zipf_cdf[NUM_BLOCKS];
+static uint32_t min_size = 1, max_size = MAX_IO_SIZE;
+//Where the current sequential run goes on, and how many requests it has left.
+static uint32_t run_next = 0;
+static int run_left = 0;
+
+//Returns a uniform number in [0, 1).
+static double uniform(void) {
+  return get_rand(0, (1 << 24) - 1) / (double)(1 << 24);
+}
+
+static void init_zipf(double skew) {
+  double sum = 0;
+  for (int rank = 0; rank < NUM_BLOCKS; rank++) {
+    sum += 1.0 / pow(rank + 1, skew);
+    zipf_cdf[rank] = sum;
+  }
+  for (int rank = 0; rank < NUM_BLOCKS; rank++)
+    zipf_cdf[rank] /= sum;
+}
+
+//Draws a block from the Zipf law. Ranks are scattered over the volume by an odd
+//multiplier, so the popular blocks are not all at the start of disk 0.
+static uint32_t zipf_block(void) {
+  double u = uniform();
+  int lo = 0, hi = NUM_BLOCKS - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (zipf_cdf[mid] <= u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (lo * 2654435761u) % NUM_BLOCKS;
+}
+
+//Returns a random address for a request of |len| bytes starting in |block|.
+static uint32_t block_addr(uint32_t block, uint32_t len) {
+  uint32_t addr = block * JBOD_BLOCK_SIZE + get_rand(0, JBOD_BLOCK_SIZE - 1);
+  return addr + len > VOLUME_SIZE ? VOLUME_SIZE - len : addr;
+}
+
+//Returns the address of the next request of the current sequential run, starting a
+//new one at a uniform address when it is over or ran off the volume.
+static uint32_t sequential_addr(uint32_t len, int run_length) {
+  if (run_left == 0 || run_next + len > VOLUME_SIZE) {
+    run_next = block_addr(get_rand(0, NUM_BLOCKS - 1), len);
+    run_left = run_length;
+  }
+  uint32_t addr = run_next;
+  run_next += len;
+  run_left -= 1;
+  return addr;
+}
+
+//Returns the address of a request of |len| bytes under |profile|, or in a hotspot.
+static uint32_t next_addr(profile_t profile, uint32_t len, int run_length, int seq_pct) {
+  double u = uniform() * 100;
+  for (int i = 0; i < num_hotspots; i++) {
+    if (u < hotspots[i].pct) {
+      uint32_t end = hotspots[i].start + hotspots[i].length;
+      uint32_t addr = hotspots[i].start + get_rand(0, hotspots[i].length - 1);
+      if (addr + len > end)
+        addr = end > hotspots[i].start + len ? end - len : hotspots[i].start;
+      return addr + len > VOLUME_SIZE ? VOLUME_SIZE - len : addr;
+    }
+    u -= hotspots[i].pct;
+  }
+  switch (profile) {
+    case PROFILE_UNIFORM:
+      return block_addr(get_rand(0, NUM_BLOCKS - 1), len);
+    case PROFILE_SEQUENTIAL:
+      return sequential_addr(len, run_length);
+    case PROFILE_MIXED:
+      if (get_rand(0, 99) < seq_pct)
+        return sequential_addr(len, run_length);
+      return block_addr(zipf_block(), len);
+    default:
+      return block_addr(zipf_block(), len);
+  }
+}
+
+static void parse_hotspot(const char *arg) {
+  unsigned start, length;
+  double pct;
+
+  if (num_hotspots == MAX_HOTSPOTS)
+    errx(1, "At most %d hotspots, aborting.", MAX_HOTSPOTS);
+  if (sscanf(arg, "%u:%u:%lf", &start, &length, &pct) != 3 || length == 0 ||
+      start >= VOLUME_SIZE || length > VOLUME_SIZE - start || pct < 0 || pct > 100)
+    errx(1, "Invalid hotspot %s, aborting.", arg);
+  hotspots[num_hotspots].start = start;
+  hotspots[num_hotspots].length = length;
+  hotspots[num_hotspots].pct = pct;
+  num_hotspots += 1;
+}
+
+static void parse_size(const char *arg) {
+  unsigned lo, hi;
+  int n = sscanf(arg, "%u-%u", &lo, &hi);
+
+  if (n == 1)
+    hi = lo;
+  if (n < 1 || lo < 1 || hi < lo || hi > MAX_IO_SIZE)
+    errx(1, "Invalid request size %s, aborting.", arg);
+  min_size = lo;
+  max_size = hi;
+}
+
+int main(int argc, char *argv[]) {
+  int ch, requests = 100000, read_pct = 70, run_length = 64, seq_pct = 50;
+  profile_t profile = PROFILE_ZIPF;
+  double skew = 0.99, hot_pct = 0;
+  const char *output = NULL;
+  bool signall = true, seeded = false;
+  uint64_t seed = 0;
+
+  while ((ch = getopt(argc, argv, GEN_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'n':
+        requests = atoi(optarg);
+        break;
+      case 'p':
+        for (profile = 0; profile < sizeof(profile_names) / sizeof(profile_names[0]); profile++)
+          if (strcmp(optarg, profile_names[profile]) == 0)
+            break;
+        if (profile == sizeof(profile_names) / sizeof(profile_names[0]))
+          errx(1, "Unknown profile (%s), aborting.", optarg);
+        break;
+      case 'r':
+        read_pct = atoi(optarg);
+        break;
+      case 'i':
+        parse_size(optarg);
+        break;
+      case 'z':
+        skew = atof(optarg);
+        break;
+      case 'q':
+        run_length = atoi(optarg);
+        break;
+      case 'm':
+        seq_pct = atoi(optarg);
+        break;
+      case 'H':
+        parse_hotspot(optarg);
+        hot_pct += hotspots[num_hotspots - 1].pct;
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 0);
+        seeded = true;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'G':
+        signall = false;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (requests < 0 || read_pct < 0 || read_pct > 100 || run_length < 1 || seq_pct < 0 ||
+      seq_pct > 100 || skew < 0 || hot_pct > 100) {
+    fprintf(stderr, USAGE);
+    return -1;
+  }
+  if (!seeded) {
+    seed = (uint64_t)get_rand(0, UINT32_MAX - 1) << 32 | get_rand(0, UINT32_MAX - 1);
+    fprintf(stderr, "seed %llu\n", (unsigned long long)seed);
+  }
+  set_rand_seed(seed);
+  init_zipf(skew);
+
+  FILE *f = output ? fopen(output, "w") : stdout;
+  if (f == NULL)
+    err(1, "Cannot open %s", output);
+  fprintf(f, "MOUNT\n");
+  for (int i = 0; i < requests; i++) {
+    uint32_t len = get_rand(min_size, max_size);
+    uint32_t addr = next_addr(profile, len, run_length, seq_pct);
+    if (get_rand(0, 99) < read_pct)
+      fprintf(f, "READ %u %u 0\n", addr, len);
+    else
+      fprintf(f, "WRITE %u %u %u\n", addr, len, get_rand(0, 255));
+  }
+  if (signall)
+    fprintf(f, "SIGNALL\n");
+  fprintf(f, "UNMOUNT\n");
+  if (f != stdout && fclose(f) != 0)
+    err(1, "Writing %s failed", output);
+  return 0;
+}